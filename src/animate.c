@@ -0,0 +1,137 @@
+#include "animate.h"
+#include "profiler.h"
+#include "mem_track.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+
+#define ANIMATE_HEIGHT_EPSILON 1e-6f
+
+TerrainAnimator *animator_create(bool flat, int rings, int sides, const TerrainParams *params) {
+    TerrainAnimator *animator = mem_calloc(MEM_EDIT, sizeof(TerrainAnimator));
+    int count = rings * sides;
+    animator->flat = flat;
+    animator->rings = rings;
+    animator->sides = sides;
+    animator->count = count;
+    animator->u = mem_alloc(MEM_EDIT, count * sizeof(float));
+    animator->v = mem_alloc(MEM_EDIT, count * sizeof(float));
+    animator->base = mem_alloc(MEM_EDIT, count * sizeof(Vector3));
+    animator->dir = mem_alloc(MEM_EDIT, count * sizeof(Vector3));
+    animator->heights = mem_alloc(MEM_EDIT, count * sizeof(float));
+    animator->prevHeights = mem_alloc(MEM_EDIT, count * sizeof(float));
+    animator->grads = mem_alloc(MEM_EDIT, count * 2 * sizeof(float));
+    animator->dirty = mem_alloc(MEM_EDIT, count);
+    mesh_sample_pixels(flat, rings, sides, animator->u, animator->v);
+    animator->footprint = mesh_sample_footprint(flat, rings, sides);
+    mesh_vertex_frames(flat, rings, sides, animator->base, animator->dir);
+    animator->trig = torus_trig_table_create(rings, sides);
+
+    // The unshifted terrain fixes the height scale for the whole animation
+    terrain_height_batch(animator->u, animator->v, count, params, 0.0f, animator->footprint, animator->prevHeights, NULL);
+    float min = FLT_MAX;
+    float max = -FLT_MAX;
+    for (int k = 0; k < count; k++) {
+        if (animator->prevHeights[k] < min) min = animator->prevHeights[k];
+        if (animator->prevHeights[k] > max) max = animator->prevHeights[k];
+    }
+    if (max <= min) max = min + 1.0f;
+    animator->min = min;
+    animator->gradient = MESH_HEIGHT_RANGE / (max - min);
+    // Force the first update to rewrite every vertex
+    for (int k = 0; k < count; k++) animator->prevHeights[k] = -1.0f;
+    return animator;
+}
+
+void animator_update(TerrainAnimator *animator, Mesh *mesh, const TerrainParams *params, float time) {
+    PROF_BEGIN("animate terrain");
+    uint64_t start = prof_now_ns();
+    int sides = animator->sides, count = animator->count;
+
+    terrain_height_batch(animator->u, animator->v, count, params, time * ANIMATE_WARP_SPEED, animator->footprint,
+                         animator->heights, animator->grads);
+    animator->evalMs = (double)(prof_now_ns() - start) / 1.0e6;
+
+    // Re-place moved vertices; each normal needs only its own vertex's gradient
+    Vector3 *positions = (Vector3 *)mesh->vertices;
+    Vector3 *normals = (Vector3 *)mesh->normals;
+    const float *grads = animator->grads;
+    float gradient = animator->gradient;
+    int changed = 0;
+    int first = count, last = -1;
+    #pragma omp parallel for schedule(static) reduction(+:changed) reduction(min:first) reduction(max:last)
+    for (int k = 0; k < count; k++) {
+        float h = animator->heights[k];
+        animator->dirty[k] = fabsf(h - animator->prevHeights[k]) > ANIMATE_HEIGHT_EPSILON;
+        if (!animator->dirty[k]) continue;
+        animator->prevHeights[k] = h;
+        float adjusted = (h - animator->min) * gradient;
+        positions[k] = Vector3Add(animator->base[k], Vector3Scale(animator->dir[k], adjusted));
+        normals[k] = mesh_surface_normal(animator->trig, animator->flat, k / sides, k % sides,
+                                         adjusted, grads[2 * k] * gradient, grads[2 * k + 1] * gradient);
+        if (k < first) first = k;
+        if (k > last) last = k;
+        changed++;
+    }
+
+    // Stream the one contiguous span that covers every touched vertex
+    if (last >= first && mesh->vboId != NULL) {
+        int offset = first * sizeof(Vector3);
+        int size = (last - first + 1) * sizeof(Vector3);
+        UpdateMeshBuffer(*mesh, 0, (char *)mesh->vertices + offset, size, offset);
+        UpdateMeshBuffer(*mesh, 2, (char *)mesh->normals + offset, size, offset);
+    }
+
+    animator->changed = changed;
+    animator->totalMs = (double)(prof_now_ns() - start) / 1.0e6;
+    PROF_COUNTER("animated vertices", changed);
+    PROF_END();
+}
+
+MeshSnapshot mesh_snapshot_take(Mesh mesh) {
+    MeshSnapshot snapshot = { 0 };
+    size_t size = mesh.vertexCount * 3 * sizeof(float);
+    snapshot.vertexCount = mesh.vertexCount;
+    snapshot.vertices = mem_alloc(MEM_EDIT, size);
+    snapshot.normals = mem_alloc(MEM_EDIT, size);
+    memcpy(snapshot.vertices, mesh.vertices, size);
+    memcpy(snapshot.normals, mesh.normals, size);
+    return snapshot;
+}
+
+void mesh_snapshot_restore(MeshSnapshot *snapshot, Mesh *mesh) {
+    if (snapshot->vertices && snapshot->vertexCount == mesh->vertexCount) {
+        int size = mesh->vertexCount * 3 * sizeof(float);
+        memcpy(mesh->vertices, snapshot->vertices, size);
+        memcpy(mesh->normals, snapshot->normals, size);
+        if (mesh->vboId != NULL) {
+            UpdateMeshBuffer(*mesh, 0, mesh->vertices, size, 0);  // SHADER_LOC_VERTEX_POSITION
+            UpdateMeshBuffer(*mesh, 2, mesh->normals, size, 0);   // SHADER_LOC_VERTEX_NORMAL
+        }
+    }
+    mesh_snapshot_free(snapshot);
+}
+
+void mesh_snapshot_free(MeshSnapshot *snapshot) {
+    size_t size = snapshot->vertexCount * 3 * sizeof(float);
+    mem_free(MEM_EDIT, snapshot->vertices, size);
+    mem_free(MEM_EDIT, snapshot->normals, size);
+    *snapshot = (MeshSnapshot){ 0 };
+}
+
+void animator_destroy(TerrainAnimator *animator) {
+    if (!animator) return;
+    int count = animator->count;
+    mem_free(MEM_EDIT, animator->u, count * sizeof(float));
+    mem_free(MEM_EDIT, animator->v, count * sizeof(float));
+    mem_free(MEM_EDIT, animator->base, count * sizeof(Vector3));
+    mem_free(MEM_EDIT, animator->dir, count * sizeof(Vector3));
+    torus_trig_table_destroy(animator->trig);
+    mem_free(MEM_EDIT, animator->heights, count * sizeof(float));
+    mem_free(MEM_EDIT, animator->prevHeights, count * sizeof(float));
+    mem_free(MEM_EDIT, animator->grads, count * 2 * sizeof(float));
+    mem_free(MEM_EDIT, animator->dirty, count);
+    mem_free(MEM_EDIT, animator, sizeof(TerrainAnimator));
+}
@@ -0,0 +1,48 @@
+#ifndef ANIMATE_H
+#define ANIMATE_H
+
+#include <stdbool.h>
+#include "raylib.h"
+#include "torus.h"
+
+#define ANIMATE_WARP_SPEED 0.05f   // warp shift in noise units per second
+
+// Animated terrain for one full-resolution mesh: each frame the heights are re-evaluated
+// at the mesh vertices only, with the warp field shifted by time. Vertices whose height
+// moved are re-placed and get an analytic normal from the height gradient, and the
+// touched span of the vertex and normal buffers is streamed with UpdateMeshBuffer.
+typedef struct TerrainAnimator {
+    bool flat;
+    int rings, sides, count;
+    float *u, *v;               // sample pixels
+    float footprint;            // vertex spacing in pixels; finer octaves are skipped
+    Vector3 *base, *dir;        // undisplaced positions and displacement directions
+    TorusTrigTable *trig;
+    float *heights, *prevHeights;
+    float *grads;               // dh/du, dh/dv per vertex
+    unsigned char *dirty;
+    float min, gradient;        // fixed at creation so unchanged vertices stay put
+
+    // Last update, for the overlay
+    int changed;
+    double evalMs, totalMs;
+} TerrainAnimator;
+
+TerrainAnimator *animator_create(bool flat, int rings, int sides, const TerrainParams *params);
+void animator_update(TerrainAnimator *animator, Mesh *mesh, const TerrainParams *params, float time);
+void animator_destroy(TerrainAnimator *animator);
+
+// The vertices and normals a mesh had before animation took it over. The startup meshes
+// carry erosion, the heightmap warp and bicubic sampling, which direct noise does not
+// reproduce, so they are put back as they were rather than regenerated.
+typedef struct MeshSnapshot {
+    float *vertices, *normals;  // NULL when nothing is held
+    int vertexCount;
+} MeshSnapshot;
+
+MeshSnapshot mesh_snapshot_take(Mesh mesh);
+// Copies the snapshot back into mesh and its GPU buffers, then releases it.
+void mesh_snapshot_restore(MeshSnapshot *snapshot, Mesh *mesh);
+void mesh_snapshot_free(MeshSnapshot *snapshot);
+
+#endif // ANIMATE_H
@@ -1,5 +1,9 @@
 
 #include "camera.h"
+#include "profiler.h"
+#include "torus.h"
+
+#include <stdio.h>
 
 void UpdateCameraManual(Camera3D *camera)
 {
@@ -46,3 +50,142 @@ void UpdateCameraManual(Camera3D *camera)
     camera->up = (Vector3){ 0.0f, 1.0f, 0.0f };
 }
 
+
+void terrain_camera_init(TerrainCamera *tc, const TerrainPicker *torus, const TerrainPicker *terrain) {
+    tc->mode = TERRAIN_CAMERA_ORBIT;
+    ground_cache_init(&tc->ground[0], torus);
+    ground_cache_init(&tc->ground[1], terrain);
+    tc->clearance = 20.0f;
+    tc->hidden[0] = tc->hidden[1] = false;
+    tc->walkSurface = 1;
+    tc->theta = PI / 2.0f;
+    tc->phi = PI / 2.0f;
+    tc->heading = 0.0f;
+    tc->pitch = 0.0f;
+    tc->eyeHeight = 10.0f;
+    tc->speed = 100.0f;
+}
+
+void terrain_camera_walk_from(TerrainCamera *tc, const Camera3D *camera, int surface) {
+    GroundSample sample;
+    if (tc->hidden[surface]) surface = 1 - surface;
+    tc->walkSurface = surface;
+    if (ground_under(&tc->ground[surface], camera->target, &sample)) {
+        tc->theta = sample.theta;
+        tc->phi = sample.phi;
+    }
+    tc->pitch = 0.0f;
+}
+
+// Pushes the camera out along the displacement direction wherever it is closer to a
+// surface than the clearance, or below it.
+static void clamp_to_ground(Camera3D *camera, TerrainCamera *tc) {
+    for (int s = 0; s < 2; s++) {
+        GroundSample sample;
+        if (tc->hidden[s]) continue;
+        if (!ground_under(&tc->ground[s], camera->position, &sample)) continue;
+        if (sample.clearance >= tc->clearance) continue;
+        camera->position = Vector3Add(camera->position, Vector3Scale(sample.frame.up, tc->clearance - sample.clearance));
+    }
+}
+
+static void update_walk(Camera3D *camera, TerrainCamera *tc) {
+    float dt = GetFrameTime();
+    if (IsKeyDown(KEY_A)) tc->heading -= 1.5f * dt;
+    if (IsKeyDown(KEY_D)) tc->heading += 1.5f * dt;
+    if (IsMouseButtonDown(MOUSE_RIGHT_BUTTON)) {
+        Vector2 delta = GetMouseDelta();
+        tc->heading += delta.x * 0.005f;
+        tc->pitch -= delta.y * 0.005f;
+        if (tc->pitch > PI/2.0f - 0.01f) tc->pitch = PI/2.0f - 0.01f;
+        if (tc->pitch < -PI/2.0f + 0.01f) tc->pitch = -PI/2.0f + 0.01f;
+    }
+
+    GroundCache *ground = &tc->ground[tc->walkSurface];
+    GroundSample sample;
+    if (!ground_at(ground, tc->theta, tc->phi, &sample)) return;
+
+    float step = ((IsKeyDown(KEY_W) ? 1.0f : 0.0f) - (IsKeyDown(KEY_S) ? 1.0f : 0.0f)) * tc->speed * dt;
+    if (IsKeyDown(KEY_LEFT_SHIFT)) step *= 4.0f;
+    if (step != 0.0f) {
+        // Move in parameter space, scaled so the step is the same length in world units
+        float theta = tc->theta + step * cosf(tc->heading) / sample.frame.metricTheta;
+        float phi = tc->phi + step * sinf(tc->heading) / sample.frame.metricPhi;
+        GroundSample next;
+        if (ground_at(ground, theta, phi, &next)) {
+            tc->theta = next.theta;
+            tc->phi = next.phi;
+            sample = next;
+        }
+    }
+
+    SurfaceFrame *frame = &sample.frame;
+    Vector3 forward = Vector3Add(Vector3Scale(frame->alongTheta, cosf(tc->heading)), Vector3Scale(frame->alongPhi, sinf(tc->heading)));
+    Vector3 look = Vector3Add(Vector3Scale(forward, cosf(tc->pitch)), Vector3Scale(frame->up, sinf(tc->pitch)));
+    camera->position = Vector3Add(frame->position, Vector3Scale(frame->up, tc->eyeHeight));
+    camera->target = Vector3Add(camera->position, Vector3Scale(look, 100.0f));
+    camera->up = frame->up;
+}
+
+void UpdateCameraTerrain(Camera3D *camera, TerrainCamera *tc) {
+    switch (tc->mode) {
+        case TERRAIN_CAMERA_WALK:
+            // Step off a surface that was hidden under the walker
+            if (tc->hidden[tc->walkSurface]) terrain_camera_walk_from(tc, camera, tc->walkSurface);
+            update_walk(camera, tc);
+            break;
+        case TERRAIN_CAMERA_CLAMPED:
+            UpdateCameraManual(camera);
+            clamp_to_ground(camera, tc);
+            break;
+        default:
+            UpdateCameraManual(camera);
+            break;
+    }
+}
+
+void terrain_camera_benchmark(TerrainPicker *torus, TerrainPicker *terrain, int steps) {
+    TerrainPicker *pickers[2] = { torus, terrain };
+    const char *names[2] = { "torus", "terrain" };
+    for (int s = 0; s < 2; s++) {
+        TerrainPicker *picker = pickers[s];
+        GroundCache cache;
+        ground_cache_init(&cache, picker);
+
+        // Three laps around the theta direction while weaving in phi; the flat patch is
+        // walked inside its edges
+        float thetaSpan = picker->flat ? 2.0f * PI * (picker->rings - 1) / picker->rings : 6.0f * PI;
+        float phiMid = picker->flat ? PI * (picker->sides - 1) / picker->sides : PI;
+        float phiAmp = picker->flat ? 0.8f * phiMid : PI;
+        double sum = 0.0;
+        int ok = 0;
+
+        uint64_t start = prof_now_ns();
+        for (int k = 0; k < steps; k++) {
+            float t = (float)k / steps;
+            GroundSample sample;
+            if (ground_at(&cache, t * thetaSpan, phiMid + phiAmp * sinf(t * 40.0f), &sample)) {
+                sum += sample.height;
+                ok++;
+            }
+        }
+        double cachedNs = (double)(prof_now_ns() - start) / steps;
+
+        // The same path, each query a ray cast down from above the surface
+        int raySteps = steps / 16 > 0 ? steps / 16 : 1;
+        double raySum = 0.0;
+        start = prof_now_ns();
+        for (int k = 0; k < raySteps; k++) {
+            float t = (float)k / raySteps;
+            GroundSample sample;
+            if (!ground_at(&cache, t * thetaSpan, phiMid + phiAmp * sinf(t * 40.0f), &sample)) continue;
+            Vector3 above = Vector3Add(sample.frame.position, Vector3Scale(sample.frame.up, MESH_HEIGHT_RANGE));
+            PickHit hit = picker_cast(picker, (Ray){ above, Vector3Negate(sample.frame.up) });
+            if (hit.hit) raySum += hit.height;
+        }
+        double rayNs = (double)(prof_now_ns() - start) / raySteps;
+
+        printf("Camera ground bench (%s): %d queries, %.1f ns/query cached, %.1f ns/query by ray cast, %d window refills, mean height %.2f / %.2f\n",
+               names[s], steps, cachedNs, rayNs, cache.refills, sum / (ok > 0 ? ok : 1), raySum / raySteps);
+    }
+}
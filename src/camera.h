@@ -3,7 +3,40 @@
 
 #include "raylib.h"
 #include "raymath.h"
+#include "ground.h"
+
+typedef enum TerrainCameraMode {
+    TERRAIN_CAMERA_ORBIT,       // free orbit (UpdateCameraManual)
+    TERRAIN_CAMERA_CLAMPED,     // the same orbit, kept above both surfaces
+    TERRAIN_CAMERA_WALK,        // first person on the torus or the flat terrain
+    TERRAIN_CAMERA_MODE_COUNT
+} TerrainCameraMode;
+
+typedef struct TerrainCamera {
+    TerrainCameraMode mode;
+    GroundCache ground[2];      // [0] torus, [1] flat terrain
+    float clearance;            // minimum height above the surface when clamped
+    bool hidden[2];             // surfaces not drawn (the flat patch while tiles stream) are neither clamped to nor walked on
+
+    // Walk mode
+    int walkSurface;            // index into ground
+    float theta, phi;           // position on the surface
+    float heading;              // radians from the +theta direction towards +phi
+    float pitch;
+    float eyeHeight, speed;     // world units, world units per second
+} TerrainCamera;
 
 void UpdateCameraManual(Camera3D *camera);
 
-#endif // CAMERA_H
\ No newline at end of file
+// The pickers' heights must be current; see picker_set_heights_from_mesh().
+void terrain_camera_init(TerrainCamera *tc, const TerrainPicker *torus, const TerrainPicker *terrain);
+// Starts walking on surface (0 torus, 1 flat terrain) at the ground under the camera's target,
+// or on the other surface if that one is hidden.
+void terrain_camera_walk_from(TerrainCamera *tc, const Camera3D *camera, int surface);
+void UpdateCameraTerrain(Camera3D *camera, TerrainCamera *tc);
+
+// Walks a scripted path over both surfaces and prints the cost of cached ground queries
+// against casting a ray down to the surface for each.
+void terrain_camera_benchmark(TerrainPicker *torus, TerrainPicker *terrain, int steps);
+
+#endif // CAMERA_H
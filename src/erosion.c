@@ -0,0 +1,287 @@
+#include "erosion.h"
+#include "torus.h"
+#include "save.h"
+#include "profiler.h"
+#include "mem_track.h"
+#include "stencil.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define EROSION_TILE 64         // target tile size, pixels
+#define EROSION_ROUNDS 4        // each tile's droplets are spread over this many rounds
+#define THERMAL_RATE 0.1f       // share of the excess drop moved per thermal step; see stencil.h
+
+static ErosionParams heightmapErosion = EROSION_DEFAULT_PARAMS;
+
+void SetHeightmapErosion(const ErosionParams *params) {
+    heightmapErosion = *params;
+}
+
+ErosionParams GetHeightmapErosion(void) {
+    return heightmapErosion;
+}
+
+bool erosion_enabled(const ErosionParams *params) {
+    return params->droplets > 0 || params->thermalSteps > 0;
+}
+
+// splitmix64: a seed for each (seed, round, tile) and a cheap stream from it.
+static uint64_t next_random(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static float random_unit(uint64_t *state) {
+    return (float)(next_random(state) >> 40) / (float)(1u << 24);
+}
+
+typedef struct ErosionBrush {
+    int count, capacity;
+    int *offset;            // into an ErosionBlock of the stride the brush was made for
+    float *weight;          // sums to 1
+} ErosionBrush;
+
+static ErosionBrush make_brush(int radius, int stride) {
+    ErosionBrush brush = { 0 };
+    int side = 2 * radius + 1;
+    brush.capacity = side * side;
+    brush.offset = mem_alloc(MEM_SCRATCH, brush.capacity * sizeof(int));
+    brush.weight = mem_alloc(MEM_SCRATCH, brush.capacity * sizeof(float));
+    float sum = 0.0f;
+    for (int dv = -radius; dv <= radius; dv++) {
+        for (int du = -radius; du <= radius; du++) {
+            float w = (float)radius - sqrtf((float)(du * du + dv * dv));
+            if (w <= 0.0f) continue;
+            brush.offset[brush.count] = dv * stride + du;
+            brush.weight[brush.count] = w;
+            brush.count++;
+            sum += w;
+        }
+    }
+    for (int k = 0; k < brush.count; k++) brush.weight[k] /= sum;
+    return brush;
+}
+
+static void free_brush(ErosionBrush *brush) {
+    mem_free(MEM_SCRATCH, brush->offset, brush->capacity * sizeof(int));
+    mem_free(MEM_SCRATCH, brush->weight, brush->capacity * sizeof(float));
+}
+
+// A tile and the apron its droplets can reach, copied out of the wrapped heightmap so
+// the droplet loop indexes a small contiguous block without wrapping.
+typedef struct ErosionBlock {
+    float *h;
+    int size;               // floats per row and rows allocated
+    int width, height;      // in use
+    int originU, originV;   // heightmap pixel of h[0], unwrapped
+} ErosionBlock;
+
+static void load_block(ErosionBlock *block, float **heightmap, int mapWidth, int mapHeight) {
+    for (int y = 0; y < block->height; y++) {
+        int v = ((block->originV + y) % mapHeight + mapHeight) % mapHeight;
+        int u = (block->originU % mapWidth + mapWidth) % mapWidth;
+        for (int x = 0; x < block->width; x++) {
+            block->h[y * block->size + x] = heightmap[v][u];
+            if (++u == mapWidth) u = 0;
+        }
+    }
+}
+
+static void store_block(const ErosionBlock *block, float **heightmap, int mapWidth, int mapHeight) {
+    for (int y = 0; y < block->height; y++) {
+        int v = ((block->originV + y) % mapHeight + mapHeight) % mapHeight;
+        int u = (block->originU % mapWidth + mapWidth) % mapWidth;
+        for (int x = 0; x < block->width; x++) {
+            heightmap[v][u] = block->h[y * block->size + x];
+            if (++u == mapWidth) u = 0;
+        }
+    }
+}
+
+// Bilinear height and gradient at block coordinates (x, y).
+static inline float sample_height(const ErosionBlock *block, float x, float y, float *gx, float *gy) {
+    int ix = (int)x, iy = (int)y;
+    float s = x - ix, t = y - iy;
+    const float *row = block->h + iy * block->size + ix;
+    float h00 = row[0], h10 = row[1];
+    float h01 = row[block->size], h11 = row[block->size + 1];
+    *gx = (h10 - h00) * (1.0f - t) + (h11 - h01) * t;
+    *gy = (h01 - h00) * (1.0f - s) + (h11 - h10) * s;
+    return h00 * (1.0f - s) * (1.0f - t) + h10 * s * (1.0f - t) + h01 * (1.0f - s) * t + h11 * s * t;
+}
+
+// Runs count droplets started inside the tile [x0, x1) x [y0, y1) of the block; they die
+// once they leave the block's interior, where the brush and bilinear reads still fit.
+static void run_droplets(ErosionBlock *block, int x0, int y0, int x1, int y1, int count,
+                         uint64_t rng, const ErosionParams *p, const ErosionBrush *brush) {
+    int reach = p->radius > 0 ? p->radius : 1;
+    float lo = (float)reach;
+    float hiX = (float)(block->width - reach - 2), hiY = (float)(block->height - reach - 2);
+    int stride = block->size;
+    float *h = block->h;
+    for (int d = 0; d < count; d++) {
+        float x = x0 + random_unit(&rng) * (x1 - x0);
+        float y = y0 + random_unit(&rng) * (y1 - y0);
+        float dirX = 0.0f, dirY = 0.0f;
+        float speed = 1.0f, water = 1.0f, sediment = 0.0f;
+
+        for (int step = 0; step < p->lifetime; step++) {
+            int ix = (int)x, iy = (int)y;
+            float s = x - ix, t = y - iy;
+            float gx, gy;
+            float height = sample_height(block, x, y, &gx, &gy);
+
+            dirX = dirX * p->inertia - gx * (1.0f - p->inertia);
+            dirY = dirY * p->inertia - gy * (1.0f - p->inertia);
+            float len = sqrtf(dirX * dirX + dirY * dirY);
+            if (len < 1e-12f) break;            // flat: nowhere to flow
+            x += dirX / len;
+            y += dirY / len;
+            if (x < lo || x > hiX || y < lo || y > hiY) break;
+
+            float ngx, ngy;
+            float dh = sample_height(block, x, y, &ngx, &ngy) - height;
+            float descent = -dh > p->minSlope ? -dh : p->minSlope;
+            float capacity = descent * speed * water * p->capacity;
+
+            float *cell = h + iy * stride + ix;
+            if (sediment > capacity || dh > 0.0f) {
+                // Fill the pit behind an uphill step, or drop the excess, at the old position
+                float deposit = dh > 0.0f ? (dh < sediment ? dh : sediment) : (sediment - capacity) * p->depositSpeed;
+                sediment -= deposit;
+                cell[0] += deposit * (1.0f - s) * (1.0f - t);
+                cell[1] += deposit * s * (1.0f - t);
+                cell[stride] += deposit * (1.0f - s) * t;
+                cell[stride + 1] += deposit * s * t;
+            } else {
+                // Never dig deeper than the descent, or a droplet carves its own pit
+                float erode = (capacity - sediment) * p->erodeSpeed;
+                if (erode > -dh) erode = -dh;
+                // Heights stay far above one step's erosion, so only the final pass clamps at 0
+                for (int k = 0; k < brush->count; k++) cell[brush->offset[k]] -= erode * brush->weight[k];
+                sediment += erode;
+            }
+            float speed2 = speed * speed - dh * p->gravity;
+            speed = speed2 > 0.0f ? sqrtf(speed2) : 0.0f;
+            water *= 1.0f - p->evaporation;
+        }
+    }
+}
+
+typedef struct ErosionTile {
+    int u0, v0, u1, v1;     // pixels [u0, u1) x [v0, v1)
+} ErosionTile;
+
+// Tile boundaries along one axis: an even count so the checkerboard wraps cleanly.
+static int split_axis(int size, int *bounds) {
+    int count = size / EROSION_TILE;
+    if (count < 2) count = 2;
+    if (count % 2) count++;
+    for (int k = 0; k <= count; k++) bounds[k] = (int)((int64_t)k * size / count);
+    return count;
+}
+
+static void erode_droplets(float **heightmap, int width, int height, const ErosionParams *params) {
+    if (params->droplets <= 0) return;
+    PROF_BEGIN("erosion");
+    uint64_t start = prof_now_ns();
+
+    size_t boundsUSize = (width / EROSION_TILE + 3) * sizeof(int), boundsVSize = (height / EROSION_TILE + 3) * sizeof(int);
+    int *boundsU = mem_alloc(MEM_SCRATCH, boundsUSize);
+    int *boundsV = mem_alloc(MEM_SCRATCH, boundsVSize);
+    int tilesU = split_axis(width, boundsU), tilesV = split_axis(height, boundsV);
+    int tileCount = tilesU * tilesV;
+    ErosionTile *tiles = mem_alloc(MEM_SCRATCH, tileCount * sizeof(ErosionTile));
+    int minTile = width, maxTile = 0;
+    for (int tv = 0; tv < tilesV; tv++) {
+        for (int tu = 0; tu < tilesU; tu++) {
+            ErosionTile *tile = &tiles[tv * tilesU + tu];
+            *tile = (ErosionTile){ boundsU[tu], boundsV[tv], boundsU[tu + 1], boundsV[tv + 1] };
+            int tileWidth = tile->u1 - tile->u0, tileHeight = tile->v1 - tile->v0;
+            if (tileWidth < minTile) minTile = tileWidth;
+            if (tileHeight < minTile) minTile = tileHeight;
+            if (tileWidth > maxTile) maxTile = tileWidth;
+            if (tileHeight > maxTile) maxTile = tileHeight;
+        }
+    }
+    // Same-colour tiles are a whole tile apart, so blocks reaching half a tile beyond
+    // their tile on each side never overlap
+    int apron = minTile / 2;
+    int blockSize = maxTile + 2 * apron;
+
+    ErosionBrush brush = make_brush(params->radius > 0 ? params->radius : 1, blockSize);
+    int64_t perTileRound = ((int64_t)params->droplets + (int64_t)tileCount * EROSION_ROUNDS - 1) / ((int64_t)tileCount * EROSION_ROUNDS);
+    int64_t done = 0;
+
+    for (int round = 0; round < EROSION_ROUNDS; round++) {
+        for (int colour = 0; colour < 4; colour++) {
+            PROF_BEGIN("erosion pass");
+            int colourU = colour & 1, colourV = colour >> 1;
+            #pragma omp parallel
+            {
+                size_t blockBytes = (size_t)blockSize * blockSize * sizeof(float);
+                ErosionBlock block = { mem_alloc(MEM_SCRATCH, blockBytes), blockSize };
+                #pragma omp for schedule(dynamic, 1)
+                for (int t = 0; t < tileCount; t++) {
+                    int tu = t % tilesU, tv = t / tilesU;
+                    if (tu % 2 != colourU || tv % 2 != colourV) continue;
+                    const ErosionTile *tile = &tiles[t];
+                    block.originU = tile->u0 - apron;
+                    block.originV = tile->v0 - apron;
+                    block.width = tile->u1 - tile->u0 + 2 * apron;
+                    block.height = tile->v1 - tile->v0 + 2 * apron;
+                    load_block(&block, heightmap, width, height);
+                    uint64_t rng = ((uint64_t)params->seed << 32) ^ ((uint64_t)round << 24) ^ (uint64_t)t;
+                    next_random(&rng);
+                    run_droplets(&block, apron, apron, block.width - apron, block.height - apron, (int)perTileRound, rng, params, &brush);
+                    store_block(&block, heightmap, width, height);
+                }
+                mem_free(MEM_SCRATCH, block.h, blockBytes);
+            }
+            done += perTileRound * (tileCount / 4);
+            PROF_COUNTER("erosion droplets", done);
+            PROF_END();
+        }
+    }
+
+    #pragma omp parallel for schedule(static)
+    for (int v = 0; v < height; v++) {
+        for (int u = 0; u < width; u++) heightmap[v][u] = fminf(fmaxf(heightmap[v][u], 0.0f), 1.0f);
+    }
+
+    double seconds = (double)(prof_now_ns() - start) / 1.0e9;
+    printf("Erosion: %lld droplets on %dx%d tiles (apron %d px) in %.1f ms, %.2f M droplets/s\n",
+           (long long)done, tilesU, tilesV, apron, seconds * 1000.0, done / seconds / 1.0e6);
+    free_brush(&brush);
+    mem_free(MEM_SCRATCH, tiles, tileCount * sizeof(ErosionTile));
+    mem_free(MEM_SCRATCH, boundsU, boundsUSize);
+    mem_free(MEM_SCRATCH, boundsV, boundsVSize);
+    PROF_END();
+}
+
+// Slumps the slopes steeper than the talus, such as the walls of droplet channels. Mass is
+// conserved and every sample moves towards its neighbours, so heights stay in [0, 1].
+static void erode_thermal(float **heightmap, int width, int height, const ErosionParams *params) {
+    if (params->thermalSteps <= 0) return;
+    uint64_t start = prof_now_ns();
+    stencil_thermal_erosion(heightmap, width, height, params->talus, THERMAL_RATE, params->thermalSteps);
+    printf("Thermal erosion: %d steps (talus %g) in %.1f ms\n",
+           params->thermalSteps, params->talus, (double)(prof_now_ns() - start) / 1.0e6);
+}
+
+void erode_heightmap(float **heightmap, int width, int height, const ErosionParams *params) {
+    erode_droplets(heightmap, width, height, params);
+    erode_thermal(heightmap, width, height, params);
+}
+
+float **get_eroded_heightmap(const char *filename, const char *sourceFile, const ErosionParams *params) {
+    if (heightmap_exists(filename)) return get_heightmap(filename);
+    float **heightmap = get_heightmap(sourceFile);
+    store_heightmap(sourceFile, heightmap);
+    erode_heightmap(heightmap, SCREEN_WIDTH, SCREEN_HEIGHT, params);
+    return heightmap;
+}
@@ -0,0 +1,47 @@
+#ifndef EROSION_H
+#define EROSION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Droplet hydraulic erosion of the periodic heightmap.
+//
+// The map is split into an even number of tiles in each direction and the tiles are
+// coloured like a 2x2 checkerboard, which stays consistent across the wrap-around seams.
+// Droplets start in a tile and die once they stray more than a margin outside it, and
+// the margin is small enough that tiles of one colour never touch the same pixels. Each
+// colour's tiles then run in parallel, one colour after another, for several rounds.
+// Every tile draws its droplets from its own generator seeded by (seed, round, tile), so
+// the result depends only on the parameters, not on the thread count or schedule.
+typedef struct ErosionParams {
+    int droplets;           // total over the map; 0 disables erosion
+    uint32_t seed;
+    int lifetime;           // steps before a droplet dies
+    int radius;             // erosion brush radius, pixels
+    float inertia;          // how much a droplet keeps its direction, [0, 1]
+    float capacity;         // sediment carried per unit of speed, water and descent
+    float minSlope;         // floor on the descent used for capacity
+    float erodeSpeed, depositSpeed;
+    float evaporation;      // fraction of water lost per step
+    float gravity;
+    int thermalSteps;       // talus slumping passes after the droplets (see stencil.h); 0 skips them
+    float talus;            // steepest drop between neighbouring pixels that stays put
+} ErosionParams;
+
+#define EROSION_DEFAULT_PARAMS ((ErosionParams){ 0, 1, 30, 3, 0.05f, 4.0f, 0.01f, 0.3f, 0.3f, 0.01f, 4.0f, 0, 0.004f })
+
+// Parameters for the startup heightmap; with no droplets and no thermal steps (the default)
+// it is left as generated.
+void SetHeightmapErosion(const ErosionParams *params);
+ErosionParams GetHeightmapErosion(void);
+bool erosion_enabled(const ErosionParams *params);
+
+// Erodes heightmap[height][width] in place, droplets first and then the thermal passes;
+// heights stay in [0, 1].
+void erode_heightmap(float **heightmap, int width, int height, const ErosionParams *params);
+
+// The cached eroded heightmap in filename, or else the one in sourceFile (generated and
+// cached if need be) eroded with params. The caller caches the result under filename.
+float **get_eroded_heightmap(const char *filename, const char *sourceFile, const ErosionParams *params);
+
+#endif // EROSION_H
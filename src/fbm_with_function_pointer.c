@@ -1,5 +1,8 @@
 #include "fbm_with_function_pointer.h"
 
+#include <float.h>
+#include <math.h>
+
 float fbm3d_fn(float x, float y, float z, int octaves, float lacunarity, float gain, NoiseFunction3D noise) {
     float total = 0.0f;
     float frequency = 1.0f;
@@ -30,4 +33,62 @@ float fbm4d_fn(float x, float y, float z, float w, int octaves, float lacunarity
     }
 
     return (total / maxValue + 1.0f) / 2.0f;  // Normalise to [0, 1]
-}
\ No newline at end of file
+}
+// Band limit for a sample spacing of footprint (in noise units): octave i gets weight
+// clamp(limit - i, 0, 1), so octaves at or above the Nyquist frequency are dropped and the
+// last one below it fades in instead of popping. A footprint <= 0 keeps every octave.
+float fbm_octave_limit(float footprint, float lacunarity) {
+    if (footprint <= 0.0f || lacunarity <= 1.0f) return FLT_MAX;
+    return logf(0.5f / footprint) / logf(lacunarity);
+}
+
+// fbm4d_fn without the octaves a sample spacing of footprint cannot resolve. Dropped octaves
+// still count towards maxValue: they average to zero, so the filtered result keeps the same
+// mean and scale. With footprint <= 0 it returns exactly what fbm4d_fn does.
+float fbm4d_fn_filtered(float x, float y, float z, float w, int octaves, float lacunarity, float gain, float footprint, NoiseFunction4D noise) {
+    float limit = fbm_octave_limit(footprint, lacunarity);
+    float total = 0.0f;
+    float frequency = 1.0f;
+    float amplitude = 1.0f;
+    float maxValue = 0.0f;
+
+    for (int i = 0; i < octaves; i++) {
+        float weight = limit - i;
+        if (weight >= 1.0f) {
+            total += noise(x * frequency, y * frequency, z * frequency, w * frequency) * amplitude;
+        } else if (weight > 0.0f) {
+            total += noise(x * frequency, y * frequency, z * frequency, w * frequency) * amplitude * weight;
+        }
+        maxValue += amplitude;
+        amplitude *= gain;
+        frequency *= lacunarity;
+    }
+
+    return (total / maxValue + 1.0f) / 2.0f;  // Normalise to [0, 1]
+}
+
+// fbm4d_fn_filtered plus the gradient of its normalised result.
+float fbm4d_fn_deriv(float x, float y, float z, float w, int octaves, float lacunarity, float gain, float footprint, NoiseFunction4DDeriv noise, float grad[4]) {
+    float limit = fbm_octave_limit(footprint, lacunarity);
+    float total = 0.0f;
+    float frequency = 1.0f;
+    float amplitude = 1.0f;
+    float maxValue = 0.0f;
+    grad[0] = grad[1] = grad[2] = grad[3] = 0.0f;
+
+    for (int i = 0; i < octaves; i++) {
+        float weight = limit - i;
+        if (weight > 0.0f) {
+            float g[4];
+            float scaled = weight >= 1.0f ? amplitude : amplitude * weight;
+            total += noise(x * frequency, y * frequency, z * frequency, w * frequency, g) * scaled;
+            for (int a = 0; a < 4; a++) grad[a] += g[a] * scaled * frequency;
+        }
+        maxValue += amplitude;
+        amplitude *= gain;
+        frequency *= lacunarity;
+    }
+
+    for (int a = 0; a < 4; a++) grad[a] /= 2.0f * maxValue;
+    return (total / maxValue + 1.0f) / 2.0f;  // Normalise to [0, 1]
+}
@@ -7,9 +7,13 @@
 
 typedef float (*NoiseFunction3D)(float, float, float);
 typedef float (*NoiseFunction4D)(float, float, float, float);
+typedef float (*NoiseFunction4DDeriv)(float, float, float, float, float *);
 
 float fbm3d_fn(float x, float y, float z, int octaves, float lacunarity, float gain, NoiseFunction3D noiseFunc);
 float fbm4d_fn(float x, float y, float z, float w, int octaves, float lacunarity, float gain, NoiseFunction4D noiseFunc);
+float fbm_octave_limit(float footprint, float lacunarity);
+float fbm4d_fn_filtered(float x, float y, float z, float w, int octaves, float lacunarity, float gain, float footprint, NoiseFunction4D noiseFunc);
+float fbm4d_fn_deriv(float x, float y, float z, float w, int octaves, float lacunarity, float gain, float footprint, NoiseFunction4DDeriv noiseFunc, float grad[4]);
 float fbm4d(float x, float y, float z, float w, int octaves, float lacunarity, float gain);
 float fbm4dx(float x, float y, float z, float w, int octaves, float lacunarity, float gain);
 
@@ -0,0 +1,255 @@
+#include "flythrough.h"
+#include "raymath.h"
+#include "profiler.h"
+#include "torus.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void add_key(CameraPath *path, CameraKey key) {
+    if (path->count == path->capacity) {
+        path->capacity = path->capacity ? 2 * path->capacity : 64;
+        path->keys = realloc(path->keys, path->capacity * sizeof(CameraKey));
+        if (!path->keys) {
+            perror("realloc failed");
+            exit(1);
+        }
+    }
+    path->keys[path->count++] = key;
+}
+
+void camera_path_free(CameraPath *path) {
+    free(path->keys);
+    *path = (CameraPath){ 0 };
+}
+
+void camera_path_record(CameraPath *path, float time, const Camera3D *camera) {
+    if (path->count > 0 && time - path->keys[path->count - 1].time < CAMERA_PATH_KEY_INTERVAL) return;
+    add_key(path, (CameraKey){ time, camera->position, camera->target, camera->up });
+}
+
+bool camera_path_load(CameraPath *path, const char *filename) {
+    FILE *f = fopen(filename, "r");
+    if (!f) {
+        perror("fopen failed");
+        return false;
+    }
+    *path = (CameraPath){ 0 };
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#') continue;
+        CameraKey k;
+        int read = sscanf(line, "%f %f %f %f %f %f %f %f %f %f", &k.time,
+                          &k.position.x, &k.position.y, &k.position.z,
+                          &k.target.x, &k.target.y, &k.target.z,
+                          &k.up.x, &k.up.y, &k.up.z);
+        if (read != 10) continue;
+        // Keys must move forward in time
+        if (path->count > 0 && k.time <= path->keys[path->count - 1].time) continue;
+        add_key(path, k);
+    }
+    fclose(f);
+    if (path->count < 2) {
+        fprintf(stderr, "Camera path %s has fewer than two keys\n", filename);
+        camera_path_free(path);
+        return false;
+    }
+    return true;
+}
+
+bool camera_path_save(const CameraPath *path, const char *filename) {
+    FILE *f = fopen(filename, "w");
+    if (!f) {
+        perror("fopen failed");
+        return false;
+    }
+    fprintf(f, "# time position target up\n");
+    for (int i = 0; i < path->count; i++) {
+        const CameraKey *k = &path->keys[i];
+        fprintf(f, "%.4f %.3f %.3f %.3f %.3f %.3f %.3f %.5f %.5f %.5f\n", k->time,
+                k->position.x, k->position.y, k->position.z,
+                k->target.x, k->target.y, k->target.z,
+                k->up.x, k->up.y, k->up.z);
+    }
+    fclose(f);
+    printf("Saved %d camera keys to %s\n", path->count, filename);
+    return true;
+}
+
+void camera_path_scripted(CameraPath *path) {
+    float R, r;
+    GetTorusDimensions(&R, &r);
+    *path = (CameraPath){ 0 };
+    Vector3 up = { 0.0f, 1.0f, 0.0f };
+    float time = 0.0f;
+
+    // Once around the torus from above its outer edge
+    float distance = 2.2f * (R + r), height = 0.8f * (R + r);
+    for (int i = 0; i <= 8; i++, time += 1.0f) {
+        float angle = 2.0f * PI * i / 8;
+        add_key(path, (CameraKey){ time, { distance * cosf(angle), height, distance * sinf(angle) }, Vector3Zero(), up });
+    }
+
+    // Along the flat terrain, low enough that the near heights fill the view
+    float x = 0.5f * SCREEN_HEIGHT, y = MESH_HEIGHT_RANGE + 150.0f;
+    for (int i = 0; i <= 8; i++, time += 1.0f) {
+        float z = SCREEN_WIDTH * i / 8.0f;
+        add_key(path, (CameraKey){ time, { x + 150.0f * sinf(i), y, z }, { x, 0.0f, z + 600.0f }, up });
+    }
+}
+
+float camera_path_duration(const CameraPath *path) {
+    return path->count > 0 ? path->keys[path->count - 1].time - path->keys[0].time : 0.0f;
+}
+
+static Vector3 catmull_rom(Vector3 p0, Vector3 p1, Vector3 p2, Vector3 p3, float t) {
+    float t2 = t * t, t3 = t2 * t;
+    Vector3 a = Vector3Scale(p1, 2.0f);
+    Vector3 b = Vector3Scale(Vector3Subtract(p2, p0), t);
+    Vector3 c = Vector3Scale(Vector3Add(Vector3Subtract(Vector3Scale(p0, 2.0f), Vector3Scale(p1, 5.0f)), Vector3Subtract(Vector3Scale(p2, 4.0f), p3)), t2);
+    Vector3 d = Vector3Scale(Vector3Add(Vector3Subtract(Vector3Scale(p1, 3.0f), p0), Vector3Subtract(p3, Vector3Scale(p2, 3.0f))), t3);
+    return Vector3Scale(Vector3Add(Vector3Add(a, b), Vector3Add(c, d)), 0.5f);
+}
+
+void camera_path_sample(const CameraPath *path, float time, Camera3D *camera) {
+    const CameraKey *keys = path->keys;
+    int n = path->count;
+    time += keys[0].time;
+    if (time <= keys[0].time) time = keys[0].time;
+    if (time >= keys[n - 1].time) time = keys[n - 1].time;
+
+    // Segment [lo, lo + 1] holding time
+    int lo = 0, hi = n - 1;
+    while (hi - lo > 1) {
+        int mid = (lo + hi) / 2;
+        if (keys[mid].time <= time) lo = mid;
+        else hi = mid;
+    }
+    const CameraKey *k0 = &keys[lo > 0 ? lo - 1 : lo];
+    const CameraKey *k1 = &keys[lo];
+    const CameraKey *k2 = &keys[hi];
+    const CameraKey *k3 = &keys[hi < n - 1 ? hi + 1 : hi];
+    float t = (time - k1->time) / (k2->time - k1->time);
+
+    camera->position = catmull_rom(k0->position, k1->position, k2->position, k3->position, t);
+    camera->target = catmull_rom(k0->target, k1->target, k2->target, k3->target, t);
+    camera->up = Vector3Normalize(Vector3Lerp(k1->up, k2->up, t));
+}
+
+Flythrough *flythrough_create(const char *pathFile, int frames) {
+    Flythrough *fly = calloc(1, sizeof(Flythrough));
+    if (!fly) {
+        perror("calloc failed");
+        exit(1);
+    }
+    if (pathFile) {
+        if (!camera_path_load(&fly->path, pathFile)) {
+            free(fly);
+            return NULL;
+        }
+        fly->pathName = pathFile;
+    } else {
+        camera_path_scripted(&fly->path);
+        fly->pathName = "scripted";
+    }
+    fly->frames = frames > 0 ? frames : 1;
+    fly->frameMs = malloc(fly->frames * sizeof(float));
+    if (!fly->frameMs) {
+        perror("malloc failed");
+        exit(1);
+    }
+    fly->frame = -1;
+    return fly;
+}
+
+void flythrough_destroy(Flythrough *fly) {
+    if (!fly) return;
+    camera_path_free(&fly->path);
+    free(fly->frameMs);
+    free(fly);
+}
+
+bool flythrough_step(Flythrough *fly, Camera3D *camera, float *time) {
+    uint64_t now = prof_now_ns();
+    int measured = fly->frame - FLYTHROUGH_WARMUP_FRAMES;
+    if (measured >= 0 && measured < fly->frames) fly->frameMs[measured] = (float)(now - fly->lastNs) / 1.0e6f;
+    fly->lastNs = now;
+    fly->frame++;
+    if (fly->frame - FLYTHROUGH_WARMUP_FRAMES >= fly->frames) return false;
+
+    // The warmup frames hold the start of the path
+    int pathFrame = fly->frame > FLYTHROUGH_WARMUP_FRAMES ? fly->frame - FLYTHROUGH_WARMUP_FRAMES : 0;
+    *time = camera_path_duration(&fly->path) * pathFrame / (fly->frames > 1 ? fly->frames - 1 : 1);
+    camera_path_sample(&fly->path, *time, camera);
+    return true;
+}
+
+void flythrough_count(Flythrough *fly, RenderStats stats) {
+    if (fly->frame < FLYTHROUGH_WARMUP_FRAMES) return;
+    fly->drawCalls += stats.drawCalls;
+    fly->triangles += stats.triangles;
+}
+
+// Paths come from the command line; quote them for JSON.
+static void write_json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', f);
+        if ((unsigned char)*s >= 0x20) fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+static int compare_floats(const void *a, const void *b) {
+    float fa = *(const float *)a;
+    float fb = *(const float *)b;
+    return (fa > fb) - (fa < fb);
+}
+
+bool flythrough_write_report(const Flythrough *fly, const char *filename, int width, int height) {
+    int n = fly->frames;
+    float *sorted = malloc(n * sizeof(float));
+    if (!sorted) {
+        perror("malloc failed");
+        exit(1);
+    }
+    memcpy(sorted, fly->frameMs, n * sizeof(float));
+    qsort(sorted, n, sizeof(float), compare_floats);
+    double sum = 0.0;
+    for (int i = 0; i < n; i++) sum += sorted[i];
+    float percentiles[3] = { 50.0f, 95.0f, 99.0f };
+    float values[3];
+    for (int p = 0; p < 3; p++) values[p] = sorted[(int)(percentiles[p] / 100.0f * (n - 1) + 0.5f)];
+    float maxMs = sorted[n - 1];
+    free(sorted);
+
+    double mean = sum / n;
+    printf("Flythrough %s: %d frames at %d x %d, mean %.2f ms, p50 %.2f ms, p95 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+           fly->pathName, n, width, height, mean, values[0], values[1], values[2], maxMs);
+    printf("Flythrough: %.1f draw calls and %.0f triangles per frame\n", fly->drawCalls / n, fly->triangles / n);
+
+    FILE *f = fopen(filename, "w");
+    if (!f) {
+        perror("fopen failed");
+        return false;
+    }
+    fprintf(f, "{\n");
+    fprintf(f, "  \"path\": ");
+    write_json_string(f, fly->pathName);
+    fprintf(f, ",\n");
+    fprintf(f, "  \"path_seconds\": %.3f,\n", camera_path_duration(&fly->path));
+    fprintf(f, "  \"frames\": %d,\n", n);
+    fprintf(f, "  \"warmup_frames\": %d,\n", FLYTHROUGH_WARMUP_FRAMES);
+    fprintf(f, "  \"width\": %d,\n", width);
+    fprintf(f, "  \"height\": %d,\n", height);
+    fprintf(f, "  \"frame_ms\": { \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f },\n",
+            mean, values[0], values[1], values[2], maxMs);
+    fprintf(f, "  \"draw_calls_per_frame\": %.2f,\n", fly->drawCalls / n);
+    fprintf(f, "  \"triangles_per_frame\": %.0f\n", fly->triangles / n);
+    fprintf(f, "}\n");
+    fclose(f);
+    printf("Wrote %s\n", filename);
+    return true;
+}
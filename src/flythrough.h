@@ -0,0 +1,58 @@
+#ifndef FLYTHROUGH_H
+#define FLYTHROUGH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "raylib.h"
+#include "render_layer.h"
+
+#define FLYTHROUGH_WARMUP_FRAMES 30     // drawn but not measured
+#define CAMERA_PATH_KEY_INTERVAL 0.1f   // seconds between recorded keys
+
+typedef struct CameraKey {
+    float time;                 // seconds from the start of the path
+    Vector3 position, target, up;
+} CameraKey;
+
+// A camera path, played back with Catmull-Rom interpolation between keys. Saved as
+// text, one "time px py pz tx ty tz ux uy uz" key per line.
+typedef struct CameraPath {
+    CameraKey *keys;
+    int count, capacity;
+} CameraPath;
+
+void camera_path_free(CameraPath *path);
+// Appends a key unless the last one is less than CAMERA_PATH_KEY_INTERVAL older.
+void camera_path_record(CameraPath *path, float time, const Camera3D *camera);
+bool camera_path_load(CameraPath *path, const char *filename);
+bool camera_path_save(const CameraPath *path, const char *filename);
+// Orbits the torus, then flies low over the flat terrain. Needs SetTorusDimensions().
+void camera_path_scripted(CameraPath *path);
+float camera_path_duration(const CameraPath *path);
+void camera_path_sample(const CameraPath *path, float time, Camera3D *camera);
+
+// Plays a camera path over a fixed number of frames, each advancing the path by the
+// same time step, so every run draws the same frames however fast they come. Frame
+// times are measured loop top to loop top, after FLYTHROUGH_WARMUP_FRAMES.
+typedef struct Flythrough {
+    CameraPath path;
+    const char *pathName;
+    int frames;                 // measured
+    int frame;                  // the frame being drawn, warmup included
+    float *frameMs;
+    double drawCalls, triangles;    // summed over measured frames
+    uint64_t lastNs;
+} Flythrough;
+
+// pathFile NULL uses the scripted path. Returns NULL if the path can't be loaded.
+Flythrough *flythrough_create(const char *pathFile, int frames);
+void flythrough_destroy(Flythrough *fly);
+// Call at the top of each frame: sets the camera and the path time to draw with. Returns
+// false once every frame has been measured.
+bool flythrough_step(Flythrough *fly, Camera3D *camera, float *time);
+// Call after each frame with what it drew.
+void flythrough_count(Flythrough *fly, RenderStats stats);
+// Frame time mean and percentiles, draw calls and triangles, as JSON; also printed.
+bool flythrough_write_report(const Flythrough *fly, const char *filename, int width, int height);
+
+#endif // FLYTHROUGH_H
@@ -0,0 +1,21 @@
+#version 330
+
+in vec3 vertexPosition;
+in mat4 instanceTransform;
+
+uniform mat4 mvp;
+
+out vec4 fragColor;
+
+void main()
+{
+    // The bottom row of the instance transform carries the gizmo colour
+    mat4 model = instanceTransform;
+    fragColor = vec4(model[0][3], model[1][3], model[2][3], model[3][3]);
+    model[0][3] = 0.0;
+    model[1][3] = 0.0;
+    model[2][3] = 0.0;
+    model[3][3] = 1.0;
+
+    gl_Position = mvp * model * vec4(vertexPosition, 1.0);
+}
@@ -0,0 +1,75 @@
+#include "ground.h"
+#include "heightmap_sampler.h"
+
+#include <stddef.h>
+#include <math.h>
+
+void ground_cache_init(GroundCache *cache, const TerrainPicker *picker) {
+    cache->picker = picker;
+    cache->valid = false;
+    cache->refills = 0;
+}
+
+// Centres the window on cell (i, j).
+static void refill(GroundCache *cache, int i, int j) {
+    const TerrainPicker *picker = cache->picker;
+    cache->originI = WRAP_MOD(i - GROUND_WINDOW / 2 + 1, picker->rings);
+    cache->originJ = WRAP_MOD(j - GROUND_WINDOW / 2 + 1, picker->sides);
+    for (int wi = 0; wi < GROUND_WINDOW; wi++) {
+        const float *row = picker->heights + (size_t)((cache->originI + wi) % picker->rings) * picker->sides;
+        for (int wj = 0; wj < GROUND_WINDOW; wj++) {
+            cache->heights[wi][wj] = row[(cache->originJ + wj) % picker->sides];
+        }
+    }
+    cache->version = picker->version;
+    cache->valid = true;
+    cache->refills++;
+}
+
+bool ground_at(GroundCache *cache, float theta, float phi, GroundSample *out) {
+    const TerrainPicker *picker = cache->picker;
+    int rings = picker->rings, sides = picker->sides;
+    float gi = theta * rings / (2.0f * PI);
+    float gj = phi * sides / (2.0f * PI);
+    if (picker->flat) {
+        // The patch spans grid points 0..rings-1, 0..sides-1 and does not wrap
+        if (gi < 0.0f || gj < 0.0f || gi > rings - 1 || gj > sides - 1) return false;
+    } else {
+        theta = fmodf(theta, 2.0f * PI);
+        phi = fmodf(phi, 2.0f * PI);
+        if (theta < 0.0f) theta += 2.0f * PI;
+        if (phi < 0.0f) phi += 2.0f * PI;
+        gi = theta * rings / (2.0f * PI);
+        gj = phi * sides / (2.0f * PI);
+    }
+    int i = (int)gi, j = (int)gj;
+    float s = gi - i, t = gj - j;
+
+    int wi = WRAP_MOD(i - cache->originI, rings), wj = WRAP_MOD(j - cache->originJ, sides);
+    if (!cache->valid || cache->version != picker->version || wi > GROUND_WINDOW - 2 || wj > GROUND_WINDOW - 2) {
+        refill(cache, i, j);
+        wi = WRAP_MOD(i - cache->originI, rings);
+        wj = WRAP_MOD(j - cache->originJ, sides);
+    }
+    float h00 = cache->heights[wi][wj], h01 = cache->heights[wi][wj + 1];
+    float h10 = cache->heights[wi + 1][wj], h11 = cache->heights[wi + 1][wj + 1];
+    float near = h00 + (h01 - h00) * t;
+    float far = h10 + (h11 - h10) * t;
+    float dh_dtheta = (far - near) * rings / (2.0f * PI);
+    float dh_dphi = ((h01 - h00) * (1.0f - s) + (h11 - h10) * s) * sides / (2.0f * PI);
+
+    out->theta = theta;
+    out->phi = phi;
+    out->height = near + (far - near) * s;
+    out->clearance = 0.0f;
+    out->frame = picker_surface(picker, theta, phi, out->height, dh_dtheta, dh_dphi);
+    return true;
+}
+
+bool ground_under(GroundCache *cache, Vector3 p, GroundSample *out) {
+    float theta, phi;
+    float offset = picker_locate(cache->picker, p, &theta, &phi);
+    if (!ground_at(cache, theta, phi, out)) return false;
+    out->clearance = offset - out->height;
+    return true;
+}
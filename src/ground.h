@@ -0,0 +1,36 @@
+#ifndef GROUND_H
+#define GROUND_H
+
+#include <stdbool.h>
+#include "raylib.h"
+#include "pick.h"
+
+#define GROUND_WINDOW 16    // grid points per side of the cached window
+
+// Height and normal queries for the camera, from a small window of a picker's height grid
+// around the last query. Consecutive frames land in the same window, so a query is one
+// bilinear lookup; the window is refilled when the camera walks out of it or the
+// picker's heights change.
+typedef struct GroundSample {
+    float theta, phi;
+    float height;           // terrain height at (theta, phi)
+    float clearance;        // how far the queried point is above the surface (ground_under only)
+    SurfaceFrame frame;
+} GroundSample;
+
+typedef struct GroundCache {
+    const TerrainPicker *picker;
+    bool valid;
+    unsigned version;       // picker->version the window was copied at
+    int originI, originJ;   // grid point at the window's corner
+    float heights[GROUND_WINDOW][GROUND_WINDOW];
+    int refills;
+} GroundCache;
+
+void ground_cache_init(GroundCache *cache, const TerrainPicker *picker);
+// False off the edge of the flat terrain patch; the torus has no edge.
+bool ground_at(GroundCache *cache, float theta, float phi, GroundSample *out);
+// The ground under model-space point p: the surface point on the same displacement line.
+bool ground_under(GroundCache *cache, Vector3 p, GroundSample *out);
+
+#endif // GROUND_H
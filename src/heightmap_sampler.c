@@ -0,0 +1,248 @@
+#include "heightmap_sampler.h"
+
+#include <math.h>
+#include <stddef.h>
+
+HeightmapSampler heightmap_sampler(float **heightmap, int width, int height, SampleMode mode) {
+    return (HeightmapSampler){ heightmap, width, height, mode };
+}
+
+void catmull_rom_weights(float t, float w[4], float dw[4]) {
+    float t2 = t * t;
+    float t3 = t2 * t;
+    w[0] = 0.5f * (-t3 + 2.0f * t2 - t);
+    w[1] = 0.5f * (3.0f * t3 - 5.0f * t2 + 2.0f);
+    w[2] = 0.5f * (-3.0f * t3 + 4.0f * t2 + t);
+    w[3] = 0.5f * (t3 - t2);
+    if (!dw) return;
+    dw[0] = 0.5f * (-3.0f * t2 + 4.0f * t - 1.0f);
+    dw[1] = 0.5f * (9.0f * t2 - 10.0f * t);
+    dw[2] = 0.5f * (-9.0f * t2 + 8.0f * t + 1.0f);
+    dw[3] = 0.5f * (3.0f * t2 - 2.0f * t);
+}
+
+static float sample_nearest(const HeightmapSampler *sampler, float u, float v, float grad[2]) {
+    int x = WRAP_MOD((int)floorf(u + 0.5f), sampler->width);
+    int y = WRAP_MOD((int)floorf(v + 0.5f), sampler->height);
+    if (grad) grad[0] = grad[1] = 0.0f;
+    return sampler->rows[y][x];
+}
+
+static float sample_bilinear(const HeightmapSampler *sampler, float u, float v, float grad[2]) {
+    float fu = floorf(u), fv = floorf(v);
+    float s = u - fu, t = v - fv;
+    int x0 = WRAP_MOD((int)fu, sampler->width), x1 = WRAP_MOD(x0 + 1, sampler->width);
+    int y0 = WRAP_MOD((int)fv, sampler->height), y1 = WRAP_MOD(y0 + 1, sampler->height);
+    float h00 = sampler->rows[y0][x0], h10 = sampler->rows[y0][x1];
+    float h01 = sampler->rows[y1][x0], h11 = sampler->rows[y1][x1];
+    float top = h00 + (h10 - h00) * s;
+    float bottom = h01 + (h11 - h01) * s;
+    if (grad) {
+        grad[0] = (h10 - h00) * (1.0f - t) + (h11 - h01) * t;
+        grad[1] = bottom - top;
+    }
+    return top + (bottom - top) * t;
+}
+
+static float sample_bicubic(const HeightmapSampler *sampler, float u, float v, float grad[2]) {
+    float fu = floorf(u), fv = floorf(v);
+    float wu[4], wv[4], dwu[4], dwv[4];
+    catmull_rom_weights(u - fu, wu, grad ? dwu : NULL);
+    catmull_rom_weights(v - fv, wv, grad ? dwv : NULL);
+
+    int cols[4];
+    for (int a = 0; a < 4; a++) cols[a] = WRAP_MOD((int)fu - 1 + a, sampler->width);
+    float value = 0.0f, du = 0.0f, dv = 0.0f;
+    for (int b = 0; b < 4; b++) {
+        const float *row = sampler->rows[WRAP_MOD((int)fv - 1 + b, sampler->height)];
+        float rowValue = 0.0f, rowSlope = 0.0f;
+        for (int a = 0; a < 4; a++) {
+            rowValue += row[cols[a]] * wu[a];
+            if (grad) rowSlope += row[cols[a]] * dwu[a];
+        }
+        value += rowValue * wv[b];
+        if (grad) {
+            du += rowSlope * wv[b];
+            dv += rowValue * dwv[b];
+        }
+    }
+    if (grad) {
+        grad[0] = du;
+        grad[1] = dv;
+    }
+    return value;
+}
+
+float heightmap_sample(const HeightmapSampler *sampler, float u, float v, float grad[2]) {
+    switch (sampler->mode) {
+        case SAMPLE_NEAREST: return sample_nearest(sampler, u, v, grad);
+        case SAMPLE_BILINEAR: return sample_bilinear(sampler, u, v, grad);
+        default: return sample_bicubic(sampler, u, v, grad);
+    }
+}
+
+#define SAMPLE_BLOCK 64     // samples per batch block; a bicubic block's taps and weights stay in L1
+
+// floorf without the libm call, so the loops below vectorise; |x| < 2^31.
+static inline int floor_int(float x) {
+    int i = (int)x;
+    return i - (x < (float)i);
+}
+
+// index into [0, size) when it is at most one period out.
+static inline int wrap_near(int index, int size) {
+    if (index < 0) index += size;
+    if (index >= size) index -= size;
+    return index;
+}
+
+// WRAP_MOD(index, size) without an integer division; exact for |index| < 2^24.
+static inline int wrap_index(int index, int size, float invSize) {
+    return wrap_near(index - size * floor_int((float)index * invSize), size);
+}
+
+// Each block is done in three passes over SoA arrays: cell coordinates and fractions,
+// the tap gather through the row pointers, and the blend. The first and last are
+// straight-line arithmetic under omp simd; only the gather stays scalar. Expressions
+// match the scalar kernels term for term, so batch and single samples agree exactly.
+static void bilinear_block(const HeightmapSampler *sampler, const float *u, const float *v, int n, float *out, float *grads) {
+    int width = sampler->width, height = sampler->height;
+    float invWidth = 1.0f / width, invHeight = 1.0f / height;
+    int x0[SAMPLE_BLOCK], y0[SAMPLE_BLOCK];
+    float s[SAMPLE_BLOCK], t[SAMPLE_BLOCK];
+    float h00[SAMPLE_BLOCK], h10[SAMPLE_BLOCK], h01[SAMPLE_BLOCK], h11[SAMPLE_BLOCK];
+
+    #pragma omp simd
+    for (int k = 0; k < n; k++) {
+        int iu = floor_int(u[k]), iv = floor_int(v[k]);
+        s[k] = u[k] - (float)iu;
+        t[k] = v[k] - (float)iv;
+        x0[k] = wrap_index(iu, width, invWidth);
+        y0[k] = wrap_index(iv, height, invHeight);
+    }
+    for (int k = 0; k < n; k++) {
+        const float *row0 = sampler->rows[y0[k]];
+        const float *row1 = sampler->rows[wrap_near(y0[k] + 1, height)];
+        int x1 = wrap_near(x0[k] + 1, width);
+        h00[k] = row0[x0[k]];
+        h10[k] = row0[x1];
+        h01[k] = row1[x0[k]];
+        h11[k] = row1[x1];
+    }
+    #pragma omp simd
+    for (int k = 0; k < n; k++) {
+        float top = h00[k] + (h10[k] - h00[k]) * s[k];
+        float bottom = h01[k] + (h11[k] - h01[k]) * s[k];
+        out[k] = top + (bottom - top) * t[k];
+    }
+    if (!grads) return;
+    #pragma omp simd
+    for (int k = 0; k < n; k++) {
+        float top = h00[k] + (h10[k] - h00[k]) * s[k];
+        float bottom = h01[k] + (h11[k] - h01[k]) * s[k];
+        grads[2 * k] = (h10[k] - h00[k]) * (1.0f - t[k]) + (h11[k] - h01[k]) * t[k];
+        grads[2 * k + 1] = bottom - top;
+    }
+}
+
+// catmull_rom_weights over a block of fractions; dw may be NULL.
+static void catmull_rom_block(const float *t, int n, float w[4][SAMPLE_BLOCK], float dw[4][SAMPLE_BLOCK]) {
+    #pragma omp simd
+    for (int k = 0; k < n; k++) {
+        float t2 = t[k] * t[k];
+        float t3 = t2 * t[k];
+        w[0][k] = 0.5f * (-t3 + 2.0f * t2 - t[k]);
+        w[1][k] = 0.5f * (3.0f * t3 - 5.0f * t2 + 2.0f);
+        w[2][k] = 0.5f * (-3.0f * t3 + 4.0f * t2 + t[k]);
+        w[3][k] = 0.5f * (t3 - t2);
+    }
+    if (!dw) return;
+    #pragma omp simd
+    for (int k = 0; k < n; k++) {
+        float t2 = t[k] * t[k];
+        dw[0][k] = 0.5f * (-3.0f * t2 + 4.0f * t[k] - 1.0f);
+        dw[1][k] = 0.5f * (9.0f * t2 - 10.0f * t[k]);
+        dw[2][k] = 0.5f * (-9.0f * t2 + 8.0f * t[k] + 1.0f);
+        dw[3][k] = 0.5f * (3.0f * t2 - 2.0f * t[k]);
+    }
+}
+
+// One row of taps weighted by w, summed in the scalar kernel's order. Spelled out so the
+// blend loops have no inner loops and vectorise.
+static inline float row_dot(const float taps[4][SAMPLE_BLOCK], const float w[4][SAMPLE_BLOCK], int k) {
+    float sum = 0.0f;
+    sum += taps[0][k] * w[0][k];
+    sum += taps[1][k] * w[1][k];
+    sum += taps[2][k] * w[2][k];
+    sum += taps[3][k] * w[3][k];
+    return sum;
+}
+
+static void bicubic_block(const HeightmapSampler *sampler, const float *u, const float *v, int n, float *out, float *grads) {
+    int width = sampler->width, height = sampler->height;
+    float invWidth = 1.0f / width, invHeight = 1.0f / height;
+    int x0[SAMPLE_BLOCK], y0[SAMPLE_BLOCK];
+    float s[SAMPLE_BLOCK], t[SAMPLE_BLOCK];
+    float wu[4][SAMPLE_BLOCK], wv[4][SAMPLE_BLOCK], dwu[4][SAMPLE_BLOCK], dwv[4][SAMPLE_BLOCK];
+    float taps[4][4][SAMPLE_BLOCK];     // [row][column][sample]
+
+    #pragma omp simd
+    for (int k = 0; k < n; k++) {
+        int iu = floor_int(u[k]), iv = floor_int(v[k]);
+        s[k] = u[k] - (float)iu;
+        t[k] = v[k] - (float)iv;
+        x0[k] = wrap_index(iu, width, invWidth);
+        y0[k] = wrap_index(iv, height, invHeight);
+    }
+    catmull_rom_block(s, n, wu, grads ? dwu : NULL);
+    catmull_rom_block(t, n, wv, grads ? dwv : NULL);
+    for (int k = 0; k < n; k++) {
+        int cols[4];
+        for (int a = 0; a < 4; a++) cols[a] = wrap_near(x0[k] - 1 + a, width);
+        for (int b = 0; b < 4; b++) {
+            const float *row = sampler->rows[wrap_near(y0[k] - 1 + b, height)];
+            for (int a = 0; a < 4; a++) taps[b][a][k] = row[cols[a]];
+        }
+    }
+    #pragma omp simd
+    for (int k = 0; k < n; k++) {
+        float value = 0.0f;
+        value += row_dot(taps[0], wu, k) * wv[0][k];
+        value += row_dot(taps[1], wu, k) * wv[1][k];
+        value += row_dot(taps[2], wu, k) * wv[2][k];
+        value += row_dot(taps[3], wu, k) * wv[3][k];
+        out[k] = value;
+    }
+    if (!grads) return;
+    #pragma omp simd
+    for (int k = 0; k < n; k++) {
+        float du = 0.0f, dv = 0.0f;
+        du += row_dot(taps[0], dwu, k) * wv[0][k];
+        du += row_dot(taps[1], dwu, k) * wv[1][k];
+        du += row_dot(taps[2], dwu, k) * wv[2][k];
+        du += row_dot(taps[3], dwu, k) * wv[3][k];
+        dv += row_dot(taps[0], wu, k) * dwv[0][k];
+        dv += row_dot(taps[1], wu, k) * dwv[1][k];
+        dv += row_dot(taps[2], wu, k) * dwv[2][k];
+        dv += row_dot(taps[3], wu, k) * dwv[3][k];
+        grads[2 * k] = du;
+        grads[2 * k + 1] = dv;
+    }
+}
+
+void heightmap_sample_batch(const HeightmapSampler *sampler, const float *u, const float *v, int count, float *out, float *grads) {
+    if (sampler->mode == SAMPLE_NEAREST) {
+        #pragma omp parallel for schedule(static)
+        for (int k = 0; k < count; k++) out[k] = sample_nearest(sampler, u[k], v[k], grads ? &grads[2 * k] : NULL);
+        return;
+    }
+    int blocks = (count + SAMPLE_BLOCK - 1) / SAMPLE_BLOCK;
+    #pragma omp parallel for schedule(static)
+    for (int block = 0; block < blocks; block++) {
+        int first = block * SAMPLE_BLOCK;
+        int n = count - first < SAMPLE_BLOCK ? count - first : SAMPLE_BLOCK;
+        float *blockGrads = grads ? &grads[2 * first] : NULL;
+        if (sampler->mode == SAMPLE_BILINEAR) bilinear_block(sampler, &u[first], &v[first], n, &out[first], blockGrads);
+        else bicubic_block(sampler, &u[first], &v[first], n, &out[first], blockGrads);
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef HEIGHTMAP_SAMPLER_H
+#define HEIGHTMAP_SAMPLER_H
+
+// a mod m in [0, m), for wrapped grid indices
+#define WRAP_MOD(a, m) (((a) % (m) + (m)) % (m))
+
+// Reads a heightmap at fractional pixel positions. Pixel (u, v) holds heightmap[v][u],
+// and both directions wrap, matching the torus the heightmap is painted on. Every mode
+// can also return the gradient (dh/du, dh/dv per pixel) of what it reconstructs.
+typedef enum {
+    SAMPLE_NEAREST,     // the closest pixel; zero gradient
+    SAMPLE_BILINEAR,    // continuous, with a gradient that jumps at pixel edges
+    SAMPLE_BICUBIC      // Catmull-Rom; continuous value and gradient
+} SampleMode;
+
+typedef struct HeightmapSampler {
+    float **rows;
+    int width, height;
+    SampleMode mode;
+} HeightmapSampler;
+
+HeightmapSampler heightmap_sampler(float **heightmap, int width, int height, SampleMode mode);
+// grad may be NULL.
+float heightmap_sample(const HeightmapSampler *sampler, float u, float v, float grad[2]);
+// out gets one height per sample; grads (optional) gets dh/du, dh/dv per sample.
+void heightmap_sample_batch(const HeightmapSampler *sampler, const float *u, const float *v, int count, float *out, float *grads);
+
+// Catmull-Rom weights for the nodes at -1, 0, 1, 2 around a fraction t in [0, 1), and
+// optionally their derivatives with respect to t.
+void catmull_rom_weights(float t, float w[4], float dw[4]);
+
+#endif // HEIGHTMAP_SAMPLER_H
@@ -0,0 +1,241 @@
+#include "light_clusters.h"
+#include "raymath.h"
+#include "profiler.h"
+#include "mem_track.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+LightClusters *light_clusters_create(void) {
+    LightClusters *clusters = mem_calloc(MEM_RENDER, sizeof(LightClusters));
+    clusters->grid = mem_calloc(MEM_RENDER, CLUSTER_COUNT * 4 * sizeof(float));
+    clusters->lights = mem_calloc(MEM_RENDER, CLUSTER_MAX_LIGHTS * 2 * 4 * sizeof(float));
+    clusters->indices = mem_calloc(MEM_RENDER, CLUSTER_MAX_INDICES * sizeof(float));
+    clusters->counts = mem_calloc(MEM_RENDER, CLUSTER_COUNT * sizeof(int));
+    clusters->ranges = mem_calloc(MEM_RENDER, CLUSTER_MAX_LIGHTS * 6 * sizeof(int));
+    return clusters;
+}
+
+static int depth_slice(const LightClusters *clusters, float depth) {
+    if (depth <= clusters->nearPlane) return 0;
+    int slice = (int)floorf(logf(depth / clusters->nearPlane) / logf(clusters->farPlane / clusters->nearPlane) * CLUSTER_SLICES);
+    return slice < CLUSTER_SLICES ? slice : CLUSTER_SLICES - 1;
+}
+
+// Tiles along one screen axis that a view-space sphere (a along the axis, z, radius) can
+// reach. Tile edge i is the plane a = s_i * depth through the eye; the sphere reaches tile
+// c when it comes within radius of the inner side of both of its edges.
+static bool tile_range(float a, float z, float radius, float tanHalf, int tiles, int *first, int *last) {
+    float distances[CLUSTER_TILES_X + 1];   // x has the most tiles
+    for (int i = 0; i <= tiles; i++) {
+        float s = (-1.0f + 2.0f * i / tiles) * tanHalf;
+        distances[i] = (a + s * z) / sqrtf(1.0f + s * s);
+    }
+    *first = tiles;
+    *last = -1;
+    for (int c = 0; c < tiles; c++) {
+        if (distances[c] < -radius || distances[c + 1] > radius) continue;
+        if (c < *first) *first = c;
+        *last = c;
+    }
+    return *first <= *last;
+}
+
+void light_clusters_build(LightClusters *clusters, const ClusterLight *lights, int count,
+                          Matrix view, float fovy, float aspect, float nearPlane, float farPlane) {
+    PROF_BEGIN("light clusters");
+    uint64_t start = prof_now_ns();
+    if (count > CLUSTER_MAX_LIGHTS) count = CLUSTER_MAX_LIGHTS;
+    clusters->view = view;
+    clusters->tanHalfY = tanf(fovy * DEG2RAD * 0.5f);
+    clusters->tanHalfX = clusters->tanHalfY * aspect;
+    clusters->nearPlane = nearPlane;
+    clusters->farPlane = farPlane;
+    clusters->lightCount = count;
+    memset(clusters->counts, 0, CLUSTER_COUNT * sizeof(int));
+
+    // Count pass: each light's cluster box, kept for the fill pass
+    for (int l = 0; l < count; l++) {
+        const ClusterLight *light = &lights[l];
+        float *texel = clusters->lights + 4 * l;
+        texel[0] = light->position.x;
+        texel[1] = light->position.y;
+        texel[2] = light->position.z;
+        texel[3] = light->radius;
+        texel += 4 * CLUSTER_MAX_LIGHTS;
+        texel[0] = light->color.r / 255.0f;
+        texel[1] = light->color.g / 255.0f;
+        texel[2] = light->color.b / 255.0f;
+        texel[3] = 1.0f;
+
+        int *range = clusters->ranges + 6 * l;
+        range[0] = 1;
+        range[1] = 0;
+        Vector3 p = Vector3Transform(light->position, view);
+        float depth = -p.z;
+        if (depth + light->radius < nearPlane || depth - light->radius > farPlane) continue;
+        if (!tile_range(p.x, p.z, light->radius, clusters->tanHalfX, CLUSTER_TILES_X, &range[0], &range[1])) continue;
+        if (!tile_range(p.y, p.z, light->radius, clusters->tanHalfY, CLUSTER_TILES_Y, &range[2], &range[3])) {
+            range[0] = 1;
+            range[1] = 0;
+            continue;
+        }
+        range[4] = depth_slice(clusters, depth - light->radius);
+        range[5] = depth_slice(clusters, depth + light->radius);
+        for (int z = range[4]; z <= range[5]; z++) {
+            for (int y = range[2]; y <= range[3]; y++) {
+                int *row = clusters->counts + (z * CLUSTER_TILES_Y + y) * CLUSTER_TILES_X;
+                for (int x = range[0]; x <= range[1]; x++) row[x]++;
+            }
+        }
+    }
+
+    // Offsets; a full index list truncates the clusters past it
+    int offset = 0;
+    clusters->maxPerCluster = 0;
+    clusters->overflowed = false;
+    for (int c = 0; c < CLUSTER_COUNT; c++) {
+        int n = clusters->counts[c];
+        if (n > clusters->maxPerCluster) clusters->maxPerCluster = n;
+        if (offset + n > CLUSTER_MAX_INDICES) {
+            n = CLUSTER_MAX_INDICES - offset;
+            clusters->overflowed = true;
+        }
+        clusters->grid[4 * c + 0] = (float)offset;
+        clusters->grid[4 * c + 1] = (float)n;
+        clusters->counts[c] = offset;   // now the fill cursor
+        offset += n;
+    }
+    clusters->indexCount = offset;
+
+    // Fill pass, in light order so every cluster's list is sorted
+    for (int l = 0; l < count; l++) {
+        const int *range = clusters->ranges + 6 * l;
+        if (range[0] > range[1]) continue;
+        for (int z = range[4]; z <= range[5]; z++) {
+            for (int y = range[2]; y <= range[3]; y++) {
+                int base = (z * CLUSTER_TILES_Y + y) * CLUSTER_TILES_X;
+                for (int x = range[0]; x <= range[1]; x++) {
+                    int c = base + x;
+                    if (clusters->counts[c] < (int)clusters->grid[4 * c] + (int)clusters->grid[4 * c + 1]) {
+                        clusters->indices[clusters->counts[c]++] = (float)l;
+                    }
+                }
+            }
+        }
+    }
+    clusters->buildUs = (double)(prof_now_ns() - start) / 1.0e3;
+    PROF_END();
+}
+
+int light_clusters_find(const LightClusters *clusters, Vector3 viewPoint) {
+    float depth = -viewPoint.z;
+    if (depth < clusters->nearPlane || depth > clusters->farPlane) return -1;
+    float ndcX = viewPoint.x / (depth * clusters->tanHalfX);
+    float ndcY = viewPoint.y / (depth * clusters->tanHalfY);
+    if (ndcX < -1.0f || ndcX >= 1.0f || ndcY < -1.0f || ndcY >= 1.0f) return -1;
+    int x = (int)((ndcX + 1.0f) * 0.5f * CLUSTER_TILES_X);
+    int y = (int)((ndcY + 1.0f) * 0.5f * CLUSTER_TILES_Y);
+    return (depth_slice(clusters, depth) * CLUSTER_TILES_Y + y) * CLUSTER_TILES_X + x;
+}
+
+static Texture2D load_float_texture(float *data, int width, int height, int format) {
+    Texture2D texture = LoadTextureFromImage((Image){ data, width, height, 1, format });
+    SetTextureFilter(texture, TEXTURE_FILTER_POINT);
+    SetTextureWrap(texture, TEXTURE_WRAP_CLAMP);
+    return texture;
+}
+
+void light_clusters_upload(LightClusters *clusters) {
+    PROF_BEGIN("light clusters upload");
+    if (clusters->gridTexture.id == 0) {
+        clusters->gridTexture = load_float_texture(clusters->grid, CLUSTER_TILES_X * CLUSTER_TILES_Y, CLUSTER_SLICES, PIXELFORMAT_UNCOMPRESSED_R32G32B32A32);
+        clusters->lightTexture = load_float_texture(clusters->lights, CLUSTER_MAX_LIGHTS, 2, PIXELFORMAT_UNCOMPRESSED_R32G32B32A32);
+        clusters->indexTexture = load_float_texture(clusters->indices, CLUSTER_INDEX_WIDTH, CLUSTER_MAX_INDICES / CLUSTER_INDEX_WIDTH, PIXELFORMAT_UNCOMPRESSED_R32);
+    } else {
+        UpdateTexture(clusters->gridTexture, clusters->grid);
+        UpdateTexture(clusters->lightTexture, clusters->lights);
+        int rows = (clusters->indexCount + CLUSTER_INDEX_WIDTH - 1) / CLUSTER_INDEX_WIDTH;
+        if (rows > 0) UpdateTextureRec(clusters->indexTexture, (Rectangle){ 0, 0, CLUSTER_INDEX_WIDTH, (float)rows }, clusters->indices);
+    }
+    PROF_END();
+}
+
+void light_clusters_destroy(LightClusters *clusters) {
+    if (!clusters) return;
+    if (clusters->gridTexture.id != 0) {
+        UnloadTexture(clusters->gridTexture);
+        UnloadTexture(clusters->lightTexture);
+        UnloadTexture(clusters->indexTexture);
+    }
+    mem_free(MEM_RENDER, clusters->grid, CLUSTER_COUNT * 4 * sizeof(float));
+    mem_free(MEM_RENDER, clusters->lights, CLUSTER_MAX_LIGHTS * 2 * 4 * sizeof(float));
+    mem_free(MEM_RENDER, clusters->indices, CLUSTER_MAX_INDICES * sizeof(float));
+    mem_free(MEM_RENDER, clusters->counts, CLUSTER_COUNT * sizeof(int));
+    mem_free(MEM_RENDER, clusters->ranges, CLUSTER_MAX_LIGHTS * 6 * sizeof(int));
+    mem_free(MEM_RENDER, clusters, sizeof(LightClusters));
+}
+
+static float random_unit(uint32_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return (*state >> 8) * (1.0f / 16777216.0f);
+}
+
+bool light_clusters_benchmark(int lightCount, int builds) {
+    if (lightCount > CLUSTER_MAX_LIGHTS) lightCount = CLUSTER_MAX_LIGHTS;
+    uint32_t state = 0x9e3779b9u;
+    ClusterLight *lights = mem_alloc(MEM_SCRATCH, lightCount * sizeof(ClusterLight));
+    // Lights hovering over a 2000 x 2000 patch, about the size of the flat terrain
+    for (int l = 0; l < lightCount; l++) {
+        lights[l].position = (Vector3){ 2000.0f * random_unit(&state) - 1000.0f, 100.0f + 400.0f * random_unit(&state), 2000.0f * random_unit(&state) - 1000.0f };
+        lights[l].radius = 60.0f + 140.0f * random_unit(&state);
+        lights[l].color = WHITE;
+    }
+
+    LightClusters *clusters = light_clusters_create();
+    const float fovy = 45.0f, aspect = 16.0f / 9.0f, nearPlane = 10.0f, farPlane = 10000.0f;
+    const int probes = 256;
+    double buildUs = 0.0, looped = 0.0;
+    long missing = 0, reached = 0, probed = 0;
+    for (int b = 0; b < builds; b++) {
+        // Orbit the patch, looking at its centre from above
+        float angle = 2.0f * PI * b / builds;
+        Vector3 eye = { 1500.0f * cosf(angle), 700.0f, 1500.0f * sinf(angle) };
+        Matrix view = MatrixLookAt(eye, Vector3Zero(), (Vector3){ 0.0f, 1.0f, 0.0f });
+        light_clusters_build(clusters, lights, lightCount, view, fovy, aspect, nearPlane, farPlane);
+        buildUs += clusters->buildUs;
+
+        // Every light reaching a random visible point must be in that point's cluster
+        Matrix inverse = MatrixInvert(view);
+        for (int k = 0; k < probes; k++) {
+            float depth = nearPlane + 3000.0f * random_unit(&state);
+            Vector3 local = { (2.0f * random_unit(&state) - 1.0f) * depth * clusters->tanHalfX,
+                              (2.0f * random_unit(&state) - 1.0f) * depth * clusters->tanHalfY, -depth };
+            int c = light_clusters_find(clusters, local);
+            if (c < 0) continue;
+            probed++;
+            Vector3 world = Vector3Transform(local, inverse);
+            int offset = (int)clusters->grid[4 * c], n = (int)clusters->grid[4 * c + 1];
+            looped += n;
+            for (int l = 0; l < lightCount; l++) {
+                if (Vector3Distance(world, lights[l].position) > lights[l].radius) continue;
+                reached++;
+                bool found = false;
+                for (int i = 0; i < n && !found; i++) found = (int)clusters->indices[offset + i] == l;
+                if (!found) missing++;
+            }
+        }
+    }
+    printf("Light clusters: %d lights, %d builds, %.1f us per build, %d indices, max %d per cluster%s\n",
+           lightCount, builds, buildUs / builds, clusters->indexCount, clusters->maxPerCluster,
+           clusters->overflowed ? " (index list full)" : "");
+    printf("Light clusters: a shaded point loops over %.1f lights instead of %d; %ld of %ld reaching lights missing\n",
+           probed ? looped / probed : 0.0, lightCount, missing, reached);
+    light_clusters_destroy(clusters);
+    mem_free(MEM_SCRATCH, lights, lightCount * sizeof(ClusterLight));
+    return missing == 0;
+}
@@ -0,0 +1,73 @@
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+#include <stdbool.h>
+#include "raylib.h"
+
+// The view frustum is cut into CLUSTER_TILES_X x CLUSTER_TILES_Y screen tiles and
+// CLUSTER_SLICES depth slices, spaced exponentially between the near and far planes.
+// lighting.fs repeats these numbers.
+#define CLUSTER_TILES_X 16
+#define CLUSTER_TILES_Y 9
+#define CLUSTER_SLICES 24
+#define CLUSTER_COUNT (CLUSTER_TILES_X * CLUSTER_TILES_Y * CLUSTER_SLICES)
+#define CLUSTER_MAX_LIGHTS 1024
+#define CLUSTER_INDEX_WIDTH 1024                // indices per row of the index texture
+#define CLUSTER_MAX_INDICES (64 * CLUSTER_INDEX_WIDTH)
+
+// A point light with a hard range: it adds nothing beyond radius.
+typedef struct ClusterLight {
+    Vector3 position;
+    float radius;
+    Color color;
+} ClusterLight;
+
+// Clustered light culling on the CPU.
+//
+// light_clusters_build() bins every light into the clusters its sphere can touch:
+// a count pass, a prefix sum and a fill pass produce one compact index list. The
+// binning is conservative (a light may land in a cluster its sphere only grazes the
+// bounds of) but never misses a cluster it reaches. light_clusters_upload() copies the
+// lists into three float textures, so the shader loops over only its cluster's lights:
+//   grid:    (offset, count, 0, 0) per cluster; x = tile + tile row * CLUSTER_TILES_X, y = slice
+//   lights:  (position, radius) in row 0 and (colour, 1) in row 1, one column per light
+//   indices: light indices, CLUSTER_INDEX_WIDTH per row
+typedef struct LightClusters {
+    // Frustum of the last build
+    Matrix view;
+    float tanHalfX, tanHalfY;
+    float nearPlane, farPlane;
+
+    int lightCount;
+    int indexCount;
+    bool overflowed;            // the index list was full; some clusters lost lights
+    int maxPerCluster;
+    double buildUs;
+
+    float *grid;                // CLUSTER_COUNT * 4
+    float *lights;              // CLUSTER_MAX_LIGHTS * 4 per row, two rows
+    float *indices;             // CLUSTER_MAX_INDICES
+    int *counts;                // per cluster, scratch for the build
+    int *ranges;                // per light: x0, x1, y0, y1, z0, z1 (x0 > x1 when culled)
+
+    // GPU copies, created on the first upload
+    Texture2D gridTexture, lightTexture, indexTexture;
+} LightClusters;
+
+LightClusters *light_clusters_create(void);
+// view is the world-to-view matrix (GetCameraMatrix); the projection is perspective with
+// fovy in degrees. Lights past CLUSTER_MAX_LIGHTS are ignored.
+void light_clusters_build(LightClusters *clusters, const ClusterLight *lights, int count,
+                          Matrix view, float fovy, float aspect, float nearPlane, float farPlane);
+// The cluster holding a view-space point, or -1 outside the frustum.
+int light_clusters_find(const LightClusters *clusters, Vector3 viewPoint);
+// Needs the GL context. Only the used rows of the index texture are sent.
+void light_clusters_upload(LightClusters *clusters);
+void light_clusters_destroy(LightClusters *clusters);
+
+// Headless: bins random lights over a terrain-sized scene from a moving camera, checks
+// every build against a brute-force search at random points, and prints the timings.
+// Returns false if a light was missing from a cluster it reaches.
+bool light_clusters_benchmark(int lightCount, int builds);
+
+#endif // LIGHT_CLUSTERS_H
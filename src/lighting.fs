@@ -5,6 +5,7 @@ in vec3 fragPosition;
 in vec2 fragTexCoord;
 in vec4 fragColor;
 in vec3 fragNormal;
+in vec3 fragLocalPosition;
 
 // Input uniform values
 uniform sampler2D texture0;
@@ -32,16 +33,149 @@ uniform Light lights[MAX_LIGHTS];
 uniform vec4 ambient;
 uniform vec3 viewPos;
 
+// The surface a fragment lies on: its (theta, phi) and the undisplaced surface's frame
+// there, recovered from the model-space position, which heights only move along the
+// displacement direction. The baked normal map and occlusion are expressed in this frame.
+#define     SURFACE_NONE            0
+#define     SURFACE_TORUS           1
+#define     SURFACE_FLAT            2
+#define     TWO_PI                  6.28318530718
+
+uniform mat4 matNormal;
+uniform int surfaceType;
+uniform vec3 surfaceShape;          // major radius R, minor radius r, flat patch x origin
+
+// Baked normal map (see normal_map.h): texel (phi, theta) holds the normal in the surface frame.
+// normalMapEnabled is 1 for three channels, 2 for two (gray-alpha; z rebuilt from x and y).
+uniform sampler2D texture2;
+uniform int normalMapEnabled;
+
+// Baked occlusion (see occlusion.h): vertex colour channel k is the mean openness
+// 1 - sin(horizon) over the directions centred on +theta, +phi, -theta and -phi
+uniform int occlusionEnabled;
+
+vec2 surfaceAngles;
+vec3 alongTheta, alongPhi, up;      // world space
+
+void surfaceFrame()
+{
+    vec3 p = fragLocalPosition;
+    float R = surfaceShape.x;
+    float r = surfaceShape.y;
+    if (surfaceType == SURFACE_TORUS)
+    {
+        float theta = atan(p.z, p.x);
+        float phi = atan(p.y, length(p.xz) - R);
+        float ct = cos(theta), st = sin(theta), cp = cos(phi), sp = sin(phi);
+        surfaceAngles = vec2(theta, phi);
+        alongTheta = vec3(-st, 0.0, ct);
+        alongPhi = vec3(-sp*ct, cp, -sp*st);
+        up = vec3(cp*ct, sp, cp*st);
+    }
+    else
+    {
+        surfaceAngles = vec2(p.z/R, (surfaceShape.z - p.x)/r);
+        alongTheta = vec3(0.0, 0.0, 1.0);
+        alongPhi = vec3(-1.0, 0.0, 0.0);
+        up = vec3(0.0, 1.0, 0.0);
+    }
+    alongTheta = normalize((matNormal*vec4(alongTheta, 0.0)).xyz);
+    alongPhi = normalize((matNormal*vec4(alongPhi, 0.0)).xyz);
+    up = normalize((matNormal*vec4(up, 0.0)).xyz);
+}
+
+vec3 mappedNormal()
+{
+    // atan jumps by a whole turn at the seam; take the derivatives of whichever of uv and
+    // its half-turn shift is continuous there, so the seam keeps the right mip level
+    vec2 uv = surfaceAngles.yx/TWO_PI;
+    vec2 shifted = fract(uv + 0.5);
+    vec2 dx = dFdx(uv), dy = dFdy(uv);
+    vec2 dxShifted = dFdx(shifted), dyShifted = dFdy(shifted);
+    dx = mix(dx, dxShifted, step(abs(dxShifted), abs(dx)));
+    dy = mix(dy, dyShifted, step(abs(dyShifted), abs(dy)));
+
+    vec4 texel = textureGrad(texture2, uv, dx, dy);
+    vec3 n = texel.rgb*2.0 - 1.0;
+    if (normalMapEnabled == 2)
+    {
+        n.xy = texel.ra*2.0 - 1.0;
+        n.z = sqrt(max(1.0 - dot(n.xy, n.xy), 0.0));
+    }
+    return normalize(n.x*alongTheta + n.y*alongPhi + n.z*up);
+}
+
+// How much of a light the horizon toward it lets through, softened over a few degrees
+float horizonShadow(vec3 light)
+{
+    float a = dot(light, alongTheta);
+    float b = dot(light, alongPhi);
+    vec4 weights = max(vec4(a, b, -a, -b), 0.0);
+    float openness = dot(weights, fragColor)/max(dot(weights, vec4(1.0)), 1e-4);
+    float horizon = 1.0 - openness;
+    return smoothstep(horizon - 0.05, horizon + 0.05, dot(light, up));
+}
+
+// Clustered point lights (see light_clusters.h): each fragment loops over only the
+// lights binned into its screen tile and depth slice
+#define     CLUSTER_TILES_X         16
+#define     CLUSTER_TILES_Y         9
+#define     CLUSTER_SLICES          24
+#define     CLUSTER_INDEX_WIDTH     1024
+
+uniform sampler2D clusterGrid;      // (offset, count) per cluster
+uniform sampler2D clusterLights;    // (position, radius) in row 0, colour in row 1
+uniform sampler2D clusterIndices;
+uniform int clusteredLightsEnabled;
+uniform mat4 clusterView;
+uniform vec4 clusterParams;         // screen width, screen height, near plane, log(far/near)
+
+void addClusteredLights(vec3 normal, vec3 viewD, bool occluded, inout vec3 lightDot, inout vec3 specular)
+{
+    float depth = -(clusterView*vec4(fragPosition, 1.0)).z;
+    ivec2 tile = ivec2(gl_FragCoord.xy/clusterParams.xy*vec2(CLUSTER_TILES_X, CLUSTER_TILES_Y));
+    tile = clamp(tile, ivec2(0), ivec2(CLUSTER_TILES_X - 1, CLUSTER_TILES_Y - 1));
+    int slice = int(floor(log(max(depth, clusterParams.z)/clusterParams.z)/clusterParams.w*float(CLUSTER_SLICES)));
+    slice = clamp(slice, 0, CLUSTER_SLICES - 1);
+
+    vec4 cluster = texelFetch(clusterGrid, ivec2(tile.x + tile.y*CLUSTER_TILES_X, slice), 0);
+    int offset = int(cluster.x);
+    int count = int(cluster.y);
+    for (int i = 0; i < count; i++)
+    {
+        int index = offset + i;
+        int l = int(texelFetch(clusterIndices, ivec2(index%CLUSTER_INDEX_WIDTH, index/CLUSTER_INDEX_WIDTH), 0).r);
+        vec4 positionRadius = texelFetch(clusterLights, ivec2(l, 0), 0);
+        vec3 toLight = positionRadius.xyz - fragPosition;
+        float dist = length(toLight);
+        if (dist >= positionRadius.w) continue;
+
+        vec3 light = toLight/dist;
+        float falloff = 1.0 - (dist*dist)/(positionRadius.w*positionRadius.w);
+        falloff *= falloff;
+        float NdotL = max(dot(normal, light), 0.0)*falloff;
+        if (occluded) NdotL *= horizonShadow(light);
+        lightDot += texelFetch(clusterLights, ivec2(l, 1), 0).rgb*NdotL;
+        if (NdotL > 0.0) specular += falloff*pow(max(0.0, dot(viewD, reflect(-light, normal))), 16.0);
+    }
+}
+
 void main()
 {
     // Texel color fetching from texture sampler
     vec4 texelColor = texture(texture0, fragTexCoord);
     vec3 lightDot = vec3(0.0);
-    vec3 normal = normalize(fragNormal);
+    if (surfaceType != SURFACE_NONE) surfaceFrame();
+    bool mapped = surfaceType != SURFACE_NONE && normalMapEnabled != 0;
+    bool occluded = surfaceType != SURFACE_NONE && occlusionEnabled == 1;
+    vec3 normal = mapped ? mappedNormal() : normalize(fragNormal);
     vec3 viewD = normalize(viewPos - fragPosition);
     vec3 specular = vec3(0.0);
 
-    vec4 tint = colDiffuse * fragColor;
+    // The vertex colours hold baked occlusion rather than a tint. There is little ambient
+    // light to darken, so occlusion scales the direct light as well.
+    vec4 tint = colDiffuse;
+    float occlusion = occluded ? dot(fragColor, vec4(0.25)) : 1.0;
 
     // NOTE: Implement here your fragment shader code
 
@@ -62,6 +196,7 @@ void main()
             }
 
             float NdotL = max(dot(normal, light), 0.0);
+            if (occluded) NdotL *= horizonShadow(light);
             lightDot += lights[i].color.rgb*NdotL;
 
             float specCo = 0.0;
@@ -70,8 +205,11 @@ void main()
         }
     }
 
+    if (clusteredLightsEnabled == 1) addClusteredLights(normal, viewD, occluded, lightDot, specular);
+
+    lightDot *= occlusion;
     finalColor = (texelColor*((tint + vec4(specular, 1.0))*vec4(lightDot, 1.0)));
-    finalColor += texelColor*(ambient/10.0)*tint;
+    finalColor += texelColor*(ambient/10.0)*tint*occlusion;
 
     // Gamma correction
     finalColor = pow(finalColor, vec4(1.0/2.2));
@@ -13,11 +13,13 @@ out vec3 fragPosition;
 out vec2 fragTexCoord;
 out vec4 fragColor;
 out vec3 fragNormal;
+out vec3 fragLocalPosition;    // model space, for the normal map lookup
 
 void main()
 {
     fragPosition = (matModel * vec4(vertexPosition, 1.0)).xyz;
     fragNormal = normalize((matNormal * vec4(vertexNormal, 0.0)).xyz);
+    fragLocalPosition = vertexPosition;
     fragTexCoord = vertexTexCoord;
     fragColor = vertexColor;
 
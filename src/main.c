@@ -5,6 +5,7 @@
 #include "raymath.h"
 
 #include "rlgl.h"
+#include "render_layer.h"     // before the implementation, which rlights.h does not guard
 #define RLIGHTS_IMPLEMENTATION
 #include "rlights.h"
 
@@ -15,6 +16,7 @@
 #endif
 
 #include <stdlib.h>
+#include <string.h>
 #include <omp.h>
 
 #define RAYGUI_IMPLEMENTATION
@@ -24,9 +26,38 @@
 
 #include "torus.h"
 #include "terrain.h"
+#include "mesh_export.h"
+#include "startup.h"
+#include "mesh_cache.h"
+#include "octave_cache.h"
+#include "regen.h"
+#include "animate.h"
+#include "profiler.h"
+#include "save.h"
+#include "pick.h"
+#include "erosion.h"
+#include "normal_map.h"
+#include "light_clusters.h"
+#include "usage_meter.h"
+#include "flythrough.h"
+#include "mem_track.h"
+#include "tile_stream.h"
 
 #define TORUS_MAJOR_SEGMENTS 256
 #define TORUS_MINOR_SEGMENTS 128
+#define PREVIEW_MAJOR_SEGMENTS 32
+#define PREVIEW_MINOR_SEGMENTS 16
+#define REGEN_UPLOAD_BUDGET (256 * 1024)   // bytes of vertex data uploaded per frame
+#define CAMERA_NEAR 10.0f
+#define CAMERA_FAR 10000.0f
+
+// Widget bounds, shared by the Gui* calls and the pick test
+enum { GUI_WIRES, GUI_ANIMATE, GUI_NORMALS, GUI_SCALE, GUI_OCTAVES, GUI_LACUNARITY, GUI_GAIN, GUI_CONTRAST, GUI_WIDGET_COUNT };
+static const Rectangle guiBounds[GUI_WIDGET_COUNT] = {
+    { 20, 170, 28, 28 }, { 170, 170, 28, 28 }, { 270, 170, 28, 28 },
+    { 120, 270, 200, 24 }, { 120, 300, 200, 24 }, { 120, 330, 200, 24 }, { 120, 360, 200, 24 }, { 120, 390, 200, 24 }
+};
+static const char *guiCheckBoxLabels[GUI_NORMALS + 1] = { "Show Wires", "Animate", "Normals" };
 
 
 int SCREEN_WIDTH;
@@ -34,25 +65,161 @@ int SCREEN_HEIGHT;
 float HALF_SCREEN_WIDTH;
 float HALF_SCREEN_HEIGHT;
 
-Matrix MatrixTranslateVector(Vector3 v) {
-    return MatrixTranslate(v.x, v.y, v.z);
+// True over a widget; a check box also takes clicks on its label, to its right.
+static bool over_gui(Vector2 point) {
+    for (int w = 0; w < GUI_WIDGET_COUNT; w++) {
+        Rectangle bounds = guiBounds[w];
+        if (w <= GUI_NORMALS) {
+            bounds.width += GuiGetStyle(CHECKBOX, TEXT_PADDING) + MeasureText(guiCheckBoxLabels[w], GuiGetStyle(DEFAULT, TEXT_SIZE));
+        }
+        if (CheckCollisionPointRec(point, bounds)) return true;
+    }
+    return false;
+}
+
+// Swaps a finished startup mesh in for the preview the model was drawing.
+static void replace_model_mesh(Model *model, Mesh mesh) {
+    UploadMesh(&mesh, false);
+    UnloadMesh(model->meshes[0]);
+    model->meshes[0] = mesh;
+}
+
+// Startup meshes mapped from the blob cache keep their CPU arrays in the mapping.
+static void unload_model_mesh(Model *model, bool mapped) {
+    if (mapped) unload_mesh_blob(model->meshes[0]);
+    else UnloadMesh(model->meshes[0]);
+}
+
+// Uploads a baked normal map as the model's normal texture, repeating in both directions
+// like the surface parameters it is indexed by.
+static void attach_normal_map(Model *model, Image image) {
+    if (!image.data) return;
+    Texture2D texture = LoadTextureFromImage(image);
+    mem_untrack(MEM_NORMAL_MAP, (size_t)image.width * image.height * (image.format == PIXELFORMAT_UNCOMPRESSED_GRAY_ALPHA ? 2 : 3));
+    UnloadImage(image);
+    GenTextureMipmaps(&texture);
+    SetTextureFilter(texture, TEXTURE_FILTER_TRILINEAR);
+    SetTextureWrap(texture, TEXTURE_WRAP_REPEAT);
+    model->materials[0].maps[MATERIAL_MAP_NORMAL].texture = texture;
+}
+
+// Any input that can change what is drawn, including the GUI's hover and click state.
+static bool input_seen(void) {
+    if (GetKeyPressed() != 0 || IsWindowResized() || GetMouseWheelMove() != 0.0f) return true;
+    Vector2 delta = GetMouseDelta();
+    if (delta.x != 0.0f || delta.y != 0.0f) return true;
+    for (int button = MOUSE_BUTTON_LEFT; button <= MOUSE_BUTTON_MIDDLE; button++) {
+        if (IsMouseButtonDown(button) || IsMouseButtonReleased(button)) return true;
+    }
+    return false;
 }
 
-void PrintMatrix(Matrix m) {
-    printf("[ %6.2f %6.2f %6.2f %6.2f ]\n", m.m0,  m.m4,  m.m8,  m.m12);
-    printf("[ %6.2f %6.2f %6.2f %6.2f ]\n", m.m1,  m.m5,  m.m9,  m.m13);
-    printf("[ %6.2f %6.2f %6.2f %6.2f ]\n", m.m2,  m.m6,  m.m10, m.m14);
-    printf("[ %6.2f %6.2f %6.2f %6.2f ]\n", m.m3,  m.m7,  m.m11, m.m15);
+static void print_usage_sample(const char *mode, UsageSample sample) {
+    if (!sample.valid) return;
+    printf("Redraw %s: %.1f fps, CPU %.1f%% of a core, ", mode, sample.fps, sample.cpuPercent);
+    if (sample.watts >= 0.0f) printf("package %.1f W\n", sample.watts);
+    else printf("package power n/a\n");
 }
 
+// normalMapEnabled for lighting.fs: 0 off, 1 three-channel map, 2 two-channel map
+static int normal_map_mode(Model model, bool enabled) {
+    Texture2D texture = model.materials[0].maps[MATERIAL_MAP_NORMAL].texture;
+    if (!enabled || texture.id == 0) return 0;
+    return texture.format == PIXELFORMAT_UNCOMPRESSED_GRAY_ALPHA ? 2 : 1;
+}
+
+// Rebuilds the stale pickers' heights from the drawn meshes; the flat terrain's waits
+// while tiles stream in place of its mesh.
+static void refresh_pickers(TerrainPicker *torusPicker, TerrainPicker *terrainPicker, Model torus, Model terrain, bool stale[2], bool streamTerrain) {
+    if (stale[0]) picker_set_heights_from_mesh(torusPicker, torus.meshes[0]);
+    stale[0] = false;
+    if (stale[1] && !streamTerrain) {
+        picker_set_heights_from_mesh(terrainPicker, terrain.meshes[0]);
+        stale[1] = false;
+    }
+}
 
-static bool printed = false;
+// Casts a world-space ray against a model's picker, in the model's own space.
+static PickHit pick_model(TerrainPicker *picker, Model model, Ray ray) {
+    Matrix inverse = MatrixInvert(model.transform);
+    Ray local = { Vector3Transform(ray.position, inverse),
+                  Vector3Subtract(Vector3Transform(ray.direction, inverse), Vector3Transform(Vector3Zero(), inverse)) };
+    PickHit hit = picker_cast(picker, local);
+    if (hit.hit) {
+        hit.position = Vector3Transform(hit.position, model.transform);
+        hit.normal = Vector3Normalize(Vector3Subtract(Vector3Transform(hit.normal, model.transform), Vector3Transform(Vector3Zero(), model.transform)));
+    }
+    return hit;
+}
 
-int main(void)
+int main(int argc, char **argv)
 {
+    // Progressive startup draws low-res previews while the full meshes are built
+    bool progressive = true;
+    bool cameraBench = false;
+    bool normalMaps = false;
+    int meshRings = TORUS_MAJOR_SEGMENTS, meshSides = TORUS_MINOR_SEGMENTS;
+    int pointLightCount = 0;
+    bool onDemand = true;
+    int flythroughFrames = 0;
+    const char *flythroughPath = NULL;
+    const char *flythroughReport = "flythrough.json";
+    const char *recordPath = NULL;
+    bool streamTerrain = false;
+    ErosionParams erosion = EROSION_DEFAULT_PARAMS;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--no-progressive") == 0) progressive = false;
+        // Evaluate the heightmap's domain warp on a grid this many pixels apart and interpolate it
+        if (strcmp(argv[i], "--warp-factor") == 0 && i + 1 < argc) SetHeightmapWarpFactor(atoi(argv[++i]));
+        // Erode the startup heightmap with this many droplets (and seed); see erosion.h
+        if (strcmp(argv[i], "--erode") == 0 && i + 1 < argc) erosion.droplets = atoi(argv[++i]);
+        if (strcmp(argv[i], "--erode-seed") == 0 && i + 1 < argc) erosion.seed = (uint32_t)strtoul(argv[++i], NULL, 10);
+        // Then slump slopes steeper than the talus with this many thermal steps
+        if (strcmp(argv[i], "--thermal") == 0 && i + 1 < argc) erosion.thermalSteps = atoi(argv[++i]);
+        if (strcmp(argv[i], "--thermal-talus") == 0 && i + 1 < argc) erosion.talus = (float)atof(argv[++i]);
+        // Time camera ground queries along a scripted path on the full meshes, then exit
+        if (strcmp(argv[i], "--camera-bench") == 0) { cameraBench = true; progressive = false; }
+        // Bake full-resolution normal maps, so coarser meshes keep the heightmap's shading detail
+        if (strcmp(argv[i], "--normal-map") == 0) normalMaps = true;
+        if (strcmp(argv[i], "--mesh-segments") == 0 && i + 2 < argc) {
+            meshRings = atoi(argv[++i]);
+            meshSides = atoi(argv[++i]);
+        }
+        // Redraw every frame, for benchmarking, instead of only when something changes
+        if (strcmp(argv[i], "--continuous") == 0) onDemand = false;
+        // Draw this many frames along a camera path with no frame cap, write the frame times
+        // as JSON and exit; the path is scripted unless one recorded with --record-path is given
+        if (strcmp(argv[i], "--flythrough") == 0 && i + 1 < argc) flythroughFrames = atoi(argv[++i]);
+        if (strcmp(argv[i], "--flythrough-path") == 0 && i + 1 < argc) flythroughPath = argv[++i];
+        if (strcmp(argv[i], "--flythrough-report") == 0 && i + 1 < argc) flythroughReport = argv[++i];
+        // Save the camera's path through this session, for --flythrough-path
+        if (strcmp(argv[i], "--record-path") == 0 && i + 1 < argc) recordPath = argv[++i];
+        // Stay within this many MB of tracked CPU buffers where a leaner path exists; see mem_track.h
+        if (strcmp(argv[i], "--memory-budget") == 0 && i + 1 < argc) mem_set_budget((size_t)(atof(argv[++i]) * 1048576.0));
+        // Draw the flat terrain as endless tiles streamed around the camera; see tile_stream.h
+        if (strcmp(argv[i], "--stream-terrain") == 0) streamTerrain = true;
+        // Clustered point lights over the terrain, on top of the four rlights
+        if (strcmp(argv[i], "--lights") == 0 && i + 1 < argc) pointLightCount = atoi(argv[++i]);
+        // Check and time the light binning on the CPU, without a window
+        if (strcmp(argv[i], "--light-bench") == 0 && i + 1 < argc) return light_clusters_benchmark(atoi(argv[++i]), 1000) ? 0 : 1;
+    }
+    if (pointLightCount > CLUSTER_MAX_LIGHTS) pointLightCount = CLUSTER_MAX_LIGHTS;
+    if (flythroughFrames > 0) {
+        progressive = false;
+        onDemand = false;
+    }
+    // Mesh indices are 16 bits wide
+    if (meshRings < 3 || meshSides < 3 || meshRings * meshSides > 65536) {
+        fprintf(stderr, "Invalid mesh segments %d x %d, using %d x %d\n", meshRings, meshSides, TORUS_MAJOR_SEGMENTS, TORUS_MINOR_SEGMENTS);
+        meshRings = TORUS_MAJOR_SEGMENTS;
+        meshSides = TORUS_MINOR_SEGMENTS;
+    }
+    SetHeightmapErosion(&erosion);
+
     bool showWireframe = false;
     size_t frameCounter = 0;
     size_t CELL_SIZE = 50;
+    prof_init();
     printf("Linked Raylib version: %s\n", RAYLIB_VERSION);
     const int glslVer = rlGetVersion();
     printf("GL version: %i\n", glslVer);
@@ -71,7 +238,8 @@ int main(void)
     HALF_SCREEN_WIDTH = SCREEN_WIDTH / 2.0f;
     HALF_SCREEN_HEIGHT = SCREEN_HEIGHT / 2.0f;
 
-    SetTargetFPS(60);
+    // Vsync is never requested, so the flythrough runs as fast as the driver allows
+    SetTargetFPS(flythroughFrames > 0 ? 0 : 60);
 
     Camera3D camera = { 0 };
     camera.position = (Vector3){ 0.0f, 0.0f, 0.0f};  // Positioned out along +Z axis
@@ -80,7 +248,16 @@ int main(void)
     camera.fovy = 45.0f;
     camera.projection = CAMERA_PERSPECTIVE;
 
+    PROF_BEGIN("startup");
+    // Mesh generation runs on worker threads while the shader and lights are set up
+    float R = SCREEN_WIDTH / (2.0f * PI);
+    float r = SCREEN_HEIGHT / (2.0f * PI);
+    SetTorusDimensions(R, r);
+    StartupMeshes startup;
+    startup_begin(&startup, meshRings, meshSides, progressive, normalMaps);
+
     // Load basic lighting shader
+    PROF_BEGIN("LoadShader");
     Shader shader = LoadShader("src/lighting.vs","src/lighting.fs");
     shader.locs[SHADER_LOC_MATRIX_MVP] = GetShaderLocation(shader, "mvp");
     shader.locs[SHADER_LOC_MATRIX_MODEL] = GetShaderLocation(shader, "matModel");
@@ -88,11 +265,18 @@ int main(void)
     printf("shader.locs[SHADER_LOC_MATRIX_MVP]: %d\n", shader.locs[SHADER_LOC_MATRIX_MVP]);
     printf("shader.locs[SHADER_LOC_MATRIX_MODEL]: %d\n", shader.locs[SHADER_LOC_MATRIX_MODEL]);
     printf("shader.locs[SHADER_LOC_MATRIX_NORMAL]: %d\n", shader.locs[SHADER_LOC_MATRIX_NORMAL]);
+    PROF_END();
     
     // Ambient light level (some basic lighting)
     int ambientLoc = GetShaderLocation(shader, "ambient");
     SetShaderValue(shader, ambientLoc, (float[4]){ 0.1f, 0.1f, 0.1f, 1.0f }, SHADER_UNIFORM_VEC4);
 
+    // Baked shading; the surface and normal map switch are set per model, as both share the shader
+    int surfaceTypeLoc = GetShaderLocation(shader, "surfaceType");
+    int normalMapEnabledLoc = GetShaderLocation(shader, "normalMapEnabled");
+    int occlusionEnabledLoc = GetShaderLocation(shader, "occlusionEnabled");
+    SetShaderValue(shader, GetShaderLocation(shader, "surfaceShape"), (float[3]){ R, r, (float)SCREEN_HEIGHT }, SHADER_UNIFORM_VEC3);
+
     // Create lights
     Light lights[MAX_LIGHTS] = { 0 };
     lights[0] = CreateLight(LIGHT_POINT, (Vector3){ -HALF_SCREEN_WIDTH, 200, -HALF_SCREEN_HEIGHT }, Vector3Zero(), YELLOW, shader);
@@ -100,35 +284,283 @@ int main(void)
     lights[2] = CreateLight(LIGHT_POINT, (Vector3){ -HALF_SCREEN_WIDTH, 200, HALF_SCREEN_HEIGHT }, Vector3Zero(), GREEN, shader);
     lights[3] = CreateLight(LIGHT_POINT, (Vector3){ HALF_SCREEN_WIDTH, 200, -HALF_SCREEN_HEIGHT }, Vector3Zero(), BLUE, shader);
 
+    // Clustered point lights: half float over the flat terrain, half circle the torus. The
+    // binned lists reach the shader as material maps, which DrawModel binds.
+    shader.locs[SHADER_LOC_MAP_ROUGHNESS] = GetShaderLocation(shader, "clusterGrid");
+    shader.locs[SHADER_LOC_MAP_OCCLUSION] = GetShaderLocation(shader, "clusterLights");
+    shader.locs[SHADER_LOC_MAP_EMISSION] = GetShaderLocation(shader, "clusterIndices");
+    int clusteredLightsEnabledLoc = GetShaderLocation(shader, "clusteredLightsEnabled");
+    int clusterViewLoc = GetShaderLocation(shader, "clusterView");
+    int clusterParamsLoc = GetShaderLocation(shader, "clusterParams");
+    bool useClusteredLights = pointLightCount > 0;
+    LightClusters *lightClusters = NULL;
+    ClusterLight *pointLights = NULL;
+    float *pointLightHeights = NULL;
+    if (pointLightCount > 0) {
+        lightClusters = light_clusters_create();
+        pointLights = malloc(pointLightCount * sizeof(ClusterLight));
+        pointLightHeights = malloc(pointLightCount * sizeof(float));
+        if (!pointLights || !pointLightHeights) {
+            perror("malloc failed");
+            exit(1);
+        }
+        for (int i = 0; i < pointLightCount; i++) {
+            float a = GetRandomValue(0, 9999) / 10000.0f, b = GetRandomValue(0, 9999) / 10000.0f;
+            if (i % 2 == 0) {
+                pointLights[i].position = (Vector3){ SCREEN_HEIGHT * a, 0.0f, SCREEN_WIDTH * b };
+                pointLightHeights[i] = 250.0f + 250.0f * GetRandomValue(0, 9999) / 10000.0f;
+            } else {
+                float angle = 2.0f * PI * a, ring = R + r + 150.0f;
+                pointLights[i].position = (Vector3){ ring * cosf(angle), 0.0f, ring * sinf(angle) };
+                pointLightHeights[i] = 1000.0f + (2.0f * b - 1.0f) * (r + 100.0f);
+            }
+            pointLights[i].radius = 120.0f + GetRandomValue(0, 160);
+            pointLights[i].color = ColorFromHSV(GetRandomValue(0, 359), 0.7f, 1.0f);
+        }
+    }
 
-    float R = SCREEN_WIDTH / (2.0f * PI);
-    float r = SCREEN_HEIGHT / (2.0f * PI);
-    SetTorusDimensions(R, r);
-    Mesh torus_mesh = MyGenTorusMesh(TORUS_MAJOR_SEGMENTS, TORUS_MINOR_SEGMENTS);
-    GenMeshTangents(&torus_mesh);
-    Model torus_model = LoadModelFromMesh(torus_mesh);
+
+    Mesh torusMesh, terrainMesh;
+    bool meshMapped[2] = { false, false };     // [0] torus, [1] flat terrain; see unload_model_mesh
+    if (progressive) {
+        torusMesh = build_preview_mesh(false, PREVIEW_MAJOR_SEGMENTS, PREVIEW_MINOR_SEGMENTS);
+        terrainMesh = build_preview_mesh(true, PREVIEW_MAJOR_SEGMENTS, PREVIEW_MINOR_SEGMENTS);
+        UploadMesh(&torusMesh, false);
+        UploadMesh(&terrainMesh, false);
+    } else {
+        startup_finish(&startup);
+        mem_report("startup");
+        torusMesh = startup.torus.mesh;
+        terrainMesh = startup.terrain.mesh;
+        meshMapped[0] = startup.torus.mapped;
+        meshMapped[1] = startup.terrain.mapped;
+    }
+    Model torus_model = LoadModelFromMesh(torusMesh);
     torus_model.materials[0].shader = shader;  // <== Required for lighting to take effect
 
-    Mesh terrain_mesh = MyGenFlatTorusMesh(TORUS_MAJOR_SEGMENTS, TORUS_MINOR_SEGMENTS);
-    GenMeshTangents(&terrain_mesh);
-    Model terrain = LoadModelFromMesh(terrain_mesh);
+    Model terrain = LoadModelFromMesh(terrainMesh);
     terrain.materials[0].shader = shader;
+    if (!progressive) {
+        attach_normal_map(&torus_model, startup.torus.normalMap);
+        attach_normal_map(&terrain, startup.terrain.normalMap);
+    }
 
-
-    Vector3 translation1 = { 2.0f * R, 0.0f, 0.0f };  // Move model to this position
-    Vector3 translation2 = { 0.0, 1000.0f, 0.0f };
+    // Both meshes are built in world space. Per-frame uniforms go through the render
+    // layer, which only sends the ones that changed.
+    RenderLayer *renderLayer = render_layer_create(shader);
+    RenderObject torusObject = render_object(&torus_model, MatrixIdentity());
+    RenderObject terrainObject = render_object(&terrain, MatrixIdentity());
+
+
+    PROF_END();
+    bool refining = progressive;
+    bool firstFrame = true;
+
+    // Slider state; edits apply once the full-resolution meshes are in
+    TerrainParams terrainParams = TERRAIN_DEFAULT_PARAMS;
+    TerrainParams appliedParams = terrainParams;
+    float octavesValue = (float)terrainParams.octaves;
+    RegenWorker *regen = NULL;
+
+    // Endless flat terrain, built straight from the slider parameters
+    TileStream *tileStream = NULL;
+    TerrainParams streamedParams = terrainParams;
+
+    // Animated terrain; owns the front meshes while it runs, so regeneration waits for it
+    bool animate = false;
+    bool animating = false;
+
+    // The normal maps and occlusion match the startup heightmap, so regenerated or animated
+    // terrain drops them
+    bool useNormalMaps = normalMaps;
+    bool useOcclusion = true;
+    bool bakedTerrainShown = true;
+    TerrainAnimator *torusAnimator = NULL;
+    TerrainAnimator *terrainAnimator = NULL;
+    // The startup meshes, held while animation runs over them, and the sliders they go with
+    MeshSnapshot torusSnapshot = { 0 }, terrainSnapshot = { 0 };
+    TerrainParams snapshotParams = terrainParams;
+
+    // Mouse picking; a picker's heights are rebuilt from its model's mesh on the first
+    // pick after the mesh changes. While tiles stream, the flat patch is not drawn, so its
+    // picker is neither cast nor rebuilt.
+    TerrainPicker *torusPicker = picker_create(false, meshRings, meshSides);
+    TerrainPicker *terrainPicker = picker_create(true, meshRings, meshSides);
+    bool pickersStale[2] = { true, true };
+    PickHit pickHit = { 0 };
+    TerrainCamera terrainCamera;
+    terrain_camera_init(&terrainCamera, torusPicker, terrainPicker);
+
+    if (cameraBench) {
+        picker_set_heights_from_mesh(torusPicker, torus_model.meshes[0]);
+        picker_set_heights_from_mesh(terrainPicker, terrain.meshes[0]);
+        terrain_camera_benchmark(torusPicker, terrainPicker, 1000000);
+        picker_destroy(torusPicker);
+        picker_destroy(terrainPicker);
+        CloseWindow();
+        return 0;
+    }
+    double pickUs = 0.0;
+    int pickNodes = 0;
+
+    // On demand, frames are drawn only while something changes; in between, the loop
+    // blocks on input events. The meter compares what each mode costs.
+    UsageMeter usage;
+    usage_meter_init(&usage);
+    Camera3D drawnCamera = { 0 };
+    bool settleFrame = true;
+
+    Flythrough *flythrough = NULL;
+    if (flythroughFrames > 0) {
+        flythrough = flythrough_create(flythroughPath, flythroughFrames);
+        if (!flythrough) {
+            CloseWindow();
+            return 1;
+        }
+    }
+    bool flythroughDone = false;
+    CameraPath recordedPath = { 0 };
 
     //int number_of_frame = 0;
     while (!WindowShouldClose())
     {
-        //float time = GetTime();
+        float time = GetTime();
+        if (flythrough && !flythrough_step(flythrough, &camera, &time)) {
+            flythroughDone = true;
+            break;
+        }
         frameCounter++;
-
-        // Update camera
-        UpdateCameraManual(&camera);
-
-        // Projection matrix (pass aspect ratio)
-        float aspect = (float)GetScreenWidth() / (float)GetScreenHeight();
+        prof_frame_mark();
+
+        PROF_BEGIN("update");
+        // Swap in full-resolution meshes as the background build finishes them
+        if (refining) {
+            StartupMeshJob *job;
+            while ((job = startup_take_ready(&startup)) != NULL) {
+                replace_model_mesh(job->flat ? &terrain : &torus_model, job->mesh);
+                meshMapped[job->flat ? 1 : 0] = job->mapped;
+                attach_normal_map(job->flat ? &terrain : &torus_model, job->normalMap);
+                pickersStale[0] = pickersStale[1] = true;
+                printf("Full %s mesh ready after %.1f ms\n", job->name, GetTime() * 1000.0);
+            }
+            refining = !startup_poll(&startup);
+            if (!refining) mem_report("startup");
+        }
+
+        // Slider edits regenerate in the background; only the layers the change invalidates
+        // are recomputed, and a newer edit cancels an older one still in flight
+        terrainParams.octaves = (int)(octavesValue + 0.5f);
+        bool paramsChanged = memcmp(&terrainParams, &appliedParams, sizeof(TerrainParams)) != 0;
+        if (!refining && animate) {
+            if (!animating || paramsChanged) {
+                if (!animating && bakedTerrainShown && !(regen && regen_busy(regen))) {
+                    torusSnapshot = mesh_snapshot_take(torus_model.meshes[0]);
+                    terrainSnapshot = mesh_snapshot_take(terrain.meshes[0]);
+                    snapshotParams = appliedParams;
+                }
+                animator_destroy(torusAnimator);
+                animator_destroy(terrainAnimator);
+                torusAnimator = animator_create(false, meshRings, meshSides, &terrainParams);
+                terrainAnimator = animator_create(true, meshRings, meshSides, &terrainParams);
+                appliedParams = terrainParams;
+                animating = true;
+            }
+            animator_update(torusAnimator, &torus_model.meshes[0], &terrainParams, time);
+            animator_update(terrainAnimator, &terrain.meshes[0], &terrainParams, time);
+            pickersStale[0] = pickersStale[1] = true;
+            bakedTerrainShown = false;
+        } else {
+            // Put the static terrain back: the startup meshes as they were when the sliders
+            // still match them, otherwise a regeneration
+            if (animating && torusSnapshot.vertices && memcmp(&terrainParams, &snapshotParams, sizeof(TerrainParams)) == 0) {
+                mesh_snapshot_restore(&torusSnapshot, &torus_model.meshes[0]);
+                mesh_snapshot_restore(&terrainSnapshot, &terrain.meshes[0]);
+                appliedParams = terrainParams;
+                paramsChanged = false;
+                pickersStale[0] = pickersStale[1] = true;
+                bakedTerrainShown = true;
+            } else if (animating) {
+                mesh_snapshot_free(&torusSnapshot);
+                mesh_snapshot_free(&terrainSnapshot);
+                paramsChanged = true;
+            }
+            animating = false;
+            if (!refining && paramsChanged) {
+                if (!regen) regen = regen_create(meshRings, meshSides);
+                regen_request(regen, &terrainParams);
+                appliedParams = terrainParams;
+            }
+            if (regen && regen_update(regen, &torus_model, &terrain, meshMapped, REGEN_UPLOAD_BUDGET)) {
+                pickersStale[0] = pickersStale[1] = true;
+                bakedTerrainShown = false;
+            }
+        }
+
+        // The tiles follow the orbit target, so the terrain under the view is built first
+        if (IsKeyPressed(KEY_X)) streamTerrain = !streamTerrain;
+        if (streamTerrain) {
+            if (!tileStream) {
+                tileStream = tile_stream_create(&terrainParams);
+                streamedParams = terrainParams;
+            } else if (memcmp(&terrainParams, &streamedParams, sizeof(TerrainParams)) != 0) {
+                tile_stream_set_params(tileStream, &terrainParams);
+                streamedParams = terrainParams;
+            }
+            tile_stream_update(tileStream, camera.target, REGEN_UPLOAD_BUDGET);
+        }
+        terrainCamera.hidden[1] = streamTerrain;
+
+        // Left click picks the nearer of the two surfaces; the previews are not picked
+        Vector2 mouse = GetMousePosition();
+        if (!refining && !over_gui(mouse) && IsMouseButtonPressed(MOUSE_LEFT_BUTTON)) {
+            refresh_pickers(torusPicker, terrainPicker, torus_model, terrain, pickersStale, streamTerrain);
+            Ray ray = GetMouseRay(mouse, camera);
+            uint64_t start = prof_now_ns();
+            PickHit torusHit = pick_model(torusPicker, torus_model, ray);
+            PickHit terrainHit = { 0 };
+            if (!streamTerrain) terrainHit = pick_model(terrainPicker, terrain, ray);
+            pickUs = (double)(prof_now_ns() - start) / 1.0e3;
+            pickNodes = torusPicker->nodesVisited + (streamTerrain ? 0 : terrainPicker->nodesVisited);
+            pickHit = torusHit;
+            if (terrainHit.hit && (!torusHit.hit || terrainHit.distance < torusHit.distance)) pickHit = terrainHit;
+        }
+
+        // C cycles orbit, ground-clamped orbit and walking; V walks on the other surface
+        if (IsKeyPressed(KEY_C) && !refining) {
+            terrainCamera.mode = (terrainCamera.mode + 1) % TERRAIN_CAMERA_MODE_COUNT;
+            if (terrainCamera.mode == TERRAIN_CAMERA_WALK) terrain_camera_walk_from(&terrainCamera, &camera, terrainCamera.walkSurface);
+        }
+        if (IsKeyPressed(KEY_V) && terrainCamera.mode == TERRAIN_CAMERA_WALK) {
+            terrain_camera_walk_from(&terrainCamera, &camera, 1 - terrainCamera.walkSurface);
+        }
+        if (terrainCamera.mode != TERRAIN_CAMERA_ORBIT) {
+            refresh_pickers(torusPicker, terrainPicker, torus_model, terrain, pickersStale, streamTerrain);
+        }
+
+        // Update camera; the flythrough has already placed it
+        if (!flythrough) UpdateCameraTerrain(&camera, &terrainCamera);
+        if (recordPath) camera_path_record(&recordedPath, time, &camera);
+
+        // Must match the projection set in the draw below
+        float aspect = (float)SCREEN_WIDTH / SCREEN_HEIGHT;
+
+        // Bob the point lights and bin them for this frame's view
+        if (IsKeyPressed(KEY_L) && lightClusters) useClusteredLights = !useClusteredLights;
+        render_set_value(renderLayer, clusteredLightsEnabledLoc, (int[1]){ useClusteredLights }, SHADER_UNIFORM_INT);
+        if (useClusteredLights) {
+            for (int i = 0; i < pointLightCount; i++) pointLights[i].position.y = pointLightHeights[i] + 40.0f * sinf(0.7f * time + i);
+            Matrix clusterView = GetCameraMatrix(camera);
+            light_clusters_build(lightClusters, pointLights, pointLightCount, clusterView, camera.fovy, aspect, CAMERA_NEAR, CAMERA_FAR);
+            light_clusters_upload(lightClusters);
+            Model *models[2] = { &torus_model, &terrain };
+            for (int m = 0; m < 2; m++) {
+                models[m]->materials[0].maps[MATERIAL_MAP_ROUGHNESS].texture = lightClusters->gridTexture;
+                models[m]->materials[0].maps[MATERIAL_MAP_OCCLUSION].texture = lightClusters->lightTexture;
+                models[m]->materials[0].maps[MATERIAL_MAP_EMISSION].texture = lightClusters->indexTexture;
+            }
+            render_set_matrix(renderLayer, clusterViewLoc, clusterView);
+            render_set_value(renderLayer, clusterParamsLoc, (float[4]){ (float)GetScreenWidth(), (float)GetScreenHeight(), CAMERA_NEAR, logf(CAMERA_FAR / CAMERA_NEAR) }, SHADER_UNIFORM_VEC4);
+        }
 
 
         // Check key inputs to enable/disable lights
@@ -136,91 +568,104 @@ int main(void)
         if (IsKeyPressed(KEY_R)) { lights[1].enabled = !lights[1].enabled; }
         if (IsKeyPressed(KEY_G)) { lights[2].enabled = !lights[2].enabled; }
         if (IsKeyPressed(KEY_B)) { lights[3].enabled = !lights[3].enabled; }
+
+        if (IsKeyPressed(KEY_O)) { useOcclusion = !useOcclusion; }
+        if (IsKeyPressed(KEY_M)) { onDemand = !onDemand; }
+        if (IsKeyPressed(KEY_I)) { mem_report("request"); }
+        if (IsKeyPressed(KEY_P)) { prof_set_enabled(!prof_is_enabled()); }
+        if (IsKeyPressed(KEY_T)) { prof_write_chrome_trace("terrain_trace.json"); }
+
+        // Export both meshes for external tools
+        if (IsKeyPressed(KEY_E)) {
+            double exportStart = GetTime();
+            make_resource_folder(S_MESHES);
+            char *path = build_fullpath(S_RESOURCES, S_MESHES, "torus.ply");
+            export_mesh_ply(path, torus_model.meshes[0]);
+            free(path);
+            path = build_fullpath(S_RESOURCES, S_MESHES, "torus.glb");
+            export_mesh_glb(path, torus_model.meshes[0]);
+            free(path);
+            path = build_fullpath(S_RESOURCES, S_MESHES, "terrain.ply");
+            export_mesh_ply(path, terrain.meshes[0]);
+            free(path);
+            path = build_fullpath(S_RESOURCES, S_MESHES, "terrain.glb");
+            export_mesh_glb(path, terrain.meshes[0]);
+            free(path);
+            printf("Mesh export took %.1f ms\n", (GetTime() - exportStart) * 1000.0);
+        }
         
         // Update light values (actually, only enable/disable them)
-        for (int i = 0; i < MAX_LIGHTS; i++) UpdateLightValues(shader, lights[i]);
-        
+        for (int i = 0; i < MAX_LIGHTS; i++) render_set_light(renderLayer, &lights[i]);
+        PROF_END();
+
+        // Background mesh work and the bobbing point lights change the picture without input.
+        // A frame that changed something is followed by one more, which picks up the GUI
+        // edits made while drawing it, before the loop goes back to waiting.
+        usage_meter_update(&usage, onDemand);
+        bool busy = refining || animating || (regen && regen_busy(regen)) ||
+                    (streamTerrain && tile_stream_stats(tileStream).pending > 0) || (useClusteredLights && pointLightCount > 0);
+        bool changed = busy || input_seen() || memcmp(&camera, &drawnCamera, sizeof(Camera3D)) != 0;
+        if (onDemand && !changed && !settleFrame) {
+            EnableEventWaiting();
+            PollInputEvents();      // blocks until the next event
+            continue;
+        }
+        settleFrame = changed;
+        if (onDemand && !settleFrame) EnableEventWaiting();
+        else DisableEventWaiting();
+        drawnCamera = camera;
+        usage_meter_frame(&usage);
+
+        PROF_BEGIN("draw");
         BeginDrawing();
             ClearBackground(RAYWHITE);
 
             BeginMode3D(camera);
 
-                rlSetMatrixProjection(MatrixPerspective(
-                    DEG2RAD * camera.fovy,
-                    (float)SCREEN_WIDTH / SCREEN_HEIGHT,
-                    10.0f,     // near clip
-                    10000.0f   // far clip
-                ));
-                
-                BeginShaderMode(shader);
-                    // --- Draw torus_model ---
-                    Matrix torusModelMatrix = MatrixTranslateVector(translation2); 
-                    Matrix view = GetCameraMatrix(camera);
-                    Matrix projection = MatrixPerspective(camera.fovy * DEG2RAD, aspect, 10.0f, 10000.0f);
-                    Matrix torusMVP = MatrixMultiply(projection, MatrixMultiply(view, torusModelMatrix));
-                    Matrix torusNormalMatrix = MatrixTranspose(MatrixInvert(torusModelMatrix));
-
-                    SetShaderValueMatrix(shader, shader.locs[SHADER_LOC_MATRIX_MVP], torusMVP);
-                    SetShaderValueMatrix(shader, shader.locs[SHADER_LOC_MATRIX_MODEL], torusModelMatrix);
-                    SetShaderValueMatrix(shader, shader.locs[SHADER_LOC_MATRIX_NORMAL], torusNormalMatrix);
-
-                    DrawModel(torus_model, Vector3Zero(), 1.0f, WHITE);
-
-                    // --- Draw terrain model ---
-                    Matrix terrainModelMatrix = MatrixTranslateVector(translation1);  
-                    Matrix terrainMVP = MatrixMultiply(projection, MatrixMultiply(view, terrainModelMatrix));
-                    Matrix terrainNormalMatrix = MatrixTranspose(MatrixInvert(terrainModelMatrix));
-
+                rlSetMatrixProjection(MatrixPerspective(DEG2RAD * camera.fovy, aspect, CAMERA_NEAR, CAMERA_FAR));
 
-                    // Set shader values for terrain
-                    // Note: We use the same shader for both models, so we can reuse the locations
-                    SetShaderValueMatrix(shader, shader.locs[SHADER_LOC_MATRIX_MVP], terrainMVP);
-                    SetShaderValueMatrix(shader, shader.locs[SHADER_LOC_MATRIX_MODEL], terrainModelMatrix);
-                    SetShaderValueMatrix(shader, shader.locs[SHADER_LOC_MATRIX_NORMAL], terrainNormalMatrix);
-
-                    DrawModel(terrain, Vector3Zero(), 1.0f, WHITE);
-
-                    if(!printed)
-                    {
-                        printf("torusMVP:\n");
-                        PrintMatrix(torusMVP);
-                        printf("torusModelMatrix:\n");
-                        PrintMatrix(torusModelMatrix);
-                        printf("torusNormalMatrix:\n");
-                        PrintMatrix(torusNormalMatrix);
-                        printf("terrainMVP:\n");
-                        PrintMatrix(terrainMVP);
-                        printf("terrainModelMatrix:\n");
-                        PrintMatrix(terrainModelMatrix);
-                        printf("terrainNormalMatrix:\n");
-                        PrintMatrix(terrainNormalMatrix);
-                        printed = true;
+                BeginShaderMode(shader);
+                    // The surface type and normal map switch differ per model, as both share the shader
+                    int mapped = normal_map_mode(torus_model, useNormalMaps && bakedTerrainShown);
+                    render_set_value(renderLayer, surfaceTypeLoc, (int[1]){ 1 }, SHADER_UNIFORM_INT);
+                    render_set_value(renderLayer, normalMapEnabledLoc, (int[1]){ mapped }, SHADER_UNIFORM_INT);
+                    render_set_value(renderLayer, occlusionEnabledLoc, (int[1]){ useOcclusion && bakedTerrainShown }, SHADER_UNIFORM_INT);
+                    render_draw(renderLayer, &torusObject);
+
+                    mapped = normal_map_mode(terrain, useNormalMaps && bakedTerrainShown);
+                    render_set_value(renderLayer, surfaceTypeLoc, (int[1]){ 2 }, SHADER_UNIFORM_INT);
+                    render_set_value(renderLayer, normalMapEnabledLoc, (int[1]){ mapped }, SHADER_UNIFORM_INT);
+                    if (!streamTerrain) render_draw(renderLayer, &terrainObject);
+                    else {
+                        // Tiles have no baked maps or occlusion, and no surface frame to read them in
+                        render_set_value(renderLayer, surfaceTypeLoc, (int[1]){ 0 }, SHADER_UNIFORM_INT);
+                        render_set_value(renderLayer, normalMapEnabledLoc, (int[1]){ 0 }, SHADER_UNIFORM_INT);
+                        render_set_value(renderLayer, occlusionEnabledLoc, (int[1]){ 0 }, SHADER_UNIFORM_INT);
+                        tile_stream_draw(tileStream, renderLayer, terrain.materials[0]);
                     }
 
                     if(showWireframe)
                     {
-                        /* 
-                        rlPushMatrix();
-                            Matrix transform = MatrixTranslateVector(translation1);
-                            rlMultMatrixf(MatrixToFloat(transform));
-                            rlEnableWireMode();
-                            DrawModel(terrain, (Vector3){0, 0, 0}, 1.0f, DARKGRAY);  // Draw at origin because transform is handled manually
-                        rlDisableWireMode();
-                        rlPopMatrix();
-                        */
-                        DrawModelWires(torus_model, (Vector3){ 0.0f, 0.0f, 0.0f }, 1.0f, DARKGRAY);
-                        DrawModelWires(terrain, (Vector3){ 0.0f, 0.0f, 0.0f }, 1.0f, DARKGRAY);
-
-
+                        render_set_value(renderLayer, surfaceTypeLoc, (int[1]){ 0 }, SHADER_UNIFORM_INT);
+                        render_draw_wires(renderLayer, &torusObject, DARKGRAY);
+                        if (!streamTerrain) render_draw_wires(renderLayer, &terrainObject, DARKGRAY);
                     }
                 EndShaderMode();
 
-                // Draw spheres to show where the lights are
-                for (int i = 0; i < MAX_LIGHTS; i++)
-                {
-                    if (lights[i].enabled) DrawSphereEx(lights[i].position, 10.0f, 8, 8, lights[i].color);
-                    else DrawSphereWires(lights[i].position, 10.0f, 8, 8, ColorAlpha(lights[i].color, 0.3f));
+                if (pickHit.hit) {
+                    render_gizmo(renderLayer, pickHit.position, 4.0f, MAGENTA, false);
+                    DrawLine3D(pickHit.position, Vector3Add(pickHit.position, Vector3Scale(pickHit.normal, 40.0f)), MAGENTA);
                 }
+
+                // Spheres show where the lights are
+                for (int i = 0; i < MAX_LIGHTS; i++) {
+                    if (lights[i].enabled) render_gizmo(renderLayer, lights[i].position, 10.0f, lights[i].color, false);
+                    else render_gizmo(renderLayer, lights[i].position, 10.0f, ColorAlpha(lights[i].color, 0.3f), true);
+                }
+                if (useClusteredLights) {
+                    for (int i = 0; i < pointLightCount; i++) render_gizmo(renderLayer, pointLights[i].position, 3.0f, pointLights[i].color, false);
+                }
+                render_draw_gizmos(renderLayer);
             EndMode3D();
 
 
@@ -231,16 +676,107 @@ int main(void)
             DrawText(TextFormat("Frame Time: %0.2f ms", GetFrameTime() * 1000), 20, 110, 30, BLUE);
             DrawText(TextFormat("OpenMP threads: %d", omp_get_max_threads()), 20, 140, 30, BLUE);
 
-            GuiCheckBox((Rectangle){ 20, 170, 28, 28 }, "Show Wires", &showWireframe);
+            GuiCheckBox(guiBounds[GUI_WIRES], guiCheckBoxLabels[GUI_WIRES], &showWireframe);
+            if (refining) GuiDisable();
+            GuiCheckBox(guiBounds[GUI_ANIMATE], guiCheckBoxLabels[GUI_ANIMATE], &animate);
+            GuiEnable();
+            if (!normalMaps || !bakedTerrainShown) GuiDisable();
+            GuiCheckBox(guiBounds[GUI_NORMALS], guiCheckBoxLabels[GUI_NORMALS], &useNormalMaps);
+            GuiEnable();
+            prof_draw_overlay(20, 210);
+
+            if (refining) GuiDisable();
+            GuiSliderBar(guiBounds[GUI_SCALE], "Scale", TextFormat("%.4f", terrainParams.scale), &terrainParams.scale, 0.001f, 0.02f);
+            GuiSliderBar(guiBounds[GUI_OCTAVES], "Octaves", TextFormat("%d", terrainParams.octaves), &octavesValue, 1.0f, OCTAVE_CACHE_MAX_OCTAVES);
+            GuiSliderBar(guiBounds[GUI_LACUNARITY], "Lacunarity", TextFormat("%.2f", terrainParams.lacunarity), &terrainParams.lacunarity, 1.5f, 3.0f);
+            GuiSliderBar(guiBounds[GUI_GAIN], "Gain", TextFormat("%.2f", terrainParams.gain), &terrainParams.gain, 0.2f, 0.8f);
+            GuiSliderBar(guiBounds[GUI_CONTRAST], "Contrast", TextFormat("%.2f", terrainParams.contrast), &terrainParams.contrast, 1.0f, 8.0f);
+            GuiEnable();
+            if (animating) {
+                double ms = torusAnimator->totalMs + terrainAnimator->totalMs;
+                double evalMs = torusAnimator->evalMs + terrainAnimator->evalMs;
+                DrawText(TextFormat("Animate: %0.1f ms/frame (noise %0.1f ms), %0.0f k vertices/s on %d threads",
+                         ms, evalMs, (torusAnimator->count + terrainAnimator->count) / evalMs, omp_get_max_threads()), 20, 450, 20, DARKGRAY);
+            }
+            if (regen) DrawText(TextFormat("Terrain regen: %s, last %0.1f ms", regen_busy(regen) ? "working" : "idle", regen_last_compute_ms(regen)), 20, 420, 20, DARKGRAY);
+
+            const char *cameraModes[TERRAIN_CAMERA_MODE_COUNT] = { "orbit", "orbit above ground", "walk" };
+            DrawText(TextFormat("Camera (C): %s%s", cameraModes[terrainCamera.mode],
+                     terrainCamera.mode == TERRAIN_CAMERA_WALK ? (terrainCamera.walkSurface ? " on terrain (V, WASD)" : " on torus (V, WASD)") : ""),
+                     20, 510, 20, DARKGRAY);
+            DrawText(TextFormat("Baked occlusion (O): %s", !bakedTerrainShown ? "n/a for edited terrain" : useOcclusion ? "on" : "off"), 20, 540, 20, DARKGRAY);
+            if (lightClusters) {
+                DrawText(TextFormat("Clustered lights (L): %d %s, binned in %0.0f us, up to %d per cluster%s", pointLightCount,
+                         useClusteredLights ? "on" : "off", lightClusters->buildUs, lightClusters->maxPerCluster,
+                         lightClusters->overflowed ? ", index list full" : ""), 20, 570, 20, DARKGRAY);
+            }
+            DrawText(TextFormat("Draw calls: %d, uniform uploads: %d (%d unchanged skipped)", renderLayer->last.drawCalls,
+                     renderLayer->last.uniformUploads, renderLayer->last.uniformsSkipped), 20, 600, 20, DARKGRAY);
+            const char *usageText[USAGE_METER_MODES];
+            for (int m = 0; m < USAGE_METER_MODES; m++) {
+                UsageSample sample = usage.modes[m];
+                if (!sample.valid) usageText[m] = "not measured";
+                else if (sample.watts < 0.0f) usageText[m] = TextFormat("%0.1f fps, CPU %0.0f%%", sample.fps, sample.cpuPercent);
+                else usageText[m] = TextFormat("%0.1f fps, CPU %0.0f%%, %0.1f W", sample.fps, sample.cpuPercent, sample.watts);
+            }
+            DrawText(TextFormat("Redraw (M): %s. On demand: %s; continuous: %s", onDemand ? "on demand" : "continuous",
+                     usageText[1], usageText[0]), 20, 630, 20, DARKGRAY);
+            DrawText(TextFormat("Memory (I prints by subsystem): %0.1f MB tracked, peak %0.1f MB",
+                     mem_live_bytes() / 1048576.0, mem_peak_bytes() / 1048576.0), 20, 660, 20, DARKGRAY);
+            if (streamTerrain) {
+                TileStreamStats tiles = tile_stream_stats(tileStream);
+                DrawText(TextFormat("Streamed terrain (X): %d/%d tiles resident, %d uploaded (%d KB), %0.1f ms per tile",
+                         tiles.resident, TILE_SLOTS, tiles.uploads, tiles.uploadBytes / 1024, tiles.buildMs), 20, 690, 20, DARKGRAY);
+            } else {
+                DrawText("Streamed terrain (X): off", 20, 690, 20, DARKGRAY);
+            }
+            if (pickHit.hit) {
+                DrawText(TextFormat("Pick: theta %0.3f phi %0.3f height %0.1f, %0.1f us, %d nodes",
+                         pickHit.theta, pickHit.phi, pickHit.height, pickUs, pickNodes), 20, 480, 20, DARKGRAY);
+            }
 
             DrawFPS(SCREEN_WIDTH - 100, 10);
 
 
 
         EndDrawing();
+        render_frame_end(renderLayer);
+        if (flythrough) flythrough_count(flythrough, renderLayer->last);
+        PROF_END();
+        if (firstFrame) {
+            printf("Time to first frame: %.1f ms after window creation\n", GetTime() * 1000.0);
+            firstFrame = false;
+        }
     }
 
+    print_usage_sample("on demand", usage.modes[1]);
+    print_usage_sample("continuous", usage.modes[0]);
+    int status = 0;
+    if (flythroughDone && !flythrough_write_report(flythrough, flythroughReport, SCREEN_WIDTH, SCREEN_HEIGHT)) status = 1;
+    flythrough_destroy(flythrough);
+    if (recordPath) camera_path_save(&recordedPath, recordPath);
+    camera_path_free(&recordedPath);
+
+    // Let the background build finish before the GL context goes away
+    if (refining) startup_finish(&startup);
+    regen_destroy(regen);
+    unload_model_mesh(&torus_model, meshMapped[0]);
+    unload_model_mesh(&terrain, meshMapped[1]);
+    tile_stream_destroy(tileStream);
+    animator_destroy(torusAnimator);
+    animator_destroy(terrainAnimator);
+    mesh_snapshot_free(&torusSnapshot);
+    mesh_snapshot_free(&terrainSnapshot);
+    picker_destroy(torusPicker);
+    picker_destroy(terrainPicker);
+    UnloadTexture(torus_model.materials[0].maps[MATERIAL_MAP_NORMAL].texture);
+    UnloadTexture(terrain.materials[0].maps[MATERIAL_MAP_NORMAL].texture);
+    light_clusters_destroy(lightClusters);
+    render_layer_destroy(renderLayer);
+    free(pointLights);
+    free(pointLightHeights);
+
     CloseWindow();
 
-    return 0;
+    return status;
 }
\ No newline at end of file
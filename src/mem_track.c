@@ -0,0 +1,105 @@
+#include "mem_track.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+static const char *tagNames[MEM_TAG_COUNT] = {
+    "heightmap", "pgm image", "mesh grids", "mesh arrays", "normal maps", "scratch",
+    "edit", "picking", "render", "tiles"
+};
+
+static size_t live[MEM_TAG_COUNT], peak[MEM_TAG_COUNT];
+static size_t liveTotal, peakTotal;
+static size_t budget;
+static bool warned;
+
+static void raise_peak(size_t *peakValue, size_t value) {
+    size_t old = __atomic_load_n(peakValue, __ATOMIC_RELAXED);
+    while (value > old && !__atomic_compare_exchange_n(peakValue, &old, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) { }
+}
+
+void mem_track(MemTag tag, size_t size) {
+    size_t tagLive = __atomic_add_fetch(&live[tag], size, __ATOMIC_RELAXED);
+    size_t total = __atomic_add_fetch(&liveTotal, size, __ATOMIC_RELAXED);
+    raise_peak(&peak[tag], tagLive);
+    raise_peak(&peakTotal, total);
+    if (budget > 0 && total > budget && !__atomic_exchange_n(&warned, true, __ATOMIC_RELAXED)) {
+        fprintf(stderr, "Memory budget of %.1f MB exceeded by %s: %.1f MB live\n",
+                budget / 1048576.0, tagNames[tag], total / 1048576.0);
+    }
+}
+
+void mem_untrack(MemTag tag, size_t size) {
+    __atomic_sub_fetch(&live[tag], size, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&liveTotal, size, __ATOMIC_RELAXED);
+}
+
+void *mem_alloc(MemTag tag, size_t size) {
+    void *p = malloc(size);
+    if (!p) {
+        perror("malloc failed");
+        exit(1);
+    }
+    mem_track(tag, size);
+    return p;
+}
+
+void *mem_calloc(MemTag tag, size_t size) {
+    void *p = calloc(1, size);
+    if (!p) {
+        perror("calloc failed");
+        exit(1);
+    }
+    mem_track(tag, size);
+    return p;
+}
+
+void mem_free(MemTag tag, void *p, size_t size) {
+    if (!p) return;
+    free(p);
+    mem_untrack(tag, size);
+}
+
+void mem_set_budget(size_t bytes) {
+    budget = bytes;
+}
+
+bool mem_budget_fits(size_t bytes) {
+    return budget == 0 || __atomic_load_n(&liveTotal, __ATOMIC_RELAXED) + bytes <= budget;
+}
+
+size_t mem_live_bytes(void) {
+    return __atomic_load_n(&liveTotal, __ATOMIC_RELAXED);
+}
+
+size_t mem_peak_bytes(void) {
+    return __atomic_load_n(&peakTotal, __ATOMIC_RELAXED);
+}
+
+// Resident set size from /proc, or 0 where it isn't available
+static size_t resident_bytes(void) {
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    unsigned long pages = 0, resident = 0;
+    int read = fscanf(f, "%lu %lu", &pages, &resident);
+    fclose(f);
+    return read == 2 ? (size_t)resident * sysconf(_SC_PAGESIZE) : 0;
+}
+
+void mem_report(const char *when) {
+    printf("Memory at %s:%s\n", when, budget > 0 ? "" : " (no budget)");
+    for (int t = 0; t < MEM_TAG_COUNT; t++) {
+        printf("  %-12s live %8.1f MB  peak %8.1f MB\n", tagNames[t],
+               __atomic_load_n(&live[t], __ATOMIC_RELAXED) / 1048576.0, __atomic_load_n(&peak[t], __ATOMIC_RELAXED) / 1048576.0);
+    }
+    printf("  %-12s live %8.1f MB  peak %8.1f MB", "tracked", mem_live_bytes() / 1048576.0, mem_peak_bytes() / 1048576.0);
+    if (budget > 0) printf("  budget %.1f MB", budget / 1048576.0);
+    printf("\n");
+
+    // ru_maxrss is in kilobytes on Linux
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("  process      rss  %8.1f MB  peak %8.1f MB\n", resident_bytes() / 1048576.0, usage.ru_maxrss / 1024.0);
+}
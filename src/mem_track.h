@@ -0,0 +1,48 @@
+#ifndef MEM_TRACK_H
+#define MEM_TRACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum MemTag {
+    MEM_HEIGHTMAP,          // float ** heightmaps, generated or loaded
+    MEM_IMAGE,              // 8-bit heightmap images for the PGM export
+    MEM_MESH_GRID,          // Vector3 ** vertex and normal grids while a mesh is built
+    MEM_MESH,               // flattened mesh arrays, until the Mesh is returned
+    MEM_NORMAL_MAP,         // baked normal maps, until they are uploaded
+    MEM_SCRATCH,            // per-vertex sample buffers and trig tables
+    MEM_EDIT,               // slider edits and animation: octave layers, regen results, animator arrays
+    MEM_PICKING,            // picking height pyramids
+    MEM_RENDER,             // per-frame render state: gizmo instances, light clusters
+    MEM_TILES,              // streamed terrain tile staging
+    MEM_TAG_COUNT
+} MemTag;
+
+// Live and peak bytes per subsystem for the large CPU buffers of the startup, mesh,
+// editing, picking, rendering and tile streaming paths, so peak footprint can be read
+// off for a given resolution. Thread safe.
+//
+// Buffers handed to raylib (mesh arrays, normal map images) are counted while this
+// code owns them; mem_untrack() is called where ownership passes on.
+//
+// With a budget set, callers with a cheaper way to do the same work ask
+// mem_budget_fits() first: the PGM export streams rows instead of building a whole
+// image, and normal maps are baked with two channels instead of three. Allocations
+// with no alternative still succeed, with a warning the first time they pass the budget.
+void *mem_alloc(MemTag tag, size_t size);       // exits on failure
+void *mem_calloc(MemTag tag, size_t size);      // zeroed; exits on failure
+void mem_free(MemTag tag, void *p, size_t size);
+// For memory allocated or freed elsewhere (MemAlloc, UnloadImage)
+void mem_track(MemTag tag, size_t size);
+void mem_untrack(MemTag tag, size_t size);
+
+// 0 means no budget
+void mem_set_budget(size_t bytes);
+bool mem_budget_fits(size_t bytes);
+
+size_t mem_live_bytes(void);
+size_t mem_peak_bytes(void);
+// Prints live and peak bytes per tag, and the process's resident and peak resident size.
+void mem_report(const char *when);
+
+#endif // MEM_TRACK_H
@@ -0,0 +1,272 @@
+#include "mesh_cache.h"
+#include "save.h"
+#include "mem_track.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+#endif
+
+#define MESH_BLOB_MAGIC 0x48534D54u  // "TMSH"
+#define MESH_BLOB_VERSION 5   // 2: analytic normals, 3: bicubic heightmap sampling, 4: baked occlusion colours,
+                              // 5: keyed by heightmap size and mtime, content hash in the header
+#define MESH_BLOB_ALIGN 64
+#define HASH_SEED 0xcbf29ce484222325ull
+#define HASH_CHUNK (1 << 20)    // bytes read per step when hashing a file; a whole number of words
+
+enum { BLOB_VERTICES, BLOB_NORMALS, BLOB_TEXCOORDS, BLOB_TANGENTS, BLOB_INDICES, BLOB_COLORS, BLOB_ARRAY_COUNT };
+
+// Arrays follow the header at 64-byte aligned offsets; an offset of 0 means the array is absent.
+typedef struct MeshBlobHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t heightmapKey;
+    uint64_t contentHash;       // of the heightmap file, checked after the blob is in use
+    int32_t rings, sides;
+    int32_t vertexCount, triangleCount;
+    uint64_t fileSize;
+    uint64_t offsets[BLOB_ARRAY_COUNT];
+    uint64_t sizes[BLOB_ARRAY_COUNT];
+} MeshBlobHeader;
+
+static uint64_t align_up(uint64_t n) { return (n + MESH_BLOB_ALIGN - 1) & ~(uint64_t)(MESH_BLOB_ALIGN - 1); }
+
+static char *blob_path(const char *name, uint64_t heightmapKey, int rings, int sides) {
+    char filename[128];
+    snprintf(filename, sizeof(filename), "%s_%dx%d_%016llx.mesh", name, rings, sides, (unsigned long long)heightmapKey);
+    return build_fullpath(S_RESOURCES, S_MESHES, filename);
+}
+
+// FNV-1a over 64-bit words, continuing from hash (HASH_SEED to start). A tail that is not a
+// whole word is folded in byte by byte, so only the last piece of a stream may have one.
+static uint64_t hash_bytes(uint64_t hash, const unsigned char *data, size_t size) {
+    size_t words = size / sizeof(uint64_t);
+    for (size_t i = 0; i < words; i++) {
+        uint64_t word;
+        memcpy(&word, data + i * sizeof(uint64_t), sizeof(word));
+        hash ^= word;
+        hash *= 0x100000001b3ull;
+    }
+    for (size_t i = words * sizeof(uint64_t); i < size; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+bool heightmap_key(const char *filename, uint64_t *out_key) {
+    char *fullpath = build_fullpath(S_RESOURCES, S_HEIGHTMAPS, filename);
+    struct stat st;
+    bool ok = stat(fullpath, &st) == 0;
+    free(fullpath);
+    if (!ok) return false;
+    uint64_t fields[2] = { (uint64_t)st.st_size, (uint64_t)st.st_mtime };
+    *out_key = hash_bytes(HASH_SEED, (const unsigned char *)fields, sizeof(fields));
+    return true;
+}
+
+bool hash_heightmap(const char *filename, uint64_t *out_hash) {
+    char *fullpath = build_fullpath(S_RESOURCES, S_HEIGHTMAPS, filename);
+    FILE *f = fopen(fullpath, "rb");
+    free(fullpath);
+    if (!f) return false;
+
+    unsigned char *chunk = mem_alloc(MEM_SCRATCH, HASH_CHUNK);
+    uint64_t hash = HASH_SEED;
+    size_t read;
+    while ((read = fread(chunk, 1, HASH_CHUNK, f)) > 0) hash = hash_bytes(hash, chunk, read);
+    bool ok = !ferror(f);
+    fclose(f);
+    mem_free(MEM_SCRATCH, chunk, HASH_CHUNK);
+    if (ok) *out_hash = hash;
+    return ok;
+}
+
+bool save_mesh_blob(Mesh mesh, const char *name, uint64_t heightmapKey, uint64_t contentHash, int rings, int sides) {
+    MeshBlobHeader header = { 0 };
+    header.magic = MESH_BLOB_MAGIC;
+    header.version = MESH_BLOB_VERSION;
+    header.heightmapKey = heightmapKey;
+    header.contentHash = contentHash;
+    header.rings = rings;
+    header.sides = sides;
+    header.vertexCount = mesh.vertexCount;
+    header.triangleCount = mesh.triangleCount;
+
+    const void *arrays[BLOB_ARRAY_COUNT] = { mesh.vertices, mesh.normals, mesh.texcoords, mesh.tangents, mesh.indices, mesh.colors };
+    const uint64_t sizes[BLOB_ARRAY_COUNT] = {
+        (uint64_t)mesh.vertexCount * 3 * sizeof(float),
+        (uint64_t)mesh.vertexCount * 3 * sizeof(float),
+        (uint64_t)mesh.vertexCount * 2 * sizeof(float),
+        (uint64_t)mesh.vertexCount * 4 * sizeof(float),
+        (uint64_t)mesh.triangleCount * 3 * sizeof(unsigned short),
+        (uint64_t)mesh.vertexCount * 4 * sizeof(unsigned char)
+    };
+    uint64_t offset = align_up(sizeof(MeshBlobHeader));
+    for (int a = 0; a < BLOB_ARRAY_COUNT; a++) {
+        if (!arrays[a]) continue;
+        header.offsets[a] = offset;
+        header.sizes[a] = sizes[a];
+        offset = align_up(offset + sizes[a]);
+    }
+    header.fileSize = offset;
+
+    make_resource_folder(S_MESHES);
+    char *fullpath = blob_path(name, heightmapKey, rings, sides);
+    FILE *f = fopen(fullpath, "wb");
+    if (!f) {
+        perror("Cannot open mesh blob for writing");
+        free(fullpath);
+        return false;
+    }
+
+    static const unsigned char zeros[MESH_BLOB_ALIGN] = { 0 };
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    uint64_t written = sizeof(header);
+    for (int a = 0; ok && a < BLOB_ARRAY_COUNT; a++) {
+        if (!arrays[a]) continue;
+        ok = fwrite(zeros, 1, header.offsets[a] - written, f) == header.offsets[a] - written;
+        ok = ok && fwrite(arrays[a], 1, header.sizes[a], f) == header.sizes[a];
+        written = header.offsets[a] + header.sizes[a];
+    }
+    ok = ok && fwrite(zeros, 1, header.fileSize - written, f) == header.fileSize - written;
+    if (fclose(f) != 0) ok = false;
+
+    if (ok) printf("Mesh blob saved to %s\n", fullpath);
+    else perror("Error writing mesh blob");
+    free(fullpath);
+    return ok;
+}
+
+static void *map_file(const char *filename, size_t *out_size) {
+#ifdef _WIN32
+    FILE *f = fopen(filename, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    void *data = malloc(size);
+    if (data && fread(data, 1, size, f) != (size_t)size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    *out_size = size;
+    return data;
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(MeshBlobHeader)) {
+        close(fd);
+        return NULL;
+    }
+    // Private and writable so later in-place edits copy the touched pages instead of the file
+    void *data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return NULL;
+    *out_size = st.st_size;
+    return data;
+#endif
+}
+
+static void unmap_file(void *data, size_t size) {
+#ifdef _WIN32
+    (void)size;
+    free(data);
+#else
+    munmap(data, size);
+#endif
+}
+
+bool mesh_blob_exists(const char *name, uint64_t heightmapKey, int rings, int sides) {
+    char *fullpath = blob_path(name, heightmapKey, rings, sides);
+    FILE *f = fopen(fullpath, "rb");
+    free(fullpath);
+    if (!f) return false;
+    fclose(f);
+    return true;
+}
+
+bool map_mesh_blob(Mesh *mesh, const char *name, uint64_t heightmapKey, int rings, int sides, uint64_t *contentHash) {
+    char *fullpath = blob_path(name, heightmapKey, rings, sides);
+    size_t size = 0;
+    unsigned char *data = map_file(fullpath, &size);
+    if (!data) {
+        printf("No mesh blob at %s\n", fullpath);
+        free(fullpath);
+        return false;
+    }
+
+    // The arrays are handed to UploadMesh as they are, so every count, size and offset
+    // has to agree with the grid; a header with the right key is not enough
+    const MeshBlobHeader *header = (const MeshBlobHeader *)data;
+    bool valid = size >= sizeof(MeshBlobHeader) &&
+                 header->magic == MESH_BLOB_MAGIC && header->version == MESH_BLOB_VERSION &&
+                 header->heightmapKey == heightmapKey && header->rings == rings && header->sides == sides &&
+                 header->vertexCount == rings * sides && header->triangleCount == 2 * rings * sides &&
+                 header->fileSize == size && header->offsets[BLOB_VERTICES] == align_up(sizeof(MeshBlobHeader));
+    if (valid) {
+        const uint64_t expected[BLOB_ARRAY_COUNT] = {
+            (uint64_t)header->vertexCount * 3 * sizeof(float),
+            (uint64_t)header->vertexCount * 3 * sizeof(float),
+            (uint64_t)header->vertexCount * 2 * sizeof(float),
+            (uint64_t)header->vertexCount * 4 * sizeof(float),
+            (uint64_t)header->triangleCount * 3 * sizeof(unsigned short),
+            (uint64_t)header->vertexCount * 4 * sizeof(unsigned char)
+        };
+        for (int a = 0; valid && a < BLOB_ARRAY_COUNT; a++) {
+            uint64_t offset = header->offsets[a];
+            if (offset == 0) continue;
+            valid = header->sizes[a] == expected[a] && offset % MESH_BLOB_ALIGN == 0 &&
+                    offset >= align_up(sizeof(MeshBlobHeader)) && offset <= size && header->sizes[a] <= size - offset;
+        }
+    }
+    if (!valid) {
+        fprintf(stderr, "Mesh blob %s is invalid, ignoring it\n", fullpath);
+        unmap_file(data, size);
+        free(fullpath);
+        return false;
+    }
+
+    Mesh loaded = { 0 };
+    loaded.vertexCount = header->vertexCount;
+    loaded.triangleCount = header->triangleCount;
+    loaded.vertices = (float *)(data + header->offsets[BLOB_VERTICES]);
+    if (header->offsets[BLOB_NORMALS]) loaded.normals = (float *)(data + header->offsets[BLOB_NORMALS]);
+    if (header->offsets[BLOB_TEXCOORDS]) loaded.texcoords = (float *)(data + header->offsets[BLOB_TEXCOORDS]);
+    if (header->offsets[BLOB_TANGENTS]) loaded.tangents = (float *)(data + header->offsets[BLOB_TANGENTS]);
+    if (header->offsets[BLOB_INDICES]) loaded.indices = (unsigned short *)(data + header->offsets[BLOB_INDICES]);
+    if (header->offsets[BLOB_COLORS]) loaded.colors = data + header->offsets[BLOB_COLORS];
+
+    *mesh = loaded;
+    if (contentHash) *contentHash = header->contentHash;
+    printf("Mesh blob mapped from %s\n", fullpath);
+    free(fullpath);
+    return true;
+}
+
+void unmap_mesh_blob(Mesh mesh) {
+    // The vertex array sits at the first aligned offset after the header
+    unsigned char *data = (unsigned char *)mesh.vertices - align_up(sizeof(MeshBlobHeader));
+    unmap_file(data, ((const MeshBlobHeader *)data)->fileSize);
+}
+
+void unload_mesh_blob(Mesh mesh) {
+    // Let raylib release the GPU buffers, but not the mapped CPU arrays
+    Mesh gpu = mesh;
+    gpu.vertices = NULL;
+    gpu.normals = NULL;
+    gpu.texcoords = NULL;
+    gpu.tangents = NULL;
+    gpu.indices = NULL;
+    gpu.colors = NULL;
+    UnloadMesh(gpu);
+    unmap_mesh_blob(mesh);
+}
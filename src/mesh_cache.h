@@ -0,0 +1,26 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "raylib.h"
+
+// Finished meshes are cached in resources/meshes as <name>_<rings>x<sides>_<key>.mesh.
+// The key covers the size and modification time of the heightmap file the mesh was built
+// from, so finding a blob costs one stat. The blob also records a hash of the file's
+// contents, for a check that can run on a worker while the blob is mapped.
+bool heightmap_key(const char *filename, uint64_t *out_key);
+bool hash_heightmap(const char *filename, uint64_t *out_hash);     // reads the file a chunk at a time
+bool save_mesh_blob(Mesh mesh, const char *name, uint64_t heightmapKey, uint64_t contentHash, int rings, int sides);
+bool mesh_blob_exists(const char *name, uint64_t heightmapKey, int rings, int sides);
+
+// Maps a cached blob. The CPU arrays point into the mapping, so once uploaded the mesh
+// must be released with unload_mesh_blob() rather than UnloadMesh().
+// Mapping does not touch the GPU and may run on any thread.
+// contentHash, when given, receives the content hash the blob was saved with.
+bool map_mesh_blob(Mesh *mesh, const char *name, uint64_t heightmapKey, int rings, int sides, uint64_t *contentHash);
+void unload_mesh_blob(Mesh mesh);
+// Releases a mapped mesh that was never uploaded; may run on any thread.
+void unmap_mesh_blob(Mesh mesh);
+
+#endif // MESH_CACHE_H
@@ -0,0 +1,306 @@
+#include "mesh_export.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <float.h>
+
+#ifdef _WIN32
+    struct iovec { void *iov_base; size_t iov_len; };
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <limits.h>
+    #include <sys/uio.h>
+    #ifndef IOV_MAX
+        #define IOV_MAX 1024
+    #endif
+#endif
+
+// Size of the staging buffer used to interleave PLY records before each write.
+#define EXPORT_CHUNK_BYTES (1 << 20)
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    #define PLY_FORMAT "binary_big_endian"
+#else
+    #define PLY_FORMAT "binary_little_endian"
+#endif
+
+// --- Output file: a raw descriptor on POSIX so whole arrays go out in one writev() ---
+
+typedef struct ExportFile {
+#ifdef _WIN32
+    FILE *f;
+#else
+    int fd;
+#endif
+} ExportFile;
+
+static bool export_open(ExportFile *out, const char *filename) {
+#ifdef _WIN32
+    out->f = fopen(filename, "wb");
+    if (!out->f) {
+        perror("Cannot open mesh file for writing");
+        return false;
+    }
+    setvbuf(out->f, NULL, _IOFBF, EXPORT_CHUNK_BYTES);
+#else
+    out->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out->fd < 0) {
+        perror("Cannot open mesh file for writing");
+        return false;
+    }
+#endif
+    return true;
+}
+
+static bool export_close(ExportFile *out) {
+#ifdef _WIN32
+    return fclose(out->f) == 0;
+#else
+    return close(out->fd) == 0;
+#endif
+}
+
+// Writes every iovec completely, resuming after short writes.
+static bool export_writev(ExportFile *out, struct iovec *iov, int iovcnt) {
+#ifdef _WIN32
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len > 0 && fwrite(iov[i].iov_base, 1, iov[i].iov_len, out->f) != iov[i].iov_len) {
+            perror("Error writing mesh data");
+            return false;
+        }
+    }
+    return true;
+#else
+    while (iovcnt > 0) {
+        int batch = iovcnt < IOV_MAX ? iovcnt : IOV_MAX;
+        ssize_t written = writev(out->fd, iov, batch);
+        if (written < 0) {
+            perror("Error writing mesh data");
+            return false;
+        }
+        // Skip the fully written vectors and trim the partially written one
+        while (batch > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+            batch--;
+        }
+        if (batch > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return true;
+#endif
+}
+
+static bool export_write(ExportFile *out, const void *data, size_t size) {
+    struct iovec iov = { (void *)data, size };
+    return export_writev(out, &iov, 1);
+}
+
+// --- Binary PLY ---
+
+static int triangle_index(Mesh mesh, int triangle, int corner) {
+    int k = triangle * 3 + corner;
+    return mesh.indices ? mesh.indices[k] : k;
+}
+
+static bool is_degenerate(Mesh mesh, int triangle) {
+    int a = triangle_index(mesh, triangle, 0);
+    int b = triangle_index(mesh, triangle, 1);
+    int c = triangle_index(mesh, triangle, 2);
+    return a == b || b == c || a == c;
+}
+
+bool export_mesh_ply(const char *filename, Mesh mesh) {
+    if (!mesh.vertices || mesh.vertexCount <= 0) {
+        fprintf(stderr, "export_mesh_ply: mesh has no CPU vertex data\n");
+        return false;
+    }
+
+    // Unused index slots are zero-filled, so leave out the triangles they produce
+    int faceCount = 0;
+    for (int t = 0; t < mesh.triangleCount; t++) {
+        if (!is_degenerate(mesh, t)) faceCount++;
+    }
+
+    char header[512];
+    int headerLength = snprintf(header, sizeof(header),
+        "ply\nformat " PLY_FORMAT " 1.0\ncomment generated by Terrain\n"
+        "element vertex %d\nproperty float x\nproperty float y\nproperty float z\n%s%s"
+        "element face %d\nproperty list uchar uint vertex_indices\nend_header\n",
+        mesh.vertexCount,
+        mesh.normals ? "property float nx\nproperty float ny\nproperty float nz\n" : "",
+        mesh.texcoords ? "property float s\nproperty float t\n" : "",
+        faceCount);
+
+    ExportFile out;
+    if (!export_open(&out, filename)) return false;
+
+    unsigned char *chunk = malloc(EXPORT_CHUNK_BYTES);
+    if (!chunk) {
+        perror("malloc failed");
+        export_close(&out);
+        return false;
+    }
+
+    bool ok = export_write(&out, header, headerLength);
+
+    // Vertex records are interleaved, so stage them through the chunk buffer
+    const int floatsPerVertex = 3 + (mesh.normals ? 3 : 0) + (mesh.texcoords ? 2 : 0);
+    const int vertexBytes = floatsPerVertex * sizeof(float);
+    const int verticesPerChunk = EXPORT_CHUNK_BYTES / vertexBytes;
+    for (int start = 0; ok && start < mesh.vertexCount; start += verticesPerChunk) {
+        int end = start + verticesPerChunk < mesh.vertexCount ? start + verticesPerChunk : mesh.vertexCount;
+        float *dst = (float *)chunk;
+        for (int i = start; i < end; i++) {
+            memcpy(dst, &mesh.vertices[i * 3], 3 * sizeof(float));
+            dst += 3;
+            if (mesh.normals) {
+                memcpy(dst, &mesh.normals[i * 3], 3 * sizeof(float));
+                dst += 3;
+            }
+            if (mesh.texcoords) {
+                memcpy(dst, &mesh.texcoords[i * 2], 2 * sizeof(float));
+                dst += 2;
+            }
+        }
+        ok = export_write(&out, chunk, (size_t)(end - start) * vertexBytes);
+    }
+
+    // Face records: a uchar count followed by three uint32 indices (13 bytes, unaligned)
+    const int faceBytes = 1 + 3 * sizeof(uint32_t);
+    size_t used = 0;
+    for (int t = 0; ok && t < mesh.triangleCount; t++) {
+        if (is_degenerate(mesh, t)) continue;
+        if (used + faceBytes > EXPORT_CHUNK_BYTES) {
+            ok = export_write(&out, chunk, used);
+            used = 0;
+        }
+        chunk[used++] = 3;
+        for (int c = 0; c < 3; c++) {
+            uint32_t index = (uint32_t)triangle_index(mesh, t, c);
+            memcpy(chunk + used, &index, sizeof(index));
+            used += sizeof(index);
+        }
+    }
+    if (ok && used > 0) ok = export_write(&out, chunk, used);
+
+    free(chunk);
+    if (!export_close(&out)) ok = false;
+    if (ok) printf("Mesh exported to %s (%d vertices, %d faces)\n", filename, mesh.vertexCount, faceCount);
+    return ok;
+}
+
+// --- Minimal glTF 2.0 binary (GLB) ---
+
+#define GLB_MAGIC 0x46546C67u        // "glTF"
+#define GLB_CHUNK_JSON 0x4E4F534Au   // "JSON"
+#define GLB_CHUNK_BIN 0x004E4942u    // "BIN\0"
+#define GLTF_ARRAY_BUFFER 34962
+#define GLTF_ELEMENT_ARRAY_BUFFER 34963
+#define GLTF_FLOAT 5126
+#define GLTF_UNSIGNED_SHORT 5123
+
+static size_t pad4(size_t n) { return (n + 3) & ~(size_t)3; }
+
+typedef struct GlbView {
+    const void *data;
+    size_t byteLength;
+    const char *attribute;   // NULL for the index view
+    const char *type;
+    int count;
+} GlbView;
+
+bool export_mesh_glb(const char *filename, Mesh mesh) {
+    if (!mesh.vertices || mesh.vertexCount <= 0) {
+        fprintf(stderr, "export_mesh_glb: mesh has no CPU vertex data\n");
+        return false;
+    }
+
+    // The arrays are written as they are, one bufferView each, so no copy is made
+    GlbView views[5];
+    int viewCount = 0;
+    views[viewCount++] = (GlbView){ mesh.vertices, mesh.vertexCount * 3 * sizeof(float), "POSITION", "VEC3", mesh.vertexCount };
+    if (mesh.normals) views[viewCount++] = (GlbView){ mesh.normals, mesh.vertexCount * 3 * sizeof(float), "NORMAL", "VEC3", mesh.vertexCount };
+    if (mesh.texcoords) views[viewCount++] = (GlbView){ mesh.texcoords, mesh.vertexCount * 2 * sizeof(float), "TEXCOORD_0", "VEC2", mesh.vertexCount };
+    if (mesh.tangents) views[viewCount++] = (GlbView){ mesh.tangents, mesh.vertexCount * 4 * sizeof(float), "TANGENT", "VEC4", mesh.vertexCount };
+    if (mesh.indices) views[viewCount++] = (GlbView){ mesh.indices, mesh.triangleCount * 3 * sizeof(unsigned short), NULL, "SCALAR", mesh.triangleCount * 3 };
+
+    // glTF requires bounds on POSITION
+    float minPos[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float maxPos[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (int i = 0; i < mesh.vertexCount; i++) {
+        for (int c = 0; c < 3; c++) {
+            float value = mesh.vertices[i * 3 + c];
+            if (value < minPos[c]) minPos[c] = value;
+            if (value > maxPos[c]) maxPos[c] = value;
+        }
+    }
+
+    size_t binLength = 0;
+    for (int v = 0; v < viewCount; v++) binLength += views[v].byteLength;  // float views keep 4-byte alignment
+    size_t binPadded = pad4(binLength);
+
+    char json[4096];
+    size_t used = 0;
+    used += snprintf(json + used, sizeof(json) - used,
+        "{\"asset\":{\"version\":\"2.0\",\"generator\":\"Terrain\"},\"scene\":0,\"scenes\":[{\"nodes\":[0]}],"
+        "\"nodes\":[{\"mesh\":0}],\"meshes\":[{\"primitives\":[{\"attributes\":{");
+    for (int v = 0, first = 1; v < viewCount; v++) {
+        if (!views[v].attribute) continue;
+        used += snprintf(json + used, sizeof(json) - used, "%s\"%s\":%d", first ? "" : ",", views[v].attribute, v);
+        first = 0;
+    }
+    used += snprintf(json + used, sizeof(json) - used, "}");
+    if (mesh.indices) used += snprintf(json + used, sizeof(json) - used, ",\"indices\":%d", viewCount - 1);
+    used += snprintf(json + used, sizeof(json) - used, "}]}],\"buffers\":[{\"byteLength\":%zu}],\"bufferViews\":[", binPadded);
+    size_t offset = 0;
+    for (int v = 0; v < viewCount; v++) {
+        used += snprintf(json + used, sizeof(json) - used, "%s{\"buffer\":0,\"byteOffset\":%zu,\"byteLength\":%zu,\"target\":%d}",
+            v ? "," : "", offset, views[v].byteLength, views[v].attribute ? GLTF_ARRAY_BUFFER : GLTF_ELEMENT_ARRAY_BUFFER);
+        offset += views[v].byteLength;
+    }
+    used += snprintf(json + used, sizeof(json) - used, "],\"accessors\":[");
+    for (int v = 0; v < viewCount; v++) {
+        used += snprintf(json + used, sizeof(json) - used, "%s{\"bufferView\":%d,\"componentType\":%d,\"count\":%d,\"type\":\"%s\"",
+            v ? "," : "", v, views[v].attribute ? GLTF_FLOAT : GLTF_UNSIGNED_SHORT, views[v].count, views[v].type);
+        if (v == 0) {
+            used += snprintf(json + used, sizeof(json) - used, ",\"min\":[%g,%g,%g],\"max\":[%g,%g,%g]",
+                minPos[0], minPos[1], minPos[2], maxPos[0], maxPos[1], maxPos[2]);
+        }
+        used += snprintf(json + used, sizeof(json) - used, "}");
+    }
+    used += snprintf(json + used, sizeof(json) - used, "]}");
+    if (used + 4 > sizeof(json)) {
+        fprintf(stderr, "export_mesh_glb: JSON chunk overflow\n");
+        return false;
+    }
+    size_t jsonPadded = pad4(used);
+    memset(json + used, ' ', jsonPadded - used);  // JSON chunk is padded with spaces
+
+    uint32_t glbHeader[3] = { GLB_MAGIC, 2, (uint32_t)(12 + 8 + jsonPadded + 8 + binPadded) };
+    uint32_t jsonHeader[2] = { (uint32_t)jsonPadded, GLB_CHUNK_JSON };
+    uint32_t binHeader[2] = { (uint32_t)binPadded, GLB_CHUNK_BIN };
+    static const unsigned char zeros[4] = { 0 };
+
+    struct iovec iov[10];
+    int iovcnt = 0;
+    iov[iovcnt++] = (struct iovec){ glbHeader, sizeof(glbHeader) };
+    iov[iovcnt++] = (struct iovec){ jsonHeader, sizeof(jsonHeader) };
+    iov[iovcnt++] = (struct iovec){ json, jsonPadded };
+    iov[iovcnt++] = (struct iovec){ binHeader, sizeof(binHeader) };
+    for (int v = 0; v < viewCount; v++) iov[iovcnt++] = (struct iovec){ (void *)views[v].data, views[v].byteLength };
+    if (binPadded > binLength) iov[iovcnt++] = (struct iovec){ (void *)zeros, binPadded - binLength };
+
+    ExportFile out;
+    if (!export_open(&out, filename)) return false;
+    bool ok = export_writev(&out, iov, iovcnt);
+    if (!export_close(&out)) ok = false;
+    if (ok) printf("Mesh exported to %s (%d vertices, %d triangles)\n", filename, mesh.vertexCount, mesh.triangleCount);
+    return ok;
+}
@@ -0,0 +1,12 @@
+#ifndef MESH_EXPORT_H
+#define MESH_EXPORT_H
+
+#include <stdbool.h>
+#include "raylib.h"
+
+// Both exporters read the CPU-side arrays raylib keeps on the Mesh after UploadMesh().
+// Vertices are required; normals, texcoords, tangents and indices are written when present.
+bool export_mesh_ply(const char *filename, Mesh mesh);
+bool export_mesh_glb(const char *filename, Mesh mesh);
+
+#endif // MESH_EXPORT_H
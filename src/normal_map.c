@@ -0,0 +1,83 @@
+#include "normal_map.h"
+#include "torus.h"
+#include "heightmap_sampler.h"
+#include "profiler.h"
+#include "mem_track.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static unsigned char encode_unit(float n) {
+    return (unsigned char)(n * 127.5f + 127.5f + 0.5f);
+}
+
+// Heights are scaled like the mesh builders scale them, and sampled at the heightmap
+// position the builders would read for a vertex at (theta, phi), so the map agrees with
+// the mesh at its vertices and adds the detail in between.
+Image bake_normal_map(float **heightmap, bool flat, float min, float max, int width, int height, int channels) {
+    float R, r;
+    GetTorusDimensions(&R, &r);
+    float gradient = MESH_HEIGHT_RANGE / (max - min);
+
+    unsigned char *texels = MemAlloc(width * height * channels);
+    if (!texels) {
+        perror("MemAlloc failed");
+        exit(1);
+    }
+    float *cosPhi = mem_alloc(MEM_SCRATCH, width * sizeof(float));
+    float *sinPhi = mem_alloc(MEM_SCRATCH, width * sizeof(float));
+    mem_track(MEM_NORMAL_MAP, (size_t)width * height * channels);
+    for (int x = 0; x < width; x++) {
+        float phi = 2.0f * PI * (x + 0.5f) / width;
+        cosPhi[x] = cosf(phi);
+        sinPhi[x] = sinf(phi);
+    }
+    HeightmapSampler sampler = heightmap_sampler(heightmap, SCREEN_WIDTH, SCREEN_HEIGHT, SAMPLE_BICUBIC);
+
+    PROF_BEGIN(flat ? "bake terrain normal map" : "bake torus normal map");
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < height; y++) {
+        float theta = 2.0f * PI * (y + 0.5f) / height;
+        float cosTheta = cosf(theta), sinTheta = sinf(theta);
+        unsigned char *out = texels + (size_t)y * width * channels;
+        for (int x = 0; x < width; x++) {
+            // Heightmap pixel and its derivatives with respect to both angles
+            float u, v, du_dtheta, dv_dtheta, du_dphi, dv_dphi;
+            if (flat) {
+                u = R * theta;
+                v = r * 2.0f * PI * (x + 0.5f) / width;
+                du_dtheta = R;
+                dv_dtheta = 0.0f;
+                du_dphi = 0.0f;
+                dv_dphi = r;
+            } else {
+                float ring = R + r * cosPhi[x];
+                u = ring * sinTheta;
+                v = SCREEN_HEIGHT - ring * cosTheta;
+                du_dtheta = ring * cosTheta;
+                dv_dtheta = ring * sinTheta;
+                du_dphi = -r * sinPhi[x] * sinTheta;
+                dv_dphi = r * sinPhi[x] * cosTheta;
+            }
+            float grad[2];
+            float h = (heightmap_sample(&sampler, u, v, grad) - min) * gradient;
+            float dh_dtheta = (grad[0] * du_dtheta + grad[1] * dv_dtheta) * gradient;
+            float dh_dphi = (grad[0] * du_dphi + grad[1] * dv_dphi) * gradient;
+
+            // World length per radian of the displaced surface around the tube and the ring
+            float tube = flat ? r : r + h;
+            float ring = flat ? R : R + tube * cosPhi[x];
+            float n[3] = { -tube * dh_dtheta, -ring * dh_dphi, tube * ring };
+            float scale = 1.0f / sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            out[channels * x + 0] = encode_unit(n[0] * scale);
+            out[channels * x + 1] = encode_unit(n[1] * scale);
+            if (channels == 3) out[3 * x + 2] = encode_unit(n[2] * scale);
+        }
+    }
+    PROF_END();
+
+    mem_free(MEM_SCRATCH, cosPhi, width * sizeof(float));
+    mem_free(MEM_SCRATCH, sinPhi, width * sizeof(float));
+    return (Image){ texels, width, height, 1, channels == 3 ? PIXELFORMAT_UNCOMPRESSED_R8G8B8 : PIXELFORMAT_UNCOMPRESSED_GRAY_ALPHA };
+}
@@ -0,0 +1,22 @@
+#ifndef NORMAL_MAP_H
+#define NORMAL_MAP_H
+
+#include <stdbool.h>
+#include "raylib.h"
+
+// Tangent-space normal maps of the displaced torus and flat patch, baked from the full
+// heightmap so shading keeps the heightmap's detail whatever the mesh resolution.
+//
+// Texel (x, y) covers phi = 2 pi (x + 0.5) / width and theta = 2 pi (y + 0.5) / height,
+// the parameters lighting.fs recovers from the model-space position, and holds the
+// normal of the displaced surface in the undisplaced surface's frame (along theta, along
+// phi, outward) encoded as n * 0.5 + 0.5. Both directions wrap.
+//
+// The outward component is always positive, so with channels 2 only the other two are
+// stored, as a gray-alpha image, and the shader rebuilds the third.
+//
+// CPU only; returns an R8G8B8 (or gray-alpha) image for LoadTextureFromImage, counted
+// under MEM_NORMAL_MAP until uploaded. Safe to run off the main thread.
+Image bake_normal_map(float **heightmap, bool flat, float min, float max, int width, int height, int channels);
+
+#endif // NORMAL_MAP_H
@@ -0,0 +1,96 @@
+#include "occlusion.h"
+#include "torus.h"
+#include "heightmap_sampler.h"
+#include "profiler.h"
+#include "mem_track.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define OCCLUSION_FIRST_STEP 2.0f       // world units
+
+void bake_vertex_occlusion(float **heightmap, bool flat, float min, float max, int rings, int sides, unsigned char *colors) {
+    float R, r;
+    GetTorusDimensions(&R, &r);
+    float gradient = MESH_HEIGHT_RANGE / (max - min);
+    HeightmapSampler sampler = heightmap_sampler(heightmap, SCREEN_WIDTH, SCREEN_HEIGHT, SAMPLE_BILINEAR);
+
+    // Directions sit half a step off the axes, so each quarter gets the same number
+    float cosDir[OCCLUSION_DIRECTIONS], sinDir[OCCLUSION_DIRECTIONS];
+    for (int d = 0; d < OCCLUSION_DIRECTIONS; d++) {
+        float angle = 2.0f * PI * (d + 0.5f) / OCCLUSION_DIRECTIONS - PI / 4.0f;
+        cosDir[d] = cosf(angle);
+        sinDir[d] = sinf(angle);
+    }
+    float distances[OCCLUSION_STEPS];
+    float growth = powf(OCCLUSION_RADIUS / OCCLUSION_FIRST_STEP, 1.0f / (OCCLUSION_STEPS - 1));
+    distances[0] = OCCLUSION_FIRST_STEP;
+    for (int s = 1; s < OCCLUSION_STEPS; s++) distances[s] = distances[s - 1] * growth;
+
+    // Per side j, direction d and step s: the turn around the ring and the tube's new
+    // cos(phi) there, so the torus samples need no trigonometry per vertex
+    int samples = OCCLUSION_DIRECTIONS * OCCLUSION_STEPS;
+    float *steps = mem_alloc(MEM_SCRATCH, sides * samples * 3 * sizeof(float));
+    for (int j = 0; j < sides; j++) {
+        float phi = 2.0f * PI * j / sides;
+        float ring = R + r * cosf(phi);
+        for (int k = 0; k < samples; k++) {
+            int d = k / OCCLUSION_STEPS;
+            float dist = distances[k % OCCLUSION_STEPS];
+            float turn = dist * cosDir[d] / ring;
+            float *step = steps + 3 * (j * samples + k);
+            step[0] = cosf(turn);
+            step[1] = sinf(turn);
+            step[2] = cosf(phi + dist * sinDir[d] / r);
+        }
+    }
+
+    PROF_BEGIN(flat ? "terrain occlusion" : "torus occlusion");
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < rings; i++) {
+        float theta = 2.0f * PI * i / rings;
+        float cosTheta = cosf(theta), sinTheta = sinf(theta);
+        for (int j = 0; j < sides; j++) {
+            float phi = 2.0f * PI * j / sides;
+            float u, v;
+            surface_pixel(flat, theta, phi, &u, &v);
+            float h0 = (heightmap_sample(&sampler, u, v, NULL) - min) * gradient;
+
+            // How fast the surface bends away from its tangent plane along each angle
+            float cosPhi = cosf(phi);
+            float bendTheta = flat ? 0.0f : cosPhi / (R + r * cosPhi);
+            float bendPhi = flat ? 0.0f : 1.0f / r;
+            const float *step = steps + 3 * j * samples;
+
+            float openness[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+            for (int d = 0; d < OCCLUSION_DIRECTIONS; d++) {
+                float bend = 0.5f * (bendTheta * cosDir[d] * cosDir[d] + bendPhi * sinDir[d] * sinDir[d]);
+                float horizon = 0.0f;   // sin of the elevation; never below the tangent plane
+                for (int s = 0; s < OCCLUSION_STEPS; s++, step += 3) {
+                    float dist = distances[s];
+                    // The sampler wraps, so the pixel needs no reduction
+                    if (flat) {
+                        u = R * theta + dist * cosDir[d];
+                        v = r * phi + dist * sinDir[d];
+                    } else {
+                        float ring = R + r * step[2];
+                        u = ring * (sinTheta * step[0] + cosTheta * step[1]);
+                        v = SCREEN_HEIGHT - ring * (cosTheta * step[0] - sinTheta * step[1]);
+                    }
+                    float rise = (heightmap_sample(&sampler, u, v, NULL) - min) * gradient - h0 - bend * dist * dist;
+                    if (rise <= 0.0f) continue;
+                    float elevation = rise / sqrtf(rise * rise + dist * dist);
+                    if (elevation > horizon) horizon = elevation;
+                }
+                openness[d / (OCCLUSION_DIRECTIONS / 4)] += 1.0f - horizon;
+            }
+            unsigned char *out = colors + 4 * (i * sides + j);
+            for (int k = 0; k < 4; k++) {
+                out[k] = (unsigned char)(openness[k] * (255.0f * 4.0f / OCCLUSION_DIRECTIONS) + 0.5f);
+            }
+        }
+    }
+    PROF_END();
+    mem_free(MEM_SCRATCH, steps, sides * samples * 3 * sizeof(float));
+}
@@ -0,0 +1,24 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <stdbool.h>
+
+#define OCCLUSION_DIRECTIONS 16         // horizon directions per vertex, four per channel
+#define OCCLUSION_STEPS 12              // samples per direction, spaced geometrically
+#define OCCLUSION_RADIUS 256.0f         // world units searched for the horizon
+
+// Horizon-based ambient occlusion baked into vertex colours, so lighting.fs gets soft
+// occlusion and horizon shadows at no per-frame cost.
+//
+// Each vertex looks along OCCLUSION_DIRECTIONS tangent directions of the undisplaced
+// surface for the highest point of the periodic heightmap within OCCLUSION_RADIUS,
+// allowing for the torus curving away underneath. Channel k of its colour holds the mean
+// openness 1 - sin(horizon elevation) over the quarter of those directions centred on
+// +theta, +phi, -theta and -phi (k = 0..3). Their average is the occlusion; the channel
+// facing a light gives the horizon it has to clear.
+//
+// colors gets 4 bytes per vertex of the rings x sides grid the mesh builders use; heights
+// are scaled like theirs. CPU only, parallel over rings.
+void bake_vertex_occlusion(float **heightmap, bool flat, float min, float max, int rings, int sides, unsigned char *colors);
+
+#endif // OCCLUSION_H
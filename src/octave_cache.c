@@ -0,0 +1,142 @@
+#include "octave_cache.h"
+#include "profiler.h"
+#include "mem_track.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+OctaveCache *octave_cache_create(const float *u, const float *v, int count) {
+    OctaveCache *cache = mem_calloc(MEM_EDIT, sizeof(OctaveCache));
+    cache->count = count;
+    cache->u = mem_alloc(MEM_EDIT, count * sizeof(float));
+    cache->v = mem_alloc(MEM_EDIT, count * sizeof(float));
+    cache->warped = mem_alloc(MEM_EDIT, count * 4 * sizeof(float));
+    cache->warpJacobian = mem_alloc(MEM_EDIT, count * 8 * sizeof(float));
+    memcpy(cache->u, u, count * sizeof(float));
+    memcpy(cache->v, v, count * sizeof(float));
+    cache->warpScale = -1.0f;   // nothing valid yet
+    return cache;
+}
+
+static void compute_warp(OctaveCache *cache, float scale) {
+    PROF_BEGIN("octave cache warp");
+    cache->warpScale = -1.0f;
+    #pragma omp parallel for schedule(static)
+    for (int k = 0; k < cache->count; k++) {
+        terrain_warp_deriv(cache->u[k], cache->v[k], scale, 0.0f, cache->footprint, &cache->warped[k * 4], &cache->warpJacobian[k * 8]);
+    }
+    cache->warpScale = scale;
+    cache->layerCount = 0;
+    PROF_END();
+}
+
+// Layer o is the raw noise at frequency lacunarity^o, the same term fbm4d_fn sums, along
+// with its pixel-space gradient chained through the cached warp Jacobian.
+static void compute_layer(OctaveCache *cache, int octave, float lacunarity) {
+    PROF_BEGIN("octave cache layer");
+    if (!cache->layers[octave]) cache->layers[octave] = mem_alloc(MEM_EDIT, cache->count * sizeof(float));
+    if (!cache->layerGrads[octave]) cache->layerGrads[octave] = mem_alloc(MEM_EDIT, cache->count * 2 * sizeof(float));
+    float frequency = 1.0f;
+    for (int o = 0; o < octave; o++) frequency *= lacunarity;
+
+    NoiseFunction4DDeriv fn = terrain_noise_deriv_fn();
+    float *layer = cache->layers[octave];
+    float *layerGrad = cache->layerGrads[octave];
+    const float *w = cache->warped;
+    const float *jac = cache->warpJacobian;
+    #pragma omp parallel for schedule(static)
+    for (int k = 0; k < cache->count; k++) {
+        float grad[4];
+        layer[k] = fn(w[k * 4] * frequency, w[k * 4 + 1] * frequency, w[k * 4 + 2] * frequency, w[k * 4 + 3] * frequency, grad);
+        const float *j = &jac[k * 8];
+        layerGrad[k * 2] = frequency * (grad[0] * j[0] + grad[1] * j[1] + grad[2] * j[2] + grad[3] * j[3]);
+        layerGrad[k * 2 + 1] = frequency * (grad[0] * j[4] + grad[1] * j[5] + grad[2] * j[6] + grad[3] * j[7]);
+    }
+    PROF_END();
+}
+
+static bool aborted(const OctaveCache *cache) {
+    return cache->abort && __atomic_load_n(cache->abort, __ATOMIC_ACQUIRE);
+}
+
+int octave_cache_eval(OctaveCache *cache, const TerrainParams *params, float *out_heights, float *out_grads) {
+    PROF_BEGIN("octave_cache_eval");
+    int octaves = params->octaves;
+    if (octaves < 1) octaves = 1;
+    if (octaves > OCTAVE_CACHE_MAX_OCTAVES) octaves = OCTAVE_CACHE_MAX_OCTAVES;
+    // Only the octaves below the sample footprint's Nyquist limit are computed
+    float limit = fbm_octave_limit(cache->footprint * params->scale, params->lacunarity);
+    int used = octaves;
+    while (used > 1 && limit <= used - 1) used--;
+
+    init_terrain_noise();
+    if (aborted(cache)) {
+        PROF_END();
+        return -1;
+    }
+    if (cache->warpScale != params->scale) compute_warp(cache, params->scale);
+    if (cache->layerLacunarity != params->lacunarity) {
+        cache->layerCount = 0;
+        cache->layerLacunarity = params->lacunarity;
+    }
+    int computed = 0;
+    while (cache->layerCount < used) {
+        if (aborted(cache)) {
+            PROF_END();
+            return -1;
+        }
+        compute_layer(cache, cache->layerCount, params->lacunarity);
+        cache->layerCount++;
+        computed++;
+    }
+    if (aborted(cache)) {
+        PROF_END();
+        return -1;
+    }
+
+    // Same accumulation order as fbm4d_fn, so default params reproduce terrain_height exactly
+    float weights[OCTAVE_CACHE_MAX_OCTAVES];
+    float amplitude = 1.0f;
+    float maxValue = 0.0f;
+    for (int o = 0; o < octaves; o++) {
+        float fade = limit - o;
+        weights[o] = fade >= 1.0f ? amplitude : (fade > 0.0f ? amplitude * fade : 0.0f);
+        maxValue += amplitude;
+        amplitude *= params->gain;
+    }
+
+    #pragma omp parallel for schedule(static)
+    for (int k = 0; k < cache->count; k++) {
+        float total = 0.0f;
+        for (int o = 0; o < used; o++) total += cache->layers[o][k] * weights[o];
+        float noise = (total / maxValue + 1.0f) / 2.0f;
+        float height = powf(noise, params->contrast);
+        out_heights[k] = height < 0.0f ? 0.0f : (height > 1.0f ? 1.0f : height);
+        if (!out_grads) continue;
+
+        float du = 0.0f, dv = 0.0f;
+        for (int o = 0; o < used; o++) {
+            du += cache->layerGrads[o][k * 2] * weights[o];
+            dv += cache->layerGrads[o][k * 2 + 1] * weights[o];
+        }
+        float slope = noise > 0.0f ? params->contrast * powf(noise, params->contrast - 1.0f) / (2.0f * maxValue) : 0.0f;
+        out_grads[k * 2] = slope * du;
+        out_grads[k * 2 + 1] = slope * dv;
+    }
+    PROF_END();
+    return computed;
+}
+
+void octave_cache_destroy(OctaveCache *cache) {
+    if (!cache) return;
+    for (int o = 0; o < OCTAVE_CACHE_MAX_OCTAVES; o++) {
+        mem_free(MEM_EDIT, cache->layers[o], cache->count * sizeof(float));
+        mem_free(MEM_EDIT, cache->layerGrads[o], cache->count * 2 * sizeof(float));
+    }
+    mem_free(MEM_EDIT, cache->warped, cache->count * 4 * sizeof(float));
+    mem_free(MEM_EDIT, cache->warpJacobian, cache->count * 8 * sizeof(float));
+    mem_free(MEM_EDIT, cache->u, cache->count * sizeof(float));
+    mem_free(MEM_EDIT, cache->v, cache->count * sizeof(float));
+    mem_free(MEM_EDIT, cache, sizeof(OctaveCache));
+}
@@ -0,0 +1,37 @@
+#ifndef OCTAVE_CACHE_H
+#define OCTAVE_CACHE_H
+
+#include <stdbool.h>
+#include "torus.h"
+
+#define OCTAVE_CACHE_MAX_OCTAVES 12
+
+// Per-octave noise layers for a fixed set of heightmap sample points, so that
+// editing the terrain parameters only redoes the work they actually affect:
+//   gain, contrast, fewer octaves -> re-weight the cached layers
+//   more octaves                  -> compute only the new layers
+//   lacunarity                    -> recompute the layers, keep the warp
+//   scale                         -> recompute everything
+// Octaves above the Nyquist limit of footprint are neither computed nor summed.
+typedef struct OctaveCache {
+    int count;
+    float *u, *v;               // sample pixels
+    float *warped;              // 4 floats per sample, valid for warpScale
+    float *warpJacobian;        // 8 floats per sample: d(warped)/du, then d(warped)/dv
+    float *layers[OCTAVE_CACHE_MAX_OCTAVES];
+    float *layerGrads[OCTAVE_CACHE_MAX_OCTAVES];   // 2 floats per sample: d(layer)/du, d(layer)/dv
+    int layerCount;             // layers valid for layerLacunarity
+    float warpScale;
+    float layerLacunarity;
+    float footprint;            // sample spacing in pixels, 0 for every octave; set before the first eval
+    const int *abort;           // optional; a nonzero value stops eval between layers
+} OctaveCache;
+
+OctaveCache *octave_cache_create(const float *u, const float *v, int count);
+// Writes one height per sample, in [0, 1], and optionally dh/du, dh/dv per sample into out_grads.
+// Returns the number of noise layers it had to compute, or -1 if abort was raised; the cache
+// stays consistent either way.
+int octave_cache_eval(OctaveCache *cache, const TerrainParams *params, float *out_heights, float *out_grads);
+void octave_cache_destroy(OctaveCache *cache);
+
+#endif // OCTAVE_CACHE_H
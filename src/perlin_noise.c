@@ -9,6 +9,12 @@ static float fade(float t)
     return t * t * t * (t * (t * 6 - 15) + 10);
 }
 
+// d/dt of fade
+static float fade_deriv(float t)
+{
+    return 30.0f * t * t * (t - 1.0f) * (t - 1.0f);
+}
+
 static float lerp(float t, float a, float b)
 {
     return a + t * (b - a);
@@ -184,4 +190,68 @@ float perlin_noise4d(float x, float y, float z, float w)
 
     // Interpolate along w and return final result
     return lerp(s, z0, z1);  // Result in [-1, 1]
-}
\ No newline at end of file
+}
+// The gradient vector grad4D dots with: +-1 on the three axes it picks, 0 on the fourth.
+static void grad4D_vector(int hash, float out[4])
+{
+    int h = hash & 31;
+    out[0] = out[1] = out[2] = out[3] = 0.0f;
+    out[h < 24 ? 0 : 1] = (h & 1) ? -1.0f : 1.0f;
+    out[h < 16 ? 1 : 2] = (h & 2) ? -1.0f : 1.0f;
+    out[h < 8 ? 2 : 3] = (h & 4) ? -1.0f : 1.0f;
+}
+
+// perlin_noise4d plus its analytic gradient. The value is computed with the same
+// interpolation sequence, so it matches perlin_noise4d bit for bit.
+float perlin_noise4d_deriv(float x, float y, float z, float w, float grad[4])
+{
+    int xi = (int)floorf(x) & 255;
+    int yi = (int)floorf(y) & 255;
+    int zi = (int)floorf(z) & 255;
+    int wi = (int)floorf(w) & 255;
+
+    float f[4] = { x - floorf(x), y - floorf(y), z - floorf(z), w - floorf(w) };
+    float fw[4] = { fade(f[0]), fade(f[1]), fade(f[2]), fade(f[3]) };
+    float dfw[4] = { fade_deriv(f[0]), fade_deriv(f[1]), fade_deriv(f[2]), fade_deriv(f[3]) };
+
+    // Corner c has offset bit d set along axis d, in the order the lerps below consume them
+    float g[16];
+    grad[0] = grad[1] = grad[2] = grad[3] = 0.0f;
+    for (int c = 0; c < 16; c++) {
+        int b[4] = { c & 1, (c >> 1) & 1, (c >> 2) & 1, (c >> 3) & 1 };
+        int hash = perm[perm[perm[perm[xi + b[0]] + yi + b[1]] + zi + b[2]] + wi + b[3]];
+        g[c] = grad4D(hash, b[0] ? f[0] - 1 : f[0], b[1] ? f[1] - 1 : f[1], b[2] ? f[2] - 1 : f[2], b[3] ? f[3] - 1 : f[3]);
+
+        // d/dp (weight * g) = weight * gradient vector + d(weight)/dp * g
+        float vec[4];
+        grad4D_vector(hash, vec);
+        float weight = 1.0f;
+        for (int d = 0; d < 4; d++) weight *= b[d] ? fw[d] : 1.0f - fw[d];
+        for (int d = 0; d < 4; d++) {
+            float dweight = b[d] ? dfw[d] : -dfw[d];
+            for (int e = 0; e < 4; e++) {
+                if (e != d) dweight *= b[e] ? fw[e] : 1.0f - fw[e];
+            }
+            grad[d] += weight * vec[d] + dweight * g[c];
+        }
+    }
+
+    float x00 = lerp(fw[0], g[0], g[1]);
+    float x10 = lerp(fw[0], g[2], g[3]);
+    float x01 = lerp(fw[0], g[4], g[5]);
+    float x11 = lerp(fw[0], g[6], g[7]);
+    float x02 = lerp(fw[0], g[8], g[9]);
+    float x12 = lerp(fw[0], g[10], g[11]);
+    float x03 = lerp(fw[0], g[12], g[13]);
+    float x13 = lerp(fw[0], g[14], g[15]);
+
+    float y0 = lerp(fw[1], x00, x10);
+    float y1 = lerp(fw[1], x01, x11);
+    float y2 = lerp(fw[1], x02, x12);
+    float y3 = lerp(fw[1], x03, x13);
+
+    float z0 = lerp(fw[2], y0, y1);
+    float z1 = lerp(fw[2], y2, y3);
+
+    return lerp(fw[3], z0, z1);
+}
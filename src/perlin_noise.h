@@ -5,4 +5,5 @@ void perlin_init(int seed);
 float perlin_noise2d(float x, float y);
 float perlin_noise3d(float x, float y, float z);
 float perlin_noise4d(float x, float y, float z, float w);
+float perlin_noise4d_deriv(float x, float y, float z, float w, float grad[4]);
 #endif // PERLIN_NOISE_H
@@ -0,0 +1,389 @@
+#include "pick.h"
+#include "torus.h"
+#include "heightmap_sampler.h"
+#include "profiler.h"
+#include "mem_track.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+
+#define PICK_MAX_DEPTH 40       // ray halvings before a segment is refined regardless
+#define PICK_LEAF_STEPS 8       // samples along a leaf segment
+#define PICK_BISECTIONS 24
+
+TerrainPicker *picker_create(bool flat, int rings, int sides) {
+    TerrainPicker *picker = mem_calloc(MEM_PICKING, sizeof(TerrainPicker));
+    picker->flat = flat;
+    picker->rings = rings;
+    picker->sides = sides;
+    picker->heights = mem_alloc(MEM_PICKING, (size_t)rings * sides * sizeof(float));
+
+    int levelRings = rings, levelSides = sides;
+    while (picker->levelCount < PICK_MAX_LEVELS) {
+        int level = picker->levelCount++;
+        picker->levelRings[level] = levelRings;
+        picker->levelSides[level] = levelSides;
+        picker->minLevels[level] = mem_alloc(MEM_PICKING, (size_t)levelRings * levelSides * sizeof(float));
+        picker->maxLevels[level] = mem_alloc(MEM_PICKING, (size_t)levelRings * levelSides * sizeof(float));
+        if (levelRings == 1 && levelSides == 1) break;
+        levelRings = (levelRings + 1) / 2;
+        levelSides = (levelSides + 1) / 2;
+    }
+    return picker;
+}
+
+// Level 0 bounds each bilinear cell by its four corners; every level above takes up to
+// 2x2 children. Rows of a level are independent, so each level is split across threads.
+static void build_pyramid(TerrainPicker *picker) {
+    PROF_BEGIN("pick pyramid");
+    int rings = picker->rings, sides = picker->sides;
+    const float *h = picker->heights;
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < rings; i++) {
+        int i1 = (i + 1) % rings;
+        for (int j = 0; j < sides; j++) {
+            int j1 = (j + 1) % sides;
+            float a = h[i * sides + j], b = h[i * sides + j1], c = h[i1 * sides + j], d = h[i1 * sides + j1];
+            picker->minLevels[0][i * sides + j] = fminf(fminf(a, b), fminf(c, d));
+            picker->maxLevels[0][i * sides + j] = fmaxf(fmaxf(a, b), fmaxf(c, d));
+        }
+    }
+
+    for (int level = 1; level < picker->levelCount; level++) {
+        int childRings = picker->levelRings[level - 1], childSides = picker->levelSides[level - 1];
+        int levelRings = picker->levelRings[level], levelSides = picker->levelSides[level];
+        const float *childMin = picker->minLevels[level - 1], *childMax = picker->maxLevels[level - 1];
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < levelRings; i++) {
+            for (int j = 0; j < levelSides; j++) {
+                float lo = FLT_MAX, hi = -FLT_MAX;
+                for (int ci = 2 * i; ci < 2 * i + 2 && ci < childRings; ci++) {
+                    for (int cj = 2 * j; cj < 2 * j + 2 && cj < childSides; cj++) {
+                        lo = fminf(lo, childMin[ci * childSides + cj]);
+                        hi = fmaxf(hi, childMax[ci * childSides + cj]);
+                    }
+                }
+                picker->minLevels[level][i * levelSides + j] = lo;
+                picker->maxLevels[level][i * levelSides + j] = hi;
+            }
+        }
+    }
+    picker->version++;
+    PROF_END();
+}
+
+void picker_set_heights(TerrainPicker *picker, const float *heights) {
+    memcpy(picker->heights, heights, (size_t)picker->rings * picker->sides * sizeof(float));
+    build_pyramid(picker);
+}
+
+void picker_set_heights_from_mesh(TerrainPicker *picker, Mesh mesh) {
+    int count = picker->rings * picker->sides;
+    if (mesh.vertexCount != count) {
+        fprintf(stderr, "picker_set_heights_from_mesh: mesh has %d vertices, picker grid %d\n", mesh.vertexCount, count);
+        return;
+    }
+    Vector3 *base = mem_alloc(MEM_SCRATCH, count * sizeof(Vector3));
+    Vector3 *dir = mem_alloc(MEM_SCRATCH, count * sizeof(Vector3));
+    mesh_vertex_frames(picker->flat, picker->rings, picker->sides, base, dir);
+    const Vector3 *vertices = (const Vector3 *)mesh.vertices;
+    #pragma omp parallel for schedule(static)
+    for (int k = 0; k < count; k++) {
+        picker->heights[k] = Vector3DotProduct(Vector3Subtract(vertices[k], base[k]), dir[k]);
+    }
+    mem_free(MEM_SCRATCH, base, count * sizeof(Vector3));
+    mem_free(MEM_SCRATCH, dir, count * sizeof(Vector3));
+    build_pyramid(picker);
+}
+
+// Min and max height over base cells a..b x c..d (inclusive, in range), from the coarsest
+// level at which the rectangle spans at most 2x2 cells.
+static void query_rect(const TerrainPicker *picker, int a, int b, int c, int d, float *lo, float *hi) {
+    int level = 0;
+    while (level + 1 < picker->levelCount && ((b >> level) - (a >> level) > 1 || (d >> level) - (c >> level) > 1)) level++;
+    int levelSides = picker->levelSides[level];
+    for (int i = a >> level; i <= b >> level; i++) {
+        for (int j = c >> level; j <= d >> level; j++) {
+            *lo = fminf(*lo, picker->minLevels[level][i * levelSides + j]);
+            *hi = fmaxf(*hi, picker->maxLevels[level][i * levelSides + j]);
+        }
+    }
+}
+
+// Bounds over the periodic grid-space rectangle [gi0, gi1] x [gj0, gj1]; the ends may lie
+// outside one period, and a rectangle crossing the seam is split in two along that axis.
+static void query_bounds(const TerrainPicker *picker, float gi0, float gi1, float gj0, float gj1, float *lo, float *hi) {
+    int rings = picker->rings, sides = picker->sides;
+    int i0 = (int)floorf(gi0), i1 = (int)floorf(gi1);
+    int j0 = (int)floorf(gj0), j1 = (int)floorf(gj1);
+    if (i1 - i0 + 1 >= rings) { i0 = 0; i1 = rings - 1; }
+    else { i1 = WRAP_MOD(i0, rings) + (i1 - i0); i0 = WRAP_MOD(i0, rings); }
+    if (j1 - j0 + 1 >= sides) { j0 = 0; j1 = sides - 1; }
+    else { j1 = WRAP_MOD(j0, sides) + (j1 - j0); j0 = WRAP_MOD(j0, sides); }
+
+    int iSpans[2][2] = { { i0, i1 < rings ? i1 : rings - 1 }, { 0, i1 - rings } };
+    int jSpans[2][2] = { { j0, j1 < sides ? j1 : sides - 1 }, { 0, j1 - sides } };
+    *lo = FLT_MAX;
+    *hi = -FLT_MAX;
+    for (int si = 0; si < (i1 < rings ? 1 : 2); si++) {
+        for (int sj = 0; sj < (j1 < sides ? 1 : 2); sj++) {
+            query_rect(picker, iSpans[si][0], iSpans[si][1], jSpans[sj][0], jSpans[sj][1], lo, hi);
+        }
+    }
+}
+
+// Bilinear height at (theta, phi) and its derivatives with respect to both angles.
+static float grid_height(const TerrainPicker *picker, float theta, float phi, float *dh_dtheta, float *dh_dphi) {
+    int rings = picker->rings, sides = picker->sides;
+    float gi = theta * rings / (2.0f * PI);
+    float gj = phi * sides / (2.0f * PI);
+    float fi = floorf(gi), fj = floorf(gj);
+    float s = gi - fi, t = gj - fj;
+    int i0 = WRAP_MOD((int)fi, rings), i1 = (i0 + 1) % rings;
+    int j0 = WRAP_MOD((int)fj, sides), j1 = (j0 + 1) % sides;
+    const float *h = picker->heights;
+    float h00 = h[i0 * sides + j0], h01 = h[i0 * sides + j1];
+    float h10 = h[i1 * sides + j0], h11 = h[i1 * sides + j1];
+    float near = h00 + (h01 - h00) * t;
+    float far = h10 + (h11 - h10) * t;
+    if (dh_dtheta) *dh_dtheta = (far - near) * rings / (2.0f * PI);
+    if (dh_dphi) *dh_dphi = ((h01 - h00) * (1.0f - s) + (h11 - h10) * s) * sides / (2.0f * PI);
+    return near + (far - near) * s;
+}
+
+float picker_locate(const TerrainPicker *picker, Vector3 p, float *theta, float *phi) {
+    float R, r;
+    GetTorusDimensions(&R, &r);
+    if (picker->flat) {
+        *theta = p.z / R;
+        *phi = (SCREEN_HEIGHT - p.x) / r;
+        return p.y;
+    }
+    float q = sqrtf(p.x * p.x + p.z * p.z);
+    *theta = atan2f(p.z, p.x);
+    *phi = atan2f(p.y, q - R);
+    if (*theta < 0.0f) *theta += 2.0f * PI;
+    if (*phi < 0.0f) *phi += 2.0f * PI;
+    return sqrtf((q - R) * (q - R) + p.y * p.y) - r;
+}
+
+// Signed offset of p from the surface along the displacement direction: positive above,
+// negative below. Also returns the surface parameters under p.
+static float surface_offset(const TerrainPicker *picker, Vector3 p, float *theta, float *phi) {
+    float offset = picker_locate(picker, p, theta, phi);
+    return offset - grid_height(picker, *theta, *phi, NULL, NULL);
+}
+
+static float interval_abs_min(float lo, float hi) { return lo > 0.0f ? lo : (hi < 0.0f ? -hi : 0.0f); }
+static float interval_abs_max(float lo, float hi) { return fmaxf(fabsf(lo), fabsf(hi)); }
+
+// Angle range covering every point of the box [x0, x1] x [y0, y1] around the origin, as
+// atan2(y, x); false if the box contains the origin (every angle).
+static bool angle_range(float x0, float x1, float y0, float y1, float *a0, float *a1) {
+    if (x0 <= 0.0f && x1 >= 0.0f && y0 <= 0.0f && y1 >= 0.0f) return false;
+    float ref = atan2f(0.5f * (y0 + y1), 0.5f * (x0 + x1));
+    float corners[4][2] = { { x0, y0 }, { x1, y0 }, { x0, y1 }, { x1, y1 } };
+    *a0 = FLT_MAX;
+    *a1 = -FLT_MAX;
+    for (int c = 0; c < 4; c++) {
+        float d = atan2f(corners[c][1], corners[c][0]) - ref;
+        if (d > PI) d -= 2.0f * PI;
+        if (d < -PI) d += 2.0f * PI;
+        *a0 = fminf(*a0, d);
+        *a1 = fmaxf(*a1, d);
+    }
+    *a0 += ref;
+    *a1 += ref;
+    return true;
+}
+
+// Can the surface cross the ray between p0 and p1? Compares the range of the ray's
+// offset coordinate (height or tube radius) over the segment's bounding box with the
+// pyramid's height bounds over the angles the box covers. Sets leaf once the box is
+// within about one grid cell, where it pays to sample instead of subdividing.
+static bool segment_may_cross(const TerrainPicker *picker, Vector3 p0, Vector3 p1, bool *leaf) {
+    float R, r;
+    GetTorusDimensions(&R, &r);
+    Vector3 lo = Vector3Min(p0, p1), hi = Vector3Max(p0, p1);
+    float scaleI = picker->rings / (2.0f * PI), scaleJ = picker->sides / (2.0f * PI);
+    float gi0, gi1, gj0, gj1, offset0, offset1;
+    if (picker->flat) {
+        gi0 = lo.z / R * scaleI;
+        gi1 = hi.z / R * scaleI;
+        gj0 = (SCREEN_HEIGHT - hi.x) / r * scaleJ;
+        gj1 = (SCREEN_HEIGHT - lo.x) / r * scaleJ;
+        offset0 = lo.y;
+        offset1 = hi.y;
+    } else {
+        float cx = fminf(fmaxf(0.0f, lo.x), hi.x), cz = fminf(fmaxf(0.0f, lo.z), hi.z);
+        float q0 = sqrtf(cx * cx + cz * cz);
+        float q1 = sqrtf(fmaxf(lo.x * lo.x, hi.x * hi.x) + fmaxf(lo.z * lo.z, hi.z * hi.z));
+        float t0, t1, f0, f1;
+        if (angle_range(lo.x, hi.x, lo.z, hi.z, &t0, &t1)) { gi0 = t0 * scaleI; gi1 = t1 * scaleI; }
+        else { gi0 = 0.0f; gi1 = picker->rings; }
+        if (angle_range(q0 - R, q1 - R, lo.y, hi.y, &f0, &f1)) { gj0 = f0 * scaleJ; gj1 = f1 * scaleJ; }
+        else { gj0 = 0.0f; gj1 = picker->sides; }
+        float dq0 = interval_abs_min(q0 - R, q1 - R), dy0 = interval_abs_min(lo.y, hi.y);
+        float dq1 = interval_abs_max(q0 - R, q1 - R), dy1 = interval_abs_max(lo.y, hi.y);
+        offset0 = sqrtf(dq0 * dq0 + dy0 * dy0) - r;
+        offset1 = sqrtf(dq1 * dq1 + dy1 * dy1) - r;
+    }
+    float hmin, hmax;
+    query_bounds(picker, gi0, gi1, gj0, gj1, &hmin, &hmax);
+    *leaf = floorf(gi1) - floorf(gi0) <= 1.0f && floorf(gj1) - floorf(gj0) <= 1.0f;
+    return offset0 <= hmax && offset1 >= hmin;
+}
+
+// Ray parameter range inside the box, clipped to t >= 0; false if the ray misses it.
+static bool clip_to_box(Ray ray, Vector3 lo, Vector3 hi, float *t0, float *t1) {
+    float o[3] = { ray.position.x, ray.position.y, ray.position.z };
+    float d[3] = { ray.direction.x, ray.direction.y, ray.direction.z };
+    float l[3] = { lo.x, lo.y, lo.z }, h[3] = { hi.x, hi.y, hi.z };
+    *t0 = 0.0f;
+    *t1 = FLT_MAX;
+    for (int a = 0; a < 3; a++) {
+        if (fabsf(d[a]) < 1e-12f) {
+            if (o[a] < l[a] || o[a] > h[a]) return false;
+            continue;
+        }
+        float ta = (l[a] - o[a]) / d[a], tb = (h[a] - o[a]) / d[a];
+        if (ta > tb) { float tmp = ta; ta = tb; tb = tmp; }
+        *t0 = fmaxf(*t0, ta);
+        *t1 = fminf(*t1, tb);
+    }
+    return *t0 <= *t1;
+}
+
+SurfaceFrame picker_surface(const TerrainPicker *picker, float theta, float phi, float h, float dh_dtheta, float dh_dphi) {
+    float R, r;
+    GetTorusDimensions(&R, &r);
+    SurfaceFrame frame;
+    if (picker->flat) {
+        frame.position = (Vector3){ SCREEN_HEIGHT - r * phi, h, R * theta };
+        frame.up = (Vector3){ 0.0f, 1.0f, 0.0f };
+        frame.alongTheta = (Vector3){ 0.0f, 0.0f, 1.0f };
+        frame.alongPhi = (Vector3){ -1.0f, 0.0f, 0.0f };
+        frame.metricTheta = R;
+        frame.metricPhi = r;
+        frame.normal = Vector3Normalize((Vector3){ R * dh_dphi, r * R, -r * dh_dtheta });
+        return frame;
+    }
+    float cosTheta = cosf(theta), sinTheta = sinf(theta);
+    float cosPhi = cosf(phi), sinPhi = sinf(phi);
+    float tube = r + h;
+    float ring = R + tube * cosPhi;
+    frame.up = (Vector3){ cosPhi * cosTheta, sinPhi, cosPhi * sinTheta };
+    frame.position = (Vector3){ ring * cosTheta, tube * sinPhi, ring * sinTheta };
+    frame.alongTheta = (Vector3){ -sinTheta, 0.0f, cosTheta };
+    frame.alongPhi = (Vector3){ -sinPhi * cosTheta, cosPhi, -sinPhi * sinTheta };
+    frame.metricTheta = ring;
+    frame.metricPhi = tube;
+    Vector3 dtheta = Vector3Add(Vector3Scale(frame.alongTheta, ring), Vector3Scale(frame.up, dh_dtheta));
+    Vector3 dphi = Vector3Add(Vector3Scale(frame.alongPhi, tube), Vector3Scale(frame.up, dh_dphi));
+    frame.normal = Vector3Normalize(Vector3CrossProduct(dphi, dtheta));
+    return frame;
+}
+
+static void fill_hit(const TerrainPicker *picker, Ray ray, float t, PickHit *hit) {
+    hit->hit = true;
+    hit->distance = t;
+    hit->position = Vector3Add(ray.position, Vector3Scale(ray.direction, t));
+    surface_offset(picker, hit->position, &hit->theta, &hit->phi);
+    float dh_dtheta, dh_dphi;
+    hit->height = grid_height(picker, hit->theta, hit->phi, &dh_dtheta, &dh_dphi);
+    hit->normal = picker_surface(picker, hit->theta, hit->phi, hit->height, dh_dtheta, dh_dphi).normal;
+}
+
+// Samples a leaf segment for the first crossing from above to below the surface and
+// bisects it down; false if the segment stays on one side at every sample.
+static bool refine_leaf(const TerrainPicker *picker, Ray ray, float t0, float t1, float *tHit) {
+    float theta, phi;
+    float prevT = t0;
+    float prev = surface_offset(picker, Vector3Add(ray.position, Vector3Scale(ray.direction, t0)), &theta, &phi);
+    for (int s = 1; s <= PICK_LEAF_STEPS; s++) {
+        float t = t0 + (t1 - t0) * s / PICK_LEAF_STEPS;
+        float f = surface_offset(picker, Vector3Add(ray.position, Vector3Scale(ray.direction, t)), &theta, &phi);
+        if (prev > 0.0f && f <= 0.0f) {
+            float a = prevT, b = t;
+            for (int k = 0; k < PICK_BISECTIONS; k++) {
+                float m = 0.5f * (a + b);
+                if (surface_offset(picker, Vector3Add(ray.position, Vector3Scale(ray.direction, m)), &theta, &phi) > 0.0f) a = m;
+                else b = m;
+            }
+            *tHit = 0.5f * (a + b);
+            return true;
+        }
+        prev = f;
+        prevT = t;
+    }
+    return false;
+}
+
+typedef struct PickSegment {
+    float t0, t1;
+    int depth;
+} PickSegment;
+
+PickHit picker_cast(TerrainPicker *picker, Ray ray) {
+    PickHit hit = { 0 };
+    picker->nodesVisited = 0;
+    float R, r;
+    GetTorusDimensions(&R, &r);
+    int top = picker->levelCount - 1;
+    float hmin = picker->minLevels[top][0], hmax = picker->maxLevels[top][0];
+    // Near the torus axes a short segment still sweeps many cells in angle, so segments
+    // shorter than about a cell in world units are sampled as they are
+    float leafLength = 0.5f * fminf(2.0f * PI * r / picker->sides, 2.0f * PI * R / picker->rings);
+    float directionLength = Vector3Length(ray.direction);
+
+    Vector3 lo, hi;
+    if (picker->flat) {
+        // The patch covers grid points 0..rings-1 and 0..sides-1; it does not wrap
+        lo = (Vector3){ SCREEN_HEIGHT - r * 2.0f * PI * (picker->sides - 1) / picker->sides, hmin, 0.0f };
+        hi = (Vector3){ SCREEN_HEIGHT, hmax, R * 2.0f * PI * (picker->rings - 1) / picker->rings };
+    } else {
+        float reach = R + r + hmax;
+        lo = (Vector3){ -reach, -(r + hmax), -reach };
+        hi = (Vector3){ reach, r + hmax, reach };
+    }
+    float tEnter, tExit;
+    if (!clip_to_box(ray, lo, hi, &tEnter, &tExit)) return hit;
+
+    // Depth-first, nearer half first, so the first crossing found is the closest one
+    PickSegment stack[2 * PICK_MAX_DEPTH + 2];
+    int count = 0;
+    stack[count++] = (PickSegment){ tEnter, tExit, 0 };
+    while (count > 0) {
+        PickSegment seg = stack[--count];
+        picker->nodesVisited++;
+        Vector3 p0 = Vector3Add(ray.position, Vector3Scale(ray.direction, seg.t0));
+        Vector3 p1 = Vector3Add(ray.position, Vector3Scale(ray.direction, seg.t1));
+        bool leaf;
+        if (!segment_may_cross(picker, p0, p1, &leaf)) continue;
+        if (leaf || (seg.t1 - seg.t0) * directionLength <= leafLength || seg.depth >= PICK_MAX_DEPTH) {
+            float t;
+            if (refine_leaf(picker, ray, seg.t0, seg.t1, &t)) {
+                fill_hit(picker, ray, t, &hit);
+                return hit;
+            }
+            continue;
+        }
+        float mid = 0.5f * (seg.t0 + seg.t1);
+        stack[count++] = (PickSegment){ mid, seg.t1, seg.depth + 1 };
+        stack[count++] = (PickSegment){ seg.t0, mid, seg.depth + 1 };
+    }
+    return hit;
+}
+
+void picker_destroy(TerrainPicker *picker) {
+    if (!picker) return;
+    for (int level = 0; level < picker->levelCount; level++) {
+        size_t size = (size_t)picker->levelRings[level] * picker->levelSides[level] * sizeof(float);
+        mem_free(MEM_PICKING, picker->minLevels[level], size);
+        mem_free(MEM_PICKING, picker->maxLevels[level], size);
+    }
+    mem_free(MEM_PICKING, picker->heights, (size_t)picker->rings * picker->sides * sizeof(float));
+    mem_free(MEM_PICKING, picker, sizeof(TerrainPicker));
+}
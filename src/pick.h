@@ -0,0 +1,60 @@
+#ifndef PICK_H
+#define PICK_H
+
+#include <stdbool.h>
+#include "raylib.h"
+
+#define PICK_MAX_LEVELS 32
+
+// Ray picking against the displaced torus or the flat terrain patch, without the GPU.
+//
+// The surface is a periodic grid of heights over (theta, phi), the same grid a mesh of
+// rings x sides vertices is built on, interpolated bilinearly and pushed along the
+// undisplaced surface normal. A min/max pyramid over the grid bounds every patch, so a
+// cast only refines the stretches of the ray that can reach the surface.
+typedef struct TerrainPicker {
+    bool flat;
+    int rings, sides;
+    float *heights;                     // rings * sides, world units along the displacement direction
+    int levelCount;
+    int levelRings[PICK_MAX_LEVELS], levelSides[PICK_MAX_LEVELS];
+    float *minLevels[PICK_MAX_LEVELS];  // level 0 cell (i, j) bounds grid points i..i+1, j..j+1
+    float *maxLevels[PICK_MAX_LEVELS];
+
+    unsigned version;                   // bumped whenever the heights change
+
+    // Last cast, for the overlay
+    int nodesVisited;
+} TerrainPicker;
+
+typedef struct PickHit {
+    bool hit;
+    float distance;             // along the ray, in units of its direction
+    float theta, phi;           // surface parameters, in [0, 2 pi)
+    float height;               // displacement at the hit
+    Vector3 position;
+    Vector3 normal;
+} PickHit;
+
+// The surface at (theta, phi) for a height h and its derivatives with respect to both angles.
+typedef struct SurfaceFrame {
+    Vector3 position, normal;
+    Vector3 up;                     // undisplaced displacement direction
+    Vector3 alongTheta, alongPhi;   // unit tangents of the undisplaced surface
+    float metricTheta, metricPhi;   // world length per radian along each, at height h
+} SurfaceFrame;
+
+TerrainPicker *picker_create(bool flat, int rings, int sides);
+// Each of these replaces the heights and rebuilds the pyramid.
+void picker_set_heights(TerrainPicker *picker, const float *heights);
+// Recovers the heights from a mesh built on the same grid, so picks follow whatever is drawn.
+void picker_set_heights_from_mesh(TerrainPicker *picker, Mesh mesh);
+// ray is in model space. Not thread-safe per picker (it records nodesVisited).
+PickHit picker_cast(TerrainPicker *picker, Ray ray);
+// Surface parameters under model-space point p; returns p's offset along the displacement
+// direction from the undisplaced surface (height 0).
+float picker_locate(const TerrainPicker *picker, Vector3 p, float *theta, float *phi);
+SurfaceFrame picker_surface(const TerrainPicker *picker, float theta, float phi, float h, float dh_dtheta, float dh_dphi);
+void picker_destroy(TerrainPicker *picker);
+
+#endif // PICK_H
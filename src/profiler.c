@@ -0,0 +1,209 @@
+#include "profiler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "raylib.h"
+
+#define PROF_MAX_THREADS 256
+#define PROF_RING_SIZE (1 << 16)    // events kept per thread; older ones are overwritten
+#define PROF_CHUNK_SIZE (1 << 10)   // ring storage is allocated this many events at a time
+#define PROF_CHUNK_COUNT (PROF_RING_SIZE / PROF_CHUNK_SIZE)
+#define PROF_MAX_DEPTH 64
+#define PROF_FRAME_HISTORY 600
+
+typedef enum { PROF_EVENT_SCOPE, PROF_EVENT_COUNTER } ProfEventType;
+
+typedef struct ProfEvent {
+    const char *name;
+    uint64_t start;
+    uint64_t end;        // unused for counters
+    int64_t value;       // counter value
+    int type;
+} ProfEvent;
+
+// One ring per thread. Only the owning thread writes it, and it publishes
+// new events by a release store of head, so recording never takes a lock.
+// The ring is allocated a chunk at a time as it first fills, so the many
+// OpenMP threads that record a handful of events only cost one small chunk.
+typedef struct ProfThread {
+    int tid;
+    uint64_t head;
+    const char *stackNames[PROF_MAX_DEPTH];
+    uint64_t stackStart[PROF_MAX_DEPTH];
+    ProfEvent *chunks[PROF_CHUNK_COUNT];
+} ProfThread;
+
+bool prof_enabled = false;
+__thread int prof_depth = 0;
+
+static ProfThread *threads[PROF_MAX_THREADS];
+static int threadCount = 0;
+static __thread ProfThread *localThread = NULL;
+static __thread bool localUnslotted = false;    // every slot was taken when this thread first recorded
+static uint64_t epoch = 0;
+
+static float frameTimes[PROF_FRAME_HISTORY];
+static int frameCount = 0;
+static uint64_t lastFrame = 0;
+
+uint64_t prof_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void prof_set_enabled(bool enabled) {
+    __atomic_store_n(&prof_enabled, enabled, __ATOMIC_RELAXED);
+}
+
+static ProfThread *get_thread(void) {
+    if (localThread) return localThread;
+    if (localUnslotted) return NULL;
+
+    int slot = __atomic_fetch_add(&threadCount, 1, __ATOMIC_ACQ_REL);
+    if (slot >= PROF_MAX_THREADS) {
+        localUnslotted = true;
+        return NULL;
+    }
+    ProfThread *thread = calloc(1, sizeof(ProfThread));
+    if (!thread) {
+        perror("calloc failed");
+        localUnslotted = true;
+        return NULL;
+    }
+    thread->tid = slot;
+    __atomic_store_n(&threads[slot], thread, __ATOMIC_RELEASE);
+    localThread = thread;
+    return thread;
+}
+
+void prof_init(void) {
+    epoch = prof_now_ns();
+    lastFrame = epoch;
+    const char *env = getenv("TERRAIN_PROFILE");
+    prof_set_enabled(env && env[0] != '\0' && env[0] != '0');
+    get_thread();  // the calling (main) thread becomes tid 0
+    printf("Profiler %s (set TERRAIN_PROFILE=1 or press P to toggle)\n", prof_is_enabled() ? "enabled" : "disabled");
+}
+
+static ProfEvent *ring_event(const ProfThread *thread, uint64_t index) {
+    uint64_t slot = index & (PROF_RING_SIZE - 1);
+    return &thread->chunks[slot / PROF_CHUNK_SIZE][slot % PROF_CHUNK_SIZE];
+}
+
+static void push_event(ProfThread *thread, ProfEvent event) {
+    uint64_t head = thread->head;
+    ProfEvent **chunk = &thread->chunks[(head & (PROF_RING_SIZE - 1)) / PROF_CHUNK_SIZE];
+    if (!*chunk) {
+        // Published before head moves into it, so a reader below head never sees it missing
+        ProfEvent *events = malloc(PROF_CHUNK_SIZE * sizeof(ProfEvent));
+        if (!events) return;
+        __atomic_store_n(chunk, events, __ATOMIC_RELEASE);
+    }
+    *ring_event(thread, head) = event;
+    __atomic_store_n(&thread->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void prof_begin(const char *name) {
+    ProfThread *thread = get_thread();
+    if (!thread) return;
+    if (prof_depth < PROF_MAX_DEPTH) {
+        thread->stackNames[prof_depth] = name;
+        thread->stackStart[prof_depth] = prof_now_ns();
+    }
+    prof_depth++;
+}
+
+void prof_end(void) {
+    ProfThread *thread = get_thread();
+    if (!thread || prof_depth == 0) return;
+    prof_depth--;
+    if (prof_depth >= PROF_MAX_DEPTH) return;
+    push_event(thread, (ProfEvent){ thread->stackNames[prof_depth], thread->stackStart[prof_depth], prof_now_ns(), 0, PROF_EVENT_SCOPE });
+}
+
+void prof_counter(const char *name, int64_t value) {
+    ProfThread *thread = get_thread();
+    if (!thread) return;
+    push_event(thread, (ProfEvent){ name, prof_now_ns(), 0, value, PROF_EVENT_COUNTER });
+}
+
+void prof_frame_mark(void) {
+    uint64_t now = prof_now_ns();
+    frameTimes[frameCount % PROF_FRAME_HISTORY] = (float)(now - lastFrame) / 1.0e6f;
+    frameCount++;
+    if (prof_is_enabled()) {
+        ProfThread *thread = get_thread();
+        if (thread) push_event(thread, (ProfEvent){ "frame", lastFrame, now, 0, PROF_EVENT_SCOPE });
+    }
+    lastFrame = now;
+}
+
+static int compare_floats(const void *a, const void *b) {
+    float fa = *(const float *)a;
+    float fb = *(const float *)b;
+    return (fa > fb) - (fa < fb);
+}
+
+// p in [0, 100] over the last PROF_FRAME_HISTORY frames, in milliseconds.
+float prof_frame_percentile(float p) {
+    int count = frameCount < PROF_FRAME_HISTORY ? frameCount : PROF_FRAME_HISTORY;
+    if (count == 0) return 0.0f;
+    float sorted[PROF_FRAME_HISTORY];
+    memcpy(sorted, frameTimes, count * sizeof(float));
+    qsort(sorted, count, sizeof(float), compare_floats);
+    int index = (int)(p / 100.0f * (count - 1) + 0.5f);
+    return sorted[index];
+}
+
+void prof_draw_overlay(int x, int y) {
+    DrawText(TextFormat("Frame p50: %0.2f ms  p95: %0.2f ms  p99: %0.2f ms",
+             prof_frame_percentile(50.0f), prof_frame_percentile(95.0f), prof_frame_percentile(99.0f)), x, y, 20, DARKGRAY);
+    DrawText(TextFormat("Profiler: %s (P toggle, T write trace)", prof_is_enabled() ? "recording" : "off"), x, y + 22, 20, DARKGRAY);
+}
+
+bool prof_write_chrome_trace(const char *filename) {
+    FILE *f = fopen(filename, "w");
+    if (!f) {
+        perror("Cannot open trace file for writing");
+        return false;
+    }
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    int count = __atomic_load_n(&threadCount, __ATOMIC_ACQUIRE);
+    if (count > PROF_MAX_THREADS) count = PROF_MAX_THREADS;
+    size_t written = 0;
+    for (int t = 0; t < count; t++) {
+        ProfThread *thread = __atomic_load_n(&threads[t], __ATOMIC_ACQUIRE);
+        if (!thread) continue;
+
+        fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+                first ? "" : ",\n", thread->tid, thread->tid == 0 ? "main" : "thread", thread->tid);
+        first = false;
+
+        // Best-effort snapshot: a thread that is still recording may overwrite its oldest events meanwhile
+        uint64_t head = __atomic_load_n(&thread->head, __ATOMIC_ACQUIRE);
+        uint64_t tail = head > PROF_RING_SIZE ? head - PROF_RING_SIZE : 0;
+        for (uint64_t i = tail; i < head; i++) {
+            const ProfEvent *e = ring_event(thread, i);
+            double ts = (double)(e->start - epoch) / 1000.0;
+            if (e->type == PROF_EVENT_SCOPE) {
+                fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                        e->name, thread->tid, ts, (double)(e->end - e->start) / 1000.0);
+            } else {
+                fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"value\":%lld}}",
+                        e->name, thread->tid, ts, (long long)e->value);
+            }
+            written++;
+        }
+    }
+    fprintf(f, "\n]}\n");
+
+    bool ok = fclose(f) == 0;
+    if (ok) printf("Trace with %zu events written to %s\n", written, filename);
+    return ok;
+}
@@ -0,0 +1,48 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Scope and counter names must be string literals: only the pointer is recorded.
+// Build with -DPROFILER_DISABLED to compile every probe out; otherwise a disabled
+// profiler costs one predictable branch per probe.
+//
+// The enabled flag is read by every thread that records, so it is only accessed
+// atomically. PROF_END closes whatever scope this thread opened, so toggling the
+// profiler inside an open scope leaves the stack balanced.
+
+extern bool prof_enabled;
+extern __thread int prof_depth;     // scopes open on this thread
+
+static inline bool prof_is_enabled(void) {
+    return __atomic_load_n(&prof_enabled, __ATOMIC_RELAXED);
+}
+
+void prof_init(void);
+void prof_set_enabled(bool enabled);
+uint64_t prof_now_ns(void);
+
+void prof_begin(const char *name);
+void prof_end(void);
+void prof_counter(const char *name, int64_t value);
+
+// Call once per frame. Frame times are always kept for the percentile overlay.
+void prof_frame_mark(void);
+float prof_frame_percentile(float p);
+void prof_draw_overlay(int x, int y);
+
+// Writes every buffered event as Chrome about:tracing / Perfetto JSON.
+bool prof_write_chrome_trace(const char *filename);
+
+#ifdef PROFILER_DISABLED
+    #define PROF_BEGIN(name) ((void)0)
+    #define PROF_END() ((void)0)
+    #define PROF_COUNTER(name, value) ((void)0)
+#else
+    #define PROF_BEGIN(name) do { if (prof_is_enabled()) prof_begin(name); } while (0)
+    #define PROF_END() do { if (prof_depth > 0) prof_end(); } while (0)
+    #define PROF_COUNTER(name, value) do { if (prof_is_enabled()) prof_counter(name, value); } while (0)
+#endif
+
+#endif // PROFILER_H
@@ -0,0 +1,284 @@
+#include "regen.h"
+#include "octave_cache.h"
+#include "profiler.h"
+#include "mem_track.h"
+#include "mesh_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define REGEN_RESULTS 3     // one being written, one ready, one being uploaded
+
+enum { RESULT_FREE, RESULT_WRITING, RESULT_READY, RESULT_UPLOADING };
+
+typedef struct RegenResult {
+    int state;              // guarded by the worker lock
+    float *vertices[2];     // [0] torus, [1] flat terrain
+    float *normals[2];
+} RegenResult;
+
+struct RegenWorker {
+    int rings, sides, vertexCount;
+    pthread_t thread;
+
+    // Guarded by lock
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    TerrainParams params;
+    unsigned requested;     // generation of the latest request
+    unsigned computed;      // generation of the latest finished result
+    bool quit;
+    RegenResult results[REGEN_RESULTS];
+    double lastComputeMs;
+
+    int cancel;             // raised by a newer request; polled by the octave caches
+    int ready;              // a result is READY, so the render thread can skip the lock
+
+    // Worker thread only
+    OctaveCache *caches[2];
+    float *heights;
+    float *grads;           // dh/du, dh/dv per vertex
+
+    // Render thread only
+    Mesh back[2];
+    bool backMapped[2];     // a back mesh is a swapped-out startup mesh mapped from its blob
+    bool backCreated;
+    RegenResult *uploading;
+    int uploadItem;         // 0..3: torus vertices, torus normals, terrain vertices, terrain normals
+    int uploadOffset;       // bytes
+};
+
+static OctaveCache *create_cache(RegenWorker *regen, bool flat) {
+    size_t size = regen->vertexCount * sizeof(float);
+    float *u = mem_alloc(MEM_SCRATCH, size);
+    float *v = mem_alloc(MEM_SCRATCH, size);
+    mesh_sample_pixels(flat, regen->rings, regen->sides, u, v);
+    OctaveCache *cache = octave_cache_create(u, v, regen->vertexCount);
+    cache->abort = &regen->cancel;
+    cache->footprint = mesh_sample_footprint(flat, regen->rings, regen->sides);
+    mem_free(MEM_SCRATCH, u, size);
+    mem_free(MEM_SCRATCH, v, size);
+    return cache;
+}
+
+// Fills the result for both meshes; false if a newer request cancelled it part way.
+static bool compute_result(RegenWorker *regen, RegenResult *result, const TerrainParams *params) {
+    for (int m = 0; m < 2; m++) {
+        if (!regen->caches[m]) regen->caches[m] = create_cache(regen, m == 1);
+        if (octave_cache_eval(regen->caches[m], params, regen->heights, regen->grads) < 0) return false;
+        mesh_vertices_from_heights(result->vertices[m], result->normals[m], m == 1, regen->heights, regen->grads, regen->rings, regen->sides);
+        if (__atomic_load_n(&regen->cancel, __ATOMIC_ACQUIRE)) return false;
+    }
+    return true;
+}
+
+static void *worker_main(void *arg) {
+    RegenWorker *regen = arg;
+    while (true) {
+        pthread_mutex_lock(&regen->lock);
+        while (!regen->quit && regen->requested == regen->computed) {
+            pthread_cond_wait(&regen->wake, &regen->lock);
+        }
+        if (regen->quit) {
+            pthread_mutex_unlock(&regen->lock);
+            break;
+        }
+        TerrainParams params = regen->params;
+        unsigned generation = regen->requested;
+        __atomic_store_n(&regen->cancel, 0, __ATOMIC_RELEASE);
+        RegenResult *result = NULL;
+        for (int i = 0; i < REGEN_RESULTS && !result; i++) {
+            if (regen->results[i].state == RESULT_FREE) result = &regen->results[i];
+        }
+        result->state = RESULT_WRITING;
+        pthread_mutex_unlock(&regen->lock);
+
+        PROF_BEGIN("regen");
+        uint64_t start = prof_now_ns();
+        bool complete = compute_result(regen, result, &params);
+        double ms = (double)(prof_now_ns() - start) / 1.0e6;
+        PROF_END();
+
+        pthread_mutex_lock(&regen->lock);
+        if (complete && generation == regen->requested) {
+            // Supersede a result the render thread has not picked up yet
+            for (int i = 0; i < REGEN_RESULTS; i++) {
+                if (regen->results[i].state == RESULT_READY) regen->results[i].state = RESULT_FREE;
+            }
+            result->state = RESULT_READY;
+            regen->computed = generation;
+            regen->lastComputeMs = ms;
+            __atomic_store_n(&regen->ready, 1, __ATOMIC_RELEASE);
+        } else {
+            result->state = RESULT_FREE;   // stale; the loop picks up the newer request
+        }
+        pthread_mutex_unlock(&regen->lock);
+    }
+    return NULL;
+}
+
+RegenWorker *regen_create(int rings, int sides) {
+    RegenWorker *regen = mem_calloc(MEM_EDIT, sizeof(RegenWorker));
+    regen->rings = rings;
+    regen->sides = sides;
+    regen->vertexCount = rings * sides;
+    regen->heights = mem_alloc(MEM_EDIT, regen->vertexCount * sizeof(float));
+    regen->grads = mem_alloc(MEM_EDIT, regen->vertexCount * 2 * sizeof(float));
+    for (int i = 0; i < REGEN_RESULTS; i++) {
+        for (int m = 0; m < 2; m++) {
+            regen->results[i].vertices[m] = mem_alloc(MEM_EDIT, regen->vertexCount * 3 * sizeof(float));
+            regen->results[i].normals[m] = mem_alloc(MEM_EDIT, regen->vertexCount * 3 * sizeof(float));
+        }
+    }
+    pthread_mutex_init(&regen->lock, NULL);
+    pthread_cond_init(&regen->wake, NULL);
+    if (pthread_create(&regen->thread, NULL, worker_main, regen) != 0) {
+        perror("pthread_create failed");
+        exit(1);
+    }
+    return regen;
+}
+
+void regen_request(RegenWorker *regen, const TerrainParams *params) {
+    pthread_mutex_lock(&regen->lock);
+    regen->params = *params;
+    regen->requested++;
+    __atomic_store_n(&regen->cancel, 1, __ATOMIC_RELEASE);
+    pthread_cond_signal(&regen->wake);
+    pthread_mutex_unlock(&regen->lock);
+}
+
+// A second GPU copy of a model's mesh to upload into while the original is drawn.
+static Mesh copy_mesh(Mesh src) {
+    Mesh mesh = { 0 };
+    mesh.vertexCount = src.vertexCount;
+    mesh.triangleCount = src.triangleCount;
+    mesh.vertices = MemAlloc(src.vertexCount * 3 * sizeof(float));
+    mesh.normals = MemAlloc(src.vertexCount * 3 * sizeof(float));
+    memcpy(mesh.vertices, src.vertices, src.vertexCount * 3 * sizeof(float));
+    memcpy(mesh.normals, src.normals, src.vertexCount * 3 * sizeof(float));
+    if (src.texcoords) {
+        mesh.texcoords = MemAlloc(src.vertexCount * 2 * sizeof(float));
+        memcpy(mesh.texcoords, src.texcoords, src.vertexCount * 2 * sizeof(float));
+    }
+    if (src.tangents) {
+        mesh.tangents = MemAlloc(src.vertexCount * 4 * sizeof(float));
+        memcpy(mesh.tangents, src.tangents, src.vertexCount * 4 * sizeof(float));
+    }
+    if (src.indices) {
+        mesh.indices = MemAlloc(src.triangleCount * 3 * sizeof(unsigned short));
+        memcpy(mesh.indices, src.indices, src.triangleCount * 3 * sizeof(unsigned short));
+    }
+    UploadMesh(&mesh, true);  // dynamic: rewritten on every regeneration
+    return mesh;
+}
+
+// Takes the newest ready result, dropping any upload of an older one.
+static void take_ready_result(RegenWorker *regen) {
+    if (!__atomic_load_n(&regen->ready, __ATOMIC_ACQUIRE)) return;
+    pthread_mutex_lock(&regen->lock);
+    for (int i = 0; i < REGEN_RESULTS; i++) {
+        if (regen->results[i].state != RESULT_READY) continue;
+        if (regen->uploading) regen->uploading->state = RESULT_FREE;
+        regen->uploading = &regen->results[i];
+        regen->uploading->state = RESULT_UPLOADING;
+        regen->uploadItem = 0;
+        regen->uploadOffset = 0;
+    }
+    __atomic_store_n(&regen->ready, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&regen->lock);
+}
+
+bool regen_update(RegenWorker *regen, Model *torus, Model *terrain, bool mapped[2], int byteBudget) {
+    take_ready_result(regen);
+    if (!regen->uploading) return false;
+
+    if (!regen->backCreated) {
+        regen->back[0] = copy_mesh(torus->meshes[0]);
+        regen->back[1] = copy_mesh(terrain->meshes[0]);
+        regen->backCreated = true;
+    }
+
+    PROF_BEGIN("regen upload");
+    int arraySize = regen->vertexCount * 3 * sizeof(float);
+    while (regen->uploadItem < 4 && byteBudget > 0) {
+        Mesh *mesh = &regen->back[regen->uploadItem / 2];
+        bool normals = regen->uploadItem % 2 == 1;
+        const char *src = (const char *)(normals ? regen->uploading->normals : regen->uploading->vertices)[regen->uploadItem / 2];
+        char *dst = (char *)(normals ? mesh->normals : mesh->vertices);
+
+        int chunk = arraySize - regen->uploadOffset;
+        if (chunk > byteBudget) chunk = byteBudget;
+        memcpy(dst + regen->uploadOffset, src + regen->uploadOffset, chunk);
+        UpdateMeshBuffer(*mesh, normals ? 2 : 0, dst + regen->uploadOffset, chunk, regen->uploadOffset);
+        regen->uploadOffset += chunk;
+        byteBudget -= chunk;
+        if (regen->uploadOffset == arraySize) {
+            regen->uploadItem++;
+            regen->uploadOffset = 0;
+        }
+    }
+    PROF_END();
+    if (regen->uploadItem < 4) return false;
+
+    // Both back meshes are complete: swap them in together
+    Model *models[2] = { torus, terrain };
+    for (int m = 0; m < 2; m++) {
+        Mesh front = models[m]->meshes[0];
+        models[m]->meshes[0] = regen->back[m];
+        regen->back[m] = front;
+        bool frontMapped = mapped[m];
+        mapped[m] = regen->backMapped[m];
+        regen->backMapped[m] = frontMapped;
+    }
+
+    pthread_mutex_lock(&regen->lock);
+    regen->uploading->state = RESULT_FREE;
+    pthread_mutex_unlock(&regen->lock);
+    regen->uploading = NULL;
+    return true;
+}
+
+bool regen_busy(RegenWorker *regen) {
+    pthread_mutex_lock(&regen->lock);
+    bool busy = regen->requested != regen->computed || regen->uploading != NULL ||
+                __atomic_load_n(&regen->ready, __ATOMIC_ACQUIRE);
+    pthread_mutex_unlock(&regen->lock);
+    return busy;
+}
+
+double regen_last_compute_ms(RegenWorker *regen) {
+    pthread_mutex_lock(&regen->lock);
+    double ms = regen->lastComputeMs;
+    pthread_mutex_unlock(&regen->lock);
+    return ms;
+}
+
+void regen_destroy(RegenWorker *regen) {
+    if (!regen) return;
+    pthread_mutex_lock(&regen->lock);
+    regen->quit = true;
+    __atomic_store_n(&regen->cancel, 1, __ATOMIC_RELEASE);
+    pthread_cond_signal(&regen->wake);
+    pthread_mutex_unlock(&regen->lock);
+    pthread_join(regen->thread, NULL);
+
+    for (int m = 0; m < 2; m++) octave_cache_destroy(regen->caches[m]);
+    for (int m = 0; regen->backCreated && m < 2; m++) {
+        if (regen->backMapped[m]) unload_mesh_blob(regen->back[m]);
+        else UnloadMesh(regen->back[m]);
+    }
+    for (int i = 0; i < REGEN_RESULTS; i++) {
+        for (int m = 0; m < 2; m++) {
+            mem_free(MEM_EDIT, regen->results[i].vertices[m], regen->vertexCount * 3 * sizeof(float));
+            mem_free(MEM_EDIT, regen->results[i].normals[m], regen->vertexCount * 3 * sizeof(float));
+        }
+    }
+    mem_free(MEM_EDIT, regen->heights, regen->vertexCount * sizeof(float));
+    mem_free(MEM_EDIT, regen->grads, regen->vertexCount * 2 * sizeof(float));
+    pthread_mutex_destroy(&regen->lock);
+    pthread_cond_destroy(&regen->wake);
+    mem_free(MEM_EDIT, regen, sizeof(RegenWorker));
+}
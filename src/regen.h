@@ -0,0 +1,27 @@
+#ifndef REGEN_H
+#define REGEN_H
+
+#include <stdbool.h>
+#include "raylib.h"
+#include "torus.h"
+
+typedef struct RegenWorker RegenWorker;
+
+// Background terrain regeneration for the torus and flat terrain models.
+//
+// A worker thread evaluates new heights into CPU result buffers. The render thread
+// copies a finished result into a second (back) GPU mesh per model a slice at a time,
+// and swaps back and front once both meshes are complete, so drawing never sees a
+// half-updated terrain. A newer request cancels the computation and any upload of
+// stale results.
+RegenWorker *regen_create(int rings, int sides);
+void regen_request(RegenWorker *regen, const TerrainParams *params);
+// Render thread, once per frame. Uploads at most byteBudget bytes and returns true on the frame the models swap.
+// mapped[0] and [1] say whether the torus and terrain meshes are mapped from the blob cache; they swap with the meshes.
+bool regen_update(RegenWorker *regen, Model *torus, Model *terrain, bool mapped[2], int byteBudget);
+bool regen_busy(RegenWorker *regen);
+double regen_last_compute_ms(RegenWorker *regen);
+// Also unloads the back meshes, so the GL context must still be current.
+void regen_destroy(RegenWorker *regen);
+
+#endif // REGEN_H
@@ -0,0 +1,135 @@
+#include "render_layer.h"
+#include "raymath.h"
+#include "rlgl.h"
+#include "mem_track.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+RenderLayer *render_layer_create(Shader shader) {
+    RenderLayer *layer = mem_calloc(MEM_RENDER, sizeof(RenderLayer));
+    layer->shader = shader;
+
+    layer->gizmoShader = LoadShader("src/gizmo.vs", "src/gizmo.fs");
+    layer->gizmoShader.locs[SHADER_LOC_MATRIX_MVP] = GetShaderLocation(layer->gizmoShader, "mvp");
+    layer->gizmoShader.locs[SHADER_LOC_VERTEX_INSTANCE_TX] = GetShaderLocationAttrib(layer->gizmoShader, "instanceTransform");
+    layer->gizmoMaterial = LoadMaterialDefault();
+    layer->gizmoMaterial.shader = layer->gizmoShader;
+    layer->gizmoMesh = GenMeshSphere(1.0f, 8, 8);
+    layer->solidGizmos = mem_alloc(MEM_RENDER, RENDER_MAX_GIZMOS * sizeof(Matrix));
+    layer->wireGizmos = mem_alloc(MEM_RENDER, RENDER_MAX_GIZMOS * sizeof(Matrix));
+    return layer;
+}
+
+void render_layer_destroy(RenderLayer *layer) {
+    if (!layer) return;
+    UnloadMesh(layer->gizmoMesh);
+    UnloadMaterial(layer->gizmoMaterial);     // and the gizmo shader
+    mem_free(MEM_RENDER, layer->solidGizmos, RENDER_MAX_GIZMOS * sizeof(Matrix));
+    mem_free(MEM_RENDER, layer->wireGizmos, RENDER_MAX_GIZMOS * sizeof(Matrix));
+    mem_free(MEM_RENDER, layer, sizeof(RenderLayer));
+}
+
+static void count_model(RenderLayer *layer, const Model *model) {
+    layer->frame.drawCalls += model->meshCount;
+    for (int i = 0; i < model->meshCount; i++) layer->frame.triangles += model->meshes[i].triangleCount;
+}
+
+static int uniform_size(int uniformType) {
+    switch (uniformType) {
+        case SHADER_UNIFORM_VEC2: case SHADER_UNIFORM_IVEC2: return 8;
+        case SHADER_UNIFORM_VEC3: case SHADER_UNIFORM_IVEC3: return 12;
+        case SHADER_UNIFORM_VEC4: case SHADER_UNIFORM_IVEC4: return 16;
+        default: return 4;
+    }
+}
+
+// True when loc already holds the size bytes at value; otherwise remembers them.
+static bool cached(RenderLayer *layer, int loc, const void *value, int size) {
+    if (loc >= RENDER_MAX_UNIFORMS) return false;
+    if (layer->known[loc] && memcmp(layer->values[loc], value, size) == 0) {
+        layer->frame.uniformsSkipped++;
+        return true;
+    }
+    memcpy(layer->values[loc], value, size);
+    layer->known[loc] = true;
+    return false;
+}
+
+void render_set_value(RenderLayer *layer, int loc, const void *value, int uniformType) {
+    if (loc < 0 || cached(layer, loc, value, uniform_size(uniformType))) return;
+    SetShaderValue(layer->shader, loc, value, uniformType);
+    layer->frame.uniformUploads++;
+}
+
+void render_set_matrix(RenderLayer *layer, int loc, Matrix value) {
+    if (loc < 0 || cached(layer, loc, &value, sizeof(Matrix))) return;
+    SetShaderValueMatrix(layer->shader, loc, value);
+    layer->frame.uniformUploads++;
+}
+
+void render_set_light(RenderLayer *layer, const Light *light) {
+    int enabled = light->enabled;   // the shader reads an int; Light keeps a bool
+    render_set_value(layer, light->enabledLoc, &enabled, SHADER_UNIFORM_INT);
+    render_set_value(layer, light->typeLoc, &light->type, SHADER_UNIFORM_INT);
+    render_set_value(layer, light->positionLoc, &light->position, SHADER_UNIFORM_VEC3);
+    render_set_value(layer, light->targetLoc, &light->target, SHADER_UNIFORM_VEC3);
+    float color[4] = { light->color.r / 255.0f, light->color.g / 255.0f, light->color.b / 255.0f, light->color.a / 255.0f };
+    render_set_value(layer, light->colorLoc, color, SHADER_UNIFORM_VEC4);
+}
+
+RenderObject render_object(Model *model, Matrix transform) {
+    model->transform = transform;
+    return (RenderObject){ model, transform };
+}
+
+void render_draw(RenderLayer *layer, const RenderObject *object) {
+    DrawModel(*object->model, Vector3Zero(), 1.0f, WHITE);
+    count_model(layer, object->model);
+}
+
+void render_draw_wires(RenderLayer *layer, const RenderObject *object, Color color) {
+    DrawModelWires(*object->model, Vector3Zero(), 1.0f, color);
+    count_model(layer, object->model);
+}
+
+void render_draw_mesh(RenderLayer *layer, Mesh mesh, Material material, Matrix transform) {
+    DrawMesh(mesh, material, transform);
+    layer->frame.drawCalls++;
+    layer->frame.triangles += mesh.triangleCount;
+}
+
+void render_gizmo(RenderLayer *layer, Vector3 position, float radius, Color color, bool wire) {
+    Matrix *list = wire ? layer->wireGizmos : layer->solidGizmos;
+    int *count = wire ? &layer->wireCount : &layer->solidCount;
+    if (*count >= RENDER_MAX_GIZMOS) return;
+    Matrix m = MatrixMultiply(MatrixScale(radius, radius, radius), MatrixTranslate(position.x, position.y, position.z));
+    m.m3 = color.r / 255.0f;
+    m.m7 = color.g / 255.0f;
+    m.m11 = color.b / 255.0f;
+    m.m15 = color.a / 255.0f;
+    list[(*count)++] = m;
+}
+
+void render_draw_gizmos(RenderLayer *layer) {
+    if (layer->solidCount > 0) {
+        DrawMeshInstanced(layer->gizmoMesh, layer->gizmoMaterial, layer->solidGizmos, layer->solidCount);
+        layer->frame.drawCalls++;
+        layer->frame.triangles += layer->gizmoMesh.triangleCount * layer->solidCount;
+    }
+    if (layer->wireCount > 0) {
+        rlEnableWireMode();
+        DrawMeshInstanced(layer->gizmoMesh, layer->gizmoMaterial, layer->wireGizmos, layer->wireCount);
+        rlDisableWireMode();
+        layer->frame.drawCalls++;
+        layer->frame.triangles += layer->gizmoMesh.triangleCount * layer->wireCount;
+    }
+    layer->solidCount = 0;
+    layer->wireCount = 0;
+}
+
+void render_frame_end(RenderLayer *layer) {
+    layer->last = layer->frame;
+    layer->frame = (RenderStats){ 0 };
+}
@@ -0,0 +1,71 @@
+#ifndef RENDER_LAYER_H
+#define RENDER_LAYER_H
+
+#include <stdbool.h>
+#include "raylib.h"
+#include "rlights.h"
+
+#define RENDER_MAX_UNIFORMS 256     // locations past this are sent every time
+#define RENDER_MAX_GIZMOS 2048
+
+// What the layer sent in one frame. Uploads raylib makes inside DrawModel (matrices,
+// colDiffuse) are not counted.
+typedef struct RenderStats {
+    int uniformUploads;
+    int uniformsSkipped;        // set to the value the shader already had
+    int drawCalls;
+    int triangles;
+} RenderStats;
+
+// A model placed once: its transform lives in model->transform, which DrawModel turns
+// into the mvp, matModel and matNormal uniforms itself, so nothing is rebuilt per frame.
+typedef struct RenderObject {
+    Model *model;
+    Matrix transform;
+} RenderObject;
+
+// Retained state between frames for the lighting shader and the debug gizmos.
+//
+// Uniforms set through the layer are remembered per location and only sent when their
+// value changes, so constant lights and switches cost nothing per frame. Gizmos (light
+// markers, the pick marker) are queued as spheres and drawn as two instanced draws of one
+// retained sphere mesh, solid and wireframe, instead of generating sphere geometry per
+// call. The gizmo colour rides in the unused bottom row of each instance transform; see
+// gizmo.vs.
+typedef struct RenderLayer {
+    Shader shader;
+    unsigned char values[RENDER_MAX_UNIFORMS][64];
+    bool known[RENDER_MAX_UNIFORMS];
+    RenderStats frame;          // being counted
+    RenderStats last;           // the previous frame, for overlays
+
+    Shader gizmoShader;
+    Material gizmoMaterial;
+    Mesh gizmoMesh;             // unit sphere
+    Matrix *solidGizmos, *wireGizmos;
+    int solidCount, wireCount;
+} RenderLayer;
+
+// Needs the GL context; the lighting shader stays owned by the caller.
+RenderLayer *render_layer_create(Shader shader);
+void render_layer_destroy(RenderLayer *layer);
+
+// Sends value (a SHADER_UNIFORM_* type) unless the location already holds it.
+void render_set_value(RenderLayer *layer, int loc, const void *value, int uniformType);
+void render_set_matrix(RenderLayer *layer, int loc, Matrix value);
+// UpdateLightValues through the cache: only changed fields are sent.
+void render_set_light(RenderLayer *layer, const Light *light);
+
+RenderObject render_object(Model *model, Matrix transform);
+void render_draw(RenderLayer *layer, const RenderObject *object);
+void render_draw_wires(RenderLayer *layer, const RenderObject *object, Color color);
+// A bare mesh at transform, for geometry that has no Model (streamed tiles).
+void render_draw_mesh(RenderLayer *layer, Mesh mesh, Material material, Matrix transform);
+
+// Queues a sphere gizmo for render_draw_gizmos(), inside BeginMode3D.
+void render_gizmo(RenderLayer *layer, Vector3 position, float radius, Color color, bool wire);
+void render_draw_gizmos(RenderLayer *layer);
+// Starts counting a new frame.
+void render_frame_end(RenderLayer *layer);
+
+#endif // RENDER_LAYER_H
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "save.h"
+#include "mem_track.h"
 
 char *build_fullpath(const char *folder1, const char *folder2, const char *filename) {
     const size_t length = strlen(folder1) + 1 + strlen(folder2) + 1 + strlen(filename) + 1; // 2 slashes + null terminator
@@ -26,6 +27,16 @@ bool file_exists(const char *filename) {
     return false;      // File does not exist
 }
 
+// Creates resources/<folder2>, ignoring the error if it already exists.
+void make_resource_folder(const char *folder2) {
+    const char *folder1 = S_RESOURCES;
+    mkdir(folder1, 0755);
+    const size_t folder2_length = strlen(folder1) + 1 + strlen(folder2) + 1; // 1 for PATH_SEP + 1 for null terminator
+    char folder2_path[folder2_length];
+    snprintf(folder2_path, folder2_length, "%s%c%s", folder1, PATH_SEP, folder2);
+    mkdir(folder2_path, 0755);
+}
+
 bool heightmap_exists(const char *filename) {
     const char *folder1 = S_RESOURCES;
     const char *folder2 = S_HEIGHTMAPS;
@@ -68,11 +79,7 @@ void save_heightmap(const char *filename, float **heightmap, int rows, int cols)
     printf("Full path: %s\n", full_path);
     
     if (!file_exists(full_path)) {
-        mkdir(folder1, 0755);
-        const size_t folder2_length = strlen(folder1) + 1 + strlen(folder2) + 1; // 1 for PATH_SEP + 1 for null terminator
-        char folder2_path[folder2_length];
-        snprintf(folder2_path, folder2_length, "%s%c%s", folder1, PATH_SEP, folder2);
-        mkdir(folder2_path, 0755);
+        make_resource_folder(folder2);
     }
 
     save_matrix(full_path, heightmap, rows, cols);
@@ -102,33 +109,17 @@ float **load_matrix(const char *filename, int *out_rows, int *out_cols) {
         return NULL;
     }
 
-    float **matrix = malloc(rows * sizeof(float *));
-    if (!matrix) {
-        perror("Failed to allocate row pointers");
-        fclose(f);
-        return NULL;
-    }
-
+    // Matrices are heightmaps, freed by free_heightmap()
+    float **matrix = mem_alloc(MEM_HEIGHTMAP, rows * sizeof(float *));
     for (int i = 0; i < rows; i++) {
-        matrix[i] = malloc(cols * sizeof(float));
-        if (!matrix[i]) {
-            perror("Failed to allocate row data");
-            // Free already allocated rows
-            for (int j = 0; j < i; j++) {
-                free(matrix[j]);
-            }
-            free(matrix);
-            fclose(f);
-            return NULL;
-        }
-
+        matrix[i] = mem_alloc(MEM_HEIGHTMAP, cols * sizeof(float));
         if (fread(matrix[i], sizeof(float), cols, f) != (size_t)cols) {
             perror("Failed to read row data");
             // Clean up
             for (int j = 0; j <= i; j++) {
-                free(matrix[j]);
+                mem_free(MEM_HEIGHTMAP, matrix[j], cols * sizeof(float));
             }
-            free(matrix);
+            mem_free(MEM_HEIGHTMAP, matrix, rows * sizeof(float *));
             fclose(f);
             return NULL;
         }
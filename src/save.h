@@ -13,6 +13,7 @@
 
 #define S_RESOURCES "resources"
 #define S_HEIGHTMAPS "heightmaps"
+#define S_MESHES "meshes"
 
 #include <stdbool.h>
 
@@ -20,5 +21,6 @@ bool heightmap_exists(const char *filename);
 void save_heightmap(const char *filename, float **heightmap, int rows, int cols);
 float **load_matrix(const char *filename, int *out_rows, int *out_cols);
 char *build_fullpath(const char *folder1, const char *folder2, const char *filename);
+void make_resource_folder(const char *folder2);
 
 #endif // SAVE_H
\ No newline at end of file
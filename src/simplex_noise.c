@@ -239,3 +239,47 @@ float simplex4d(float x, float y, float z, float w) {
 
     return 27.0f * (n0 + n1 + n2 + n3 + n4);
 }
+
+// One simplex corner: t^4 (g . p) with t = 0.6 - |p|^2, accumulating its gradient
+// t^4 g - 8 t^3 (g . p) p.
+static inline float corner4_deriv(const int *g, const float p[4], float grad[4]) {
+    float t = 0.6f - p[0]*p[0] - p[1]*p[1] - p[2]*p[2] - p[3]*p[3];
+    if (t < 0) return 0.0f;
+    float d = dot4(g, p[0], p[1], p[2], p[3]);
+    float t2 = t * t;
+    float t4 = t2 * t2;
+    for (int a = 0; a < 4; a++) grad[a] += t4 * g[a] - 8.0f * t2 * t * d * p[a];
+    return t4 * d;
+}
+
+// simplex4d plus its analytic gradient; the value agrees with simplex4d to rounding.
+float simplex4d_deriv(float x, float y, float z, float w, float grad[4]) {
+    float s = (x + y + z + w) * F4;
+    int i = (int)floorf(x + s);
+    int j = (int)floorf(y + s);
+    int k = (int)floorf(z + s);
+    int l = (int)floorf(w + s);
+
+    float t = (i + j + k + l) * G4;
+    float x0 = x - (i - t), y0 = y - (j - t), z0 = z - (k - t), w0 = w - (l - t);
+
+    int rankx = (x0 > y0) + (x0 > z0) + (x0 > w0);
+    int ranky = (y0 > x0) + (y0 > z0) + (y0 > w0);
+    int rankz = (z0 > x0) + (z0 > y0) + (z0 > w0);
+    int rankw = (w0 > x0) + (w0 > y0) + (w0 > z0);
+
+    // Corner c of the simplex is offset by 1 on every axis ranked at least 4 - c
+    float n = 0.0f;
+    grad[0] = grad[1] = grad[2] = grad[3] = 0.0f;
+    for (int c = 0; c < 5; c++) {
+        int oi = c == 0 ? 0 : rankx >= 4 - c;
+        int oj = c == 0 ? 0 : ranky >= 4 - c;
+        int ok = c == 0 ? 0 : rankz >= 4 - c;
+        int ol = c == 0 ? 0 : rankw >= 4 - c;
+        float p[4] = { x0 - oi + c * G4, y0 - oj + c * G4, z0 - ok + c * G4, w0 - ol + c * G4 };
+        int gi = perm[(i+oi + perm[(j+oj + perm[(k+ok + perm[(l+ol) & 255]) & 255]) & 255]) & 255] & 31;
+        n += corner4_deriv(grad4[gi], p, grad);
+    }
+    for (int a = 0; a < 4; a++) grad[a] *= 27.0f;
+    return 27.0f * n;
+}
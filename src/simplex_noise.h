@@ -5,5 +5,6 @@
 
 float simplex3d(float x, float y, float z);
 float simplex4d(float x, float y, float z, float w);
+float simplex4d_deriv(float x, float y, float z, float w, float grad[4]);
 
 #endif // SIMPLEX_NOISE_H
\ No newline at end of file
@@ -0,0 +1,286 @@
+#include "startup.h"
+#include "torus.h"
+#include "mesh_cache.h"
+#include "profiler.h"
+#include "erosion.h"
+#include "normal_map.h"
+#include "occlusion.h"
+#include "mem_track.h"
+
+#include <stdio.h>
+#include <omp.h>
+
+#define HEIGHTMAP_FILE "heightmap.bin"
+#define HEIGHTMAP_FILE_COARSE_WARP "heightmap_warp%d.bin"   // interpolated warps are cached apart
+#define HEIGHTMAP_FILE_ERODED "heightmap_w%d_e%d_s%u_t%d_%g.bin"    // warp factor, droplets, seed, thermal steps, talus
+
+// The eroded heightmap is cached under its own name, next to the generated one it came from.
+static float **load_heightmap(StartupMeshes *startup) {
+    ErosionParams erosion = GetHeightmapErosion();
+    if (erosion_enabled(&erosion)) return get_eroded_heightmap(startup->heightmapFile, startup->sourceFile, &erosion);
+    return get_heightmap(startup->heightmapFile);
+}
+
+static void task_heightmap(void *arg) {
+    StartupMeshes *startup = arg;
+    startup->heightmap = load_heightmap(startup);
+}
+
+static void task_range(void *arg) {
+    StartupMeshes *startup = arg;
+    get_heightmap_range(startup->heightmap, &startup->min, &startup->max);
+}
+
+static void task_pgm_torus(void *arg) {
+    StartupMeshes *startup = arg;
+    write_heightmap_pgm("heightmap_T.pgm", startup->heightmap);
+}
+
+static void task_pgm_flat(void *arg) {
+    StartupMeshes *startup = arg;
+    write_heightmap_pgm("heightmap.pgm", startup->heightmap);
+}
+
+static void task_store(void *arg) {
+    StartupMeshes *startup = arg;
+    store_heightmap(startup->heightmapFile, startup->heightmap);
+    if (!startup->keyKnown) startup->keyKnown = heightmap_key(startup->heightmapFile, &startup->heightmapKey);
+    // Only saved blobs need the content hash
+    if (!startup->torus.cached || !startup->terrain.cached) {
+        startup->contentKnown = hash_heightmap(startup->heightmapFile, &startup->contentHash);
+    }
+}
+
+static void task_free_heightmap(void *arg) {
+    StartupMeshes *startup = arg;
+    free_heightmap(startup->heightmap);
+    startup->heightmap = NULL;
+}
+
+static void build_job(StartupMeshJob *job) {
+    StartupMeshes *startup = job->startup;
+    if (job->flat) job->mesh = build_flat_torus_mesh(startup->heightmap, startup->min, startup->max, startup->rings, startup->sides);
+    else job->mesh = build_torus_mesh(startup->heightmap, startup->min, startup->max, startup->rings, startup->sides);
+}
+
+static void task_build(void *arg) {
+    build_job(arg);
+}
+
+// Vertex colours carry the baked occlusion, so it is cached and uploaded with the mesh
+static void bake_occlusion(StartupMeshJob *job, float **heightmap, float min, float max) {
+    StartupMeshes *startup = job->startup;
+    job->mesh.colors = MemAlloc(job->mesh.vertexCount * 4);
+    bake_vertex_occlusion(heightmap, job->flat, min, max, startup->rings, startup->sides, job->mesh.colors);
+}
+
+static void task_occlusion(void *arg) {
+    StartupMeshJob *job = arg;
+    bake_occlusion(job, job->startup->heightmap, job->startup->min, job->startup->max);
+}
+
+static void task_tangents(void *arg) {
+    StartupMeshJob *job = arg;
+    GenMeshTangents(&job->mesh);  // CPU only while the mesh has no VBOs
+}
+
+static void task_save_blob(void *arg) {
+    StartupMeshJob *job = arg;
+    StartupMeshes *startup = job->startup;
+    if (startup->keyKnown && startup->contentKnown) {
+        save_mesh_blob(job->mesh, job->name, startup->heightmapKey, startup->contentHash, startup->rings, startup->sides);
+    }
+}
+
+// Builds a job's mesh inline, for when its blob turns out to be unusable after the graph
+// was laid out without build tasks for it.
+static void rebuild_job(StartupMeshJob *job, float **heightmap) {
+    StartupMeshes *startup = job->startup;
+    float min, max;
+    get_heightmap_range(heightmap, &min, &max);
+    if (job->flat) job->mesh = build_flat_torus_mesh(heightmap, min, max, startup->rings, startup->sides);
+    else job->mesh = build_torus_mesh(heightmap, min, max, startup->rings, startup->sides);
+    bake_occlusion(job, heightmap, min, max);
+    GenMeshTangents(&job->mesh);
+}
+
+static void task_map_blob(void *arg) {
+    StartupMeshJob *job = arg;
+    StartupMeshes *startup = job->startup;
+    job->mapped = map_mesh_blob(&job->mesh, job->name, startup->heightmapKey, startup->rings, startup->sides, &job->blobContentHash);
+    if (job->mapped) return;
+
+    // The blob was unreadable
+    float **heightmap = load_heightmap(startup);
+    rebuild_job(job, heightmap);
+    free_heightmap(heightmap);
+}
+
+// One texel per heightmap pixel: phi across the texture, theta down it. Two channels
+// instead of three when three would pass the memory budget.
+static void task_bake_normal_map(void *arg) {
+    StartupMeshJob *job = arg;
+    StartupMeshes *startup = job->startup;
+    int channels = mem_budget_fits((size_t)SCREEN_WIDTH * SCREEN_HEIGHT * 3) ? 3 : 2;
+    if (channels == 2) printf("Baking the %s normal map with two channels to stay within the memory budget\n", job->name);
+    job->normalMap = bake_normal_map(startup->heightmap, job->flat, startup->min, startup->max, SCREEN_HEIGHT, SCREEN_WIDTH, channels);
+}
+
+// The key only covers size and mtime, so a mapped mesh is held back until its blob's content
+// hash matches the heightmap. A stale one is rebuilt here and its blob rewritten.
+static void task_check_blobs(void *arg) {
+    StartupMeshes *startup = arg;
+    uint64_t hash;
+    if (!hash_heightmap(startup->heightmapFile, &hash)) return;
+    float **heightmap = NULL;
+    StartupMeshJob *jobs[2] = { &startup->torus, &startup->terrain };
+    for (int i = 0; i < 2; i++) {
+        StartupMeshJob *job = jobs[i];
+        if (!job->mapped || job->blobContentHash == hash) continue;
+        fprintf(stderr, "Cached %s mesh was built from a different %s; rebuilding it\n", job->name, startup->heightmapFile);
+        unmap_mesh_blob(job->mesh);
+        job->mapped = false;
+        if (!heightmap) heightmap = load_heightmap(startup);
+        rebuild_job(job, heightmap);
+        save_mesh_blob(job->mesh, job->name, startup->heightmapKey, hash, startup->rings, startup->sides);
+    }
+    if (heightmap) free_heightmap(heightmap);
+}
+
+static void task_upload(void *arg) {
+    StartupMeshJob *job = arg;
+    UploadMesh(&job->mesh, false);
+}
+
+// Progressive stand-in for task_upload: hands the CPU mesh to the render loop.
+static void task_publish(void *arg) {
+    StartupMeshJob *job = arg;
+    __atomic_store_n(&job->startup->published[job->flat ? 1 : 0], job, __ATOMIC_RELEASE);
+}
+
+// A cached mesh is just mapped; otherwise it is built from the shared heightmap.
+static void add_mesh_tasks(StartupMeshes *startup, StartupMeshJob *job, int range, int store, int freeHeightmap, int check) {
+    TaskGraph *graph = startup->graph;
+    int upload = startup->progressive
+        ? task_graph_add(graph, job->flat ? "publish terrain" : "publish torus", task_publish, job, false)
+        : task_graph_add(graph, job->flat ? "upload terrain" : "upload torus", task_upload, job, true);
+    if (startup->normalMaps) {
+        int bake = task_graph_add(graph, job->flat ? "bake terrain normal map" : "bake torus normal map", task_bake_normal_map, job, false);
+        task_graph_depends(graph, bake, range);
+        task_graph_depends(graph, freeHeightmap, bake);
+        task_graph_depends(graph, upload, bake);
+    }
+    if (job->cached) {
+        int map = task_graph_add(graph, job->flat ? "map terrain blob" : "map torus blob", task_map_blob, job, false);
+        task_graph_depends(graph, check, map);
+        task_graph_depends(graph, upload, check);
+        return;
+    }
+
+    int build = task_graph_add(graph, job->flat ? "build terrain" : "build torus", task_build, job, false);
+    int tangents = task_graph_add(graph, job->flat ? "terrain tangents" : "torus tangents", task_tangents, job, false);
+    int occlusion = task_graph_add(graph, job->flat ? "terrain occlusion" : "torus occlusion", task_occlusion, job, false);
+    int save = task_graph_add(graph, job->flat ? "save terrain blob" : "save torus blob", task_save_blob, job, false);
+    task_graph_depends(graph, build, range);
+    task_graph_depends(graph, freeHeightmap, build);
+    task_graph_depends(graph, tangents, build);
+    task_graph_depends(graph, occlusion, build);
+    task_graph_depends(graph, freeHeightmap, occlusion);
+    task_graph_depends(graph, upload, tangents);
+    task_graph_depends(graph, upload, occlusion);
+    task_graph_depends(graph, save, tangents);
+    task_graph_depends(graph, save, occlusion);
+    task_graph_depends(graph, save, store);
+    // UploadMesh writes the GPU ids into job->mesh while the save copies it. Published
+    // meshes are uploaded from a copy, so only the main-thread upload has to wait.
+    if (!startup->progressive) task_graph_depends(graph, upload, save);
+}
+
+void startup_begin(StartupMeshes *startup, int rings, int sides, bool progressive, bool normalMaps) {
+    *startup = (StartupMeshes){ 0 };
+    startup->rings = rings;
+    startup->sides = sides;
+    int warpFactor = GetHeightmapWarpFactor();
+    if (warpFactor > 1) snprintf(startup->sourceFile, sizeof(startup->sourceFile), HEIGHTMAP_FILE_COARSE_WARP, warpFactor);
+    else snprintf(startup->sourceFile, sizeof(startup->sourceFile), HEIGHTMAP_FILE);
+    ErosionParams erosion = GetHeightmapErosion();
+    if (erosion_enabled(&erosion)) {
+        snprintf(startup->heightmapFile, sizeof(startup->heightmapFile), HEIGHTMAP_FILE_ERODED,
+                 warpFactor, erosion.droplets, erosion.seed, erosion.thermalSteps, erosion.talus);
+    } else {
+        snprintf(startup->heightmapFile, sizeof(startup->heightmapFile), "%s", startup->sourceFile);
+    }
+    startup->progressive = progressive;
+    startup->normalMaps = normalMaps;
+    startup->torus = (StartupMeshJob){ startup, "torus", false, false, { 0 }, { 0 } };
+    startup->terrain = (StartupMeshJob){ startup, "terrain", true, false, { 0 }, { 0 } };
+
+    startup->keyKnown = heightmap_key(startup->heightmapFile, &startup->heightmapKey);
+    if (startup->keyKnown) {
+        startup->torus.cached = mesh_blob_exists("torus", startup->heightmapKey, rings, sides);
+        startup->terrain.cached = mesh_blob_exists("terrain", startup->heightmapKey, rings, sides);
+    }
+
+    int workers = omp_get_max_threads();
+    if (workers > 8) workers = 8;  // the graph is never wider than this
+    startup->graph = task_graph_create(workers);
+    TaskGraph *graph = startup->graph;
+
+    int range = -1, store = -1, freeHeightmap = -1;
+    if (!startup->torus.cached || !startup->terrain.cached || normalMaps) {
+        int heightmap = task_graph_add(graph, "heightmap", task_heightmap, startup, false);
+        range = task_graph_add(graph, "heightmap range", task_range, startup, false);
+        int pgmTorus = task_graph_add(graph, "write heightmap_T.pgm", task_pgm_torus, startup, false);
+        int pgmFlat = task_graph_add(graph, "write heightmap.pgm", task_pgm_flat, startup, false);
+        store = task_graph_add(graph, "store heightmap", task_store, startup, false);
+        freeHeightmap = task_graph_add(graph, "free heightmap", task_free_heightmap, startup, false);
+        task_graph_depends(graph, range, heightmap);
+        task_graph_depends(graph, pgmTorus, heightmap);
+        task_graph_depends(graph, pgmFlat, heightmap);
+        task_graph_depends(graph, store, heightmap);
+        task_graph_depends(graph, freeHeightmap, pgmTorus);
+        task_graph_depends(graph, freeHeightmap, pgmFlat);
+        task_graph_depends(graph, freeHeightmap, store);
+    }
+    int check = -1;
+    if (startup->torus.cached || startup->terrain.cached) {
+        check = task_graph_add(graph, "check blob heightmap hash", task_check_blobs, startup, false);
+    }
+    add_mesh_tasks(startup, &startup->torus, range, store, freeHeightmap, check);
+    add_mesh_tasks(startup, &startup->terrain, range, store, freeHeightmap, check);
+
+    printf("Startup graph: torus %s, terrain %s%s, %d workers\n",
+           startup->torus.cached ? "cached" : "build", startup->terrain.cached ? "cached" : "build",
+           normalMaps ? ", normal maps" : "", workers);
+    // A progressive graph outlives the caller's own scopes, so only its tasks are profiled
+    if (!progressive) PROF_BEGIN("startup graph");
+    task_graph_start(graph);
+}
+
+void startup_finish(StartupMeshes *startup) {
+    task_graph_wait(startup->graph);
+    if (!startup->progressive) PROF_END();
+    task_graph_destroy(startup->graph);
+    startup->graph = NULL;
+}
+
+StartupMeshJob *startup_take_ready(StartupMeshes *startup) {
+    for (int i = 0; i < 2; i++) {
+        if (!__atomic_load_n(&startup->published[i], __ATOMIC_ACQUIRE)) continue;
+        StartupMeshJob *job = __atomic_exchange_n(&startup->published[i], NULL, __ATOMIC_ACQ_REL);
+        if (job) {
+            startup->taken++;
+            return job;
+        }
+    }
+    return NULL;
+}
+
+bool startup_poll(StartupMeshes *startup) {
+    if (!startup->graph) return true;
+    // The graph may still be writing blobs after both meshes were published
+    if (startup->taken < 2 || !task_graph_poll(startup->graph)) return false;
+    task_graph_destroy(startup->graph);
+    startup->graph = NULL;
+    return true;
+}
@@ -0,0 +1,67 @@
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "raylib.h"
+#include "task_graph.h"
+
+typedef struct StartupMeshes StartupMeshes;
+
+typedef struct StartupMeshJob {
+    StartupMeshes *startup;
+    const char *name;       // blob cache name
+    bool flat;
+    bool cached;            // a blob exists for the current heightmap
+    Mesh mesh;
+    Image normalMap;        // baked from the heightmap when normal maps are on; caller uploads and unloads it
+    bool mapped;            // the mesh came from its blob
+    uint64_t blobContentHash;   // the heightmap content hash the blob was saved with
+} StartupMeshJob;
+
+// Startup mesh work as a task graph: the heightmap feeds both mesh builds, which run
+// in parallel with the PGM export and heightmap save. Each build also bakes its mesh's
+// occlusion into the vertex colours (see occlusion.h), which the blob caches. Only the
+// uploads run on the thread that calls startup_finish().
+//
+// In progressive mode nothing runs on the main thread: finished meshes are published
+// instead, and the render loop collects them with startup_take_ready() and uploads
+// them itself, swapping out whatever preview it was drawing.
+//
+// Blobs are found by the heightmap's size and mtime, which costs one stat before the graph
+// starts. A worker task then hashes the heightmap's contents while the blobs are mapped, and
+// a mapped mesh is only uploaded once its blob matches; a stale one is rebuilt and resaved.
+//
+// With normal maps on, each job also bakes its model's normal map from the heightmap,
+// so the heightmap is loaded even when both meshes are cached.
+struct StartupMeshes {
+    int rings, sides;
+    bool progressive;
+    bool normalMaps;
+    StartupMeshJob torus;
+    StartupMeshJob terrain;
+    StartupMeshJob *published[2];   // progressive mode: CPU-complete meshes not yet taken
+    int taken;
+
+    // Shared between tasks
+    char heightmapFile[64];         // the heightmap the meshes are built from
+    char sourceFile[64];            // the generated heightmap it is eroded from, if erosion is on
+    float **heightmap;
+    float min, max;
+    uint64_t heightmapKey;          // blob key: heightmap size and mtime
+    bool keyKnown;
+    uint64_t contentHash;           // recorded in saved blobs
+    bool contentKnown;
+    TaskGraph *graph;
+};
+
+// Needs SetTorusDimensions() and the screen size; the caller may do other work until startup_finish().
+void startup_begin(StartupMeshes *startup, int rings, int sides, bool progressive, bool normalMaps);
+void startup_finish(StartupMeshes *startup);
+
+// Progressive mode only; neither call blocks. take_ready returns a finished mesh that still
+// needs UploadMesh (or NULL), and poll returns true once both meshes were taken and the graph is gone.
+StartupMeshJob *startup_take_ready(StartupMeshes *startup);
+bool startup_poll(StartupMeshes *startup);
+
+#endif // STARTUP_H
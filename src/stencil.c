@@ -0,0 +1,224 @@
+#include "stencil.h"
+#include "profiler.h"
+#include "mem_track.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+
+#define STENCIL_TILE_WIDTH 512     // columns; a tile's rows plus halo stay in L2
+#define STENCIL_TILE_HEIGHT 32
+
+// With errno semantics GCC keeps a scalar call for sqrtf's domain error, which stops the
+// loop vectorising. GCC 12 only drops that call when it may also assume no NaNs; heights
+// are always finite. Other compilers get the plain kernel.
+#if defined(__GNUC__) && !defined(__clang__)
+#define STENCIL_NO_MATH_ERRNO __attribute__((optimize("no-math-errno", "finite-math-only")))
+#else
+#define STENCIL_NO_MATH_ERRNO
+#endif
+
+float **stencil_grid_alloc(int width, int height) {
+    float **grid = mem_alloc(MEM_SCRATCH, height * sizeof(float *));
+    float *data = mem_alloc(MEM_SCRATCH, (size_t)width * height * sizeof(float));
+    for (int y = 0; y < height; y++) grid[y] = data + (size_t)y * width;
+    return grid;
+}
+
+void stencil_grid_free(float **grid, int width, int height) {
+    if (!grid) return;
+    mem_free(MEM_SCRATCH, grid[0], (size_t)width * height * sizeof(float));
+    mem_free(MEM_SCRATCH, grid, height * sizeof(float *));
+}
+
+// Copies columns [x0 - haloX, x0 + count + haloX) of a source row, wrapping.
+static void copy_wrapped(float *dst, const float *src, int width, int x0, int count, int haloX) {
+    int u = ((x0 - haloX) % width + width) % width;
+    for (int k = 0; k < count + 2 * haloX; k++) {
+        dst[k] = src[u];
+        if (++u == width) u = 0;
+    }
+}
+
+void stencil_apply(float **dst, float *const *src, int width, int height, const StencilFilter *filter) {
+    int haloX = filter->haloX, haloY = filter->haloY;
+    if (haloX > STENCIL_MAX_HALO || haloY > STENCIL_MAX_HALO) {
+        fprintf(stderr, "stencil_apply: halo %dx%d exceeds %d\n", haloX, haloY, STENCIL_MAX_HALO);
+        return;
+    }
+    int tilesX = (width + STENCIL_TILE_WIDTH - 1) / STENCIL_TILE_WIDTH;
+    int tilesY = (height + STENCIL_TILE_HEIGHT - 1) / STENCIL_TILE_HEIGHT;
+    int padded = STENCIL_TILE_WIDTH + 2 * STENCIL_MAX_HALO;
+    int window = 2 * haloY + 1;
+
+    #pragma omp parallel
+    {
+        // Edge tiles: padded copies of the rows in the tile plus its vertical halo
+        size_t bufferSize = (size_t)(STENCIL_TILE_HEIGHT + 2 * haloY) * padded * sizeof(float);
+        float *buffer = mem_alloc(MEM_SCRATCH, bufferSize);
+        const float *rows[2 * STENCIL_MAX_HALO + 1];
+
+        #pragma omp for collapse(2) schedule(static)
+        for (int ty = 0; ty < tilesY; ty++) {
+            for (int tx = 0; tx < tilesX; tx++) {
+                int x0 = tx * STENCIL_TILE_WIDTH, y0 = ty * STENCIL_TILE_HEIGHT;
+                int count = width - x0 < STENCIL_TILE_WIDTH ? width - x0 : STENCIL_TILE_WIDTH;
+                int rowsInTile = height - y0 < STENCIL_TILE_HEIGHT ? height - y0 : STENCIL_TILE_HEIGHT;
+                bool wraps = x0 - haloX < 0 || x0 + count + haloX > width;
+                if (wraps) {
+                    for (int k = 0; k < rowsInTile + 2 * haloY; k++) {
+                        int v = ((y0 - haloY + k) % height + height) % height;
+                        copy_wrapped(buffer + (size_t)k * padded, src[v], width, x0, count, haloX);
+                    }
+                }
+                for (int y = y0; y < y0 + rowsInTile; y++) {
+                    for (int k = 0; k < window; k++) {
+                        if (wraps) {
+                            rows[k] = buffer + (size_t)(y - y0 + k) * padded + haloX;
+                        } else {
+                            int v = ((y - haloY + k) % height + height) % height;
+                            rows[k] = src[v] + x0;
+                        }
+                    }
+                    filter->kernel(rows, dst[y] + x0, count, filter->user);
+                }
+            }
+        }
+        mem_free(MEM_SCRATCH, buffer, bufferSize);
+    }
+}
+
+typedef struct GaussianKernel {
+    int radius;
+    float weights[2 * STENCIL_MAX_HALO + 1];
+} GaussianKernel;
+
+static void blur_rows_x(const float *const *rows, float *out, int count, const void *user) {
+    const GaussianKernel *g = user;
+    const float *in = rows[0];
+    #pragma omp simd
+    for (int x = 0; x < count; x++) out[x] = g->weights[g->radius] * in[x];
+    for (int k = -g->radius; k <= g->radius; k++) {
+        if (k == 0) continue;
+        float w = g->weights[g->radius + k];
+        const float *shifted = in + k;
+        #pragma omp simd
+        for (int x = 0; x < count; x++) out[x] += w * shifted[x];
+    }
+}
+
+static void blur_rows_y(const float *const *rows, float *out, int count, const void *user) {
+    const GaussianKernel *g = user;
+    const float *centre = rows[g->radius];
+    #pragma omp simd
+    for (int x = 0; x < count; x++) out[x] = g->weights[g->radius] * centre[x];
+    for (int k = 0; k < 2 * g->radius + 1; k++) {
+        if (k == g->radius) continue;
+        float w = g->weights[k];
+        const float *in = rows[k];
+        #pragma omp simd
+        for (int x = 0; x < count; x++) out[x] += w * in[x];
+    }
+}
+
+void stencil_gaussian_blur(float **dst, float *const *src, int width, int height, float sigma) {
+    PROF_BEGIN("stencil blur");
+    GaussianKernel g = { 0 };
+    g.radius = (int)ceilf(3.0f * sigma);
+    if (g.radius > STENCIL_MAX_HALO) g.radius = STENCIL_MAX_HALO;
+    float sum = 0.0f;
+    for (int k = -g.radius; k <= g.radius; k++) {
+        g.weights[g.radius + k] = sigma > 0.0f ? expf(-0.5f * k * k / (sigma * sigma)) : (k == 0);
+        sum += g.weights[g.radius + k];
+    }
+    for (int k = 0; k < 2 * g.radius + 1; k++) g.weights[k] /= sum;
+
+    float **tmp = stencil_grid_alloc(width, height);
+    stencil_apply(tmp, src, width, height, &(StencilFilter){ g.radius, 0, blur_rows_x, &g });
+    stencil_apply(dst, tmp, width, height, &(StencilFilter){ 0, g.radius, blur_rows_y, &g });
+    stencil_grid_free(tmp, width, height);
+    PROF_END();
+}
+
+STENCIL_NO_MATH_ERRNO static void slope_rows(const float *const *rows, float *out, int count, const void *user) {
+    float scale = 0.5f / *(const float *)user;
+    const float *up = rows[0], *mid = rows[1], *down = rows[2];
+    #pragma omp simd
+    for (int x = 0; x < count; x++) {
+        float dx = (mid[x + 1] - mid[x - 1]) * scale;
+        float dy = (down[x] - up[x]) * scale;
+        out[x] = __builtin_sqrtf(dx * dx + dy * dy);
+    }
+}
+
+void stencil_slope(float **dst, float *const *src, int width, int height, float spacing) {
+    PROF_BEGIN("stencil slope");
+    stencil_apply(dst, src, width, height, &(StencilFilter){ 1, 1, slope_rows, &spacing });
+    PROF_END();
+}
+
+// Five-point Laplacian: positive in hollows, negative on ridges.
+static void curvature_rows(const float *const *rows, float *out, int count, const void *user) {
+    float spacing = *(const float *)user;
+    float scale = 1.0f / (spacing * spacing);
+    const float *up = rows[0], *mid = rows[1], *down = rows[2];
+    #pragma omp simd
+    for (int x = 0; x < count; x++) {
+        out[x] = (mid[x - 1] + mid[x + 1] + up[x] + down[x] - 4.0f * mid[x]) * scale;
+    }
+}
+
+void stencil_curvature(float **dst, float *const *src, int width, int height, float spacing) {
+    PROF_BEGIN("stencil curvature");
+    stencil_apply(dst, src, width, height, &(StencilFilter){ 1, 1, curvature_rows, &spacing });
+    PROF_END();
+}
+
+typedef struct ThermalParams {
+    float talus, rate;
+} ThermalParams;
+
+// max(drop - talus, 0) without a branch, so the row loop vectorises
+static inline float thermal_excess(float drop, float talus) {
+    float excess = drop - talus;
+    return 0.5f * (excess + fabsf(excess));
+}
+
+// Each sample gathers what its four neighbours shed towards it and loses what it sheds
+// towards them; the pairwise flows cancel, so the step conserves mass.
+static void thermal_rows(const float *const *rows, float *out, int count, const void *user) {
+    const ThermalParams *p = user;
+    float talus = p->talus, rate = p->rate;
+    const float *up = rows[0], *mid = rows[1], *down = rows[2];
+    #pragma omp simd
+    for (int x = 0; x < count; x++) {
+        float h = mid[x];
+        float flow = 0.0f;
+        flow += thermal_excess(mid[x - 1] - h, talus) - thermal_excess(h - mid[x - 1], talus);
+        flow += thermal_excess(mid[x + 1] - h, talus) - thermal_excess(h - mid[x + 1], talus);
+        flow += thermal_excess(up[x] - h, talus) - thermal_excess(h - up[x], talus);
+        flow += thermal_excess(down[x] - h, talus) - thermal_excess(h - down[x], talus);
+        out[x] = h + rate * flow;
+    }
+}
+
+void stencil_thermal_erosion(float **grid, int width, int height, float talus, float rate, int steps) {
+    PROF_BEGIN("stencil thermal erosion");
+    ThermalParams params = { talus, rate };
+    StencilFilter filter = { 1, 1, thermal_rows, &params };
+    float **tmp = stencil_grid_alloc(width, height);
+    // Ping-pong through the scratch grid; an odd step count ends with one copy back
+    for (int s = 0; s + 1 < steps; s += 2) {
+        stencil_apply(tmp, grid, width, height, &filter);
+        stencil_apply(grid, tmp, width, height, &filter);
+    }
+    if (steps % 2) {
+        stencil_apply(tmp, grid, width, height, &filter);
+        #pragma omp parallel for schedule(static)
+        for (int y = 0; y < height; y++) memcpy(grid[y], tmp[y], width * sizeof(float));
+    }
+    stencil_grid_free(tmp, width, height);
+    PROF_END();
+}
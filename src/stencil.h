@@ -0,0 +1,40 @@
+#ifndef STENCIL_H
+#define STENCIL_H
+
+// Neighbourhood filters over a periodic 2D grid of float rows (the heightmap layout,
+// grid[row][column]), wrapping in both directions.
+//
+// The grid is processed in cache-sized tiles split across OpenMP threads. A filter only
+// supplies a row kernel: it gets the input rows around the output row and writes one
+// output row span with a plain loop the compiler vectorises. Rows above and below wrap
+// by pointer; only tiles at the left and right edges copy their rows into a padded
+// buffer to wrap the halo columns, so most tiles read the source in place.
+#define STENCIL_MAX_HALO 16
+
+// rows[haloY + k] is the input row k rows from the output row (k in -haloY..haloY), and
+// each is readable at [-haloX, count + haloX). Writes out[0, count).
+typedef void (*StencilRowKernel)(const float *const *rows, float *out, int count, const void *user);
+
+typedef struct StencilFilter {
+    int haloX, haloY;               // at most STENCIL_MAX_HALO
+    StencilRowKernel kernel;
+    const void *user;
+} StencilFilter;
+
+// dst and src must not alias.
+void stencil_apply(float **dst, float *const *src, int width, int height, const StencilFilter *filter);
+
+// A grid of height rows, one allocation; free with stencil_grid_free().
+float **stencil_grid_alloc(int width, int height);
+void stencil_grid_free(float **grid, int width, int height);
+
+// Built-in filters. Heights are in grid units; spacing is the distance between
+// neighbouring samples in the same units, so slope and curvature come out per unit length.
+void stencil_gaussian_blur(float **dst, float *const *src, int width, int height, float sigma);
+void stencil_slope(float **dst, float *const *src, int width, int height, float spacing);
+void stencil_curvature(float **dst, float *const *src, int width, int height, float spacing);
+// Moves material from each sample to any neighbour more than talus below it, rate of the
+// excess per step. Conserves mass; rate <= 0.125 keeps it from overshooting. In place.
+void stencil_thermal_erosion(float **grid, int width, int height, float talus, float rate, int steps);
+
+#endif // STENCIL_H
@@ -0,0 +1,259 @@
+#include "task_graph.h"
+#include "profiler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <omp.h>
+
+typedef struct Task {
+    const char *name;
+    TaskFunction fn;
+    void *arg;
+    bool mainThread;
+    int pending;            // unfinished dependencies
+    int successorCount;
+    int successors[TASK_GRAPH_MAX_TASKS];
+} Task;
+
+// Each task is pushed at most once, so a plain array never needs to wrap.
+typedef struct TaskDeque {
+    pthread_mutex_t lock;
+    int items[TASK_GRAPH_MAX_TASKS];
+    int head;               // thieves take from here
+    int tail;               // the owner pushes and pops here
+} TaskDeque;
+
+typedef struct WorkerArg {
+    TaskGraph *graph;
+    int index;
+} WorkerArg;
+
+struct TaskGraph {
+    Task tasks[TASK_GRAPH_MAX_TASKS];
+    int taskCount;
+    int workerCount;
+    pthread_t threads[TASK_GRAPH_MAX_WORKERS];
+    WorkerArg workerArgs[TASK_GRAPH_MAX_WORKERS];
+    TaskDeque deques[TASK_GRAPH_MAX_WORKERS + 1];   // the last deque holds main-thread tasks
+
+    // Idle threads sleep on changed; ready and completed are only modified under lock
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int ready;              // queued worker tasks not yet taken
+    int completed;
+    int ompThreads;         // OpenMP threads all running tasks share
+    int ompClaimed;
+    bool started;
+    bool joined;
+};
+
+static void deque_push(TaskDeque *deque, int id) {
+    pthread_mutex_lock(&deque->lock);
+    deque->items[deque->tail++] = id;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+static bool deque_pop(TaskDeque *deque, int *id) {
+    pthread_mutex_lock(&deque->lock);
+    bool found = deque->tail > deque->head;
+    if (found) *id = deque->items[--deque->tail];
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static bool deque_steal(TaskDeque *deque, int *id) {
+    pthread_mutex_lock(&deque->lock);
+    bool found = deque->tail > deque->head;
+    if (found) *id = deque->items[deque->head++];
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static bool deque_empty(TaskDeque *deque) {
+    pthread_mutex_lock(&deque->lock);
+    bool empty = deque->tail == deque->head;
+    pthread_mutex_unlock(&deque->lock);
+    return empty;
+}
+
+TaskGraph *task_graph_create(int workerCount) {
+    TaskGraph *graph = calloc(1, sizeof(TaskGraph));
+    if (!graph) {
+        perror("calloc failed");
+        exit(1);
+    }
+    if (workerCount < 0) workerCount = 0;
+    if (workerCount > TASK_GRAPH_MAX_WORKERS) workerCount = TASK_GRAPH_MAX_WORKERS;
+    graph->workerCount = workerCount;
+    graph->ompThreads = omp_get_max_threads();
+    for (int i = 0; i <= workerCount; i++) pthread_mutex_init(&graph->deques[i].lock, NULL);
+    pthread_mutex_init(&graph->lock, NULL);
+    pthread_cond_init(&graph->changed, NULL);
+    return graph;
+}
+
+int task_graph_add(TaskGraph *graph, const char *name, TaskFunction fn, void *arg, bool mainThread) {
+    if (graph->started || graph->taskCount >= TASK_GRAPH_MAX_TASKS) {
+        fprintf(stderr, "task_graph_add: cannot add task %s\n", name);
+        exit(1);
+    }
+    Task *task = &graph->tasks[graph->taskCount];
+    task->name = name;
+    task->fn = fn;
+    task->arg = arg;
+    task->mainThread = mainThread;
+    return graph->taskCount++;
+}
+
+void task_graph_depends(TaskGraph *graph, int task, int dependency) {
+    Task *before = &graph->tasks[dependency];
+    before->successors[before->successorCount++] = task;
+    graph->tasks[task].pending++;
+}
+
+// Main-thread tasks go to the main deque; the rest to worker's own deque, or round-robin
+// from it when spread is set. The whole batch is counted in ready before any of it can
+// be taken, so the first task taken already sees its siblings when it claims threads.
+static void enqueue(TaskGraph *graph, const int *ids, int count, int worker, bool spread) {
+    pthread_mutex_lock(&graph->lock);
+    for (int i = 0; i < count; i++) {
+        bool onMain = graph->tasks[ids[i]].mainThread || graph->workerCount == 0;
+        if (!onMain) graph->ready++;
+        int deque = onMain ? graph->workerCount : spread ? (worker + i) % graph->workerCount : worker;
+        deque_push(&graph->deques[deque], ids[i]);
+    }
+    pthread_cond_broadcast(&graph->changed);
+    pthread_mutex_unlock(&graph->lock);
+}
+
+// Every pthread that opens a parallel region gets its own OpenMP team, so concurrent
+// tasks would each take every core. A task instead claims an even share of the threads
+// still free among itself and the tasks queued behind it, at least one; a task running
+// alone gets them all. Running tasks never hold more than ompThreads + workerCount.
+static int claim_omp_threads(TaskGraph *graph) {
+    pthread_mutex_lock(&graph->lock);
+    int share = (graph->ompThreads - graph->ompClaimed) / (graph->ready + 1);
+    if (share < 1) share = 1;
+    graph->ompClaimed += share;
+    pthread_mutex_unlock(&graph->lock);
+    return share;
+}
+
+static void release_omp_threads(TaskGraph *graph, int threads) {
+    pthread_mutex_lock(&graph->lock);
+    graph->ompClaimed -= threads;
+    pthread_mutex_unlock(&graph->lock);
+}
+
+static void run_task(TaskGraph *graph, int id, int worker, bool onWorker) {
+    Task *task = &graph->tasks[id];
+    int threads = onWorker ? claim_omp_threads(graph) : 0;
+    if (threads) omp_set_num_threads(threads);
+    PROF_BEGIN(task->name);
+    task->fn(task->arg);
+    PROF_END();
+    // Before the successors are queued, so they see the threads as free
+    if (threads) release_omp_threads(graph, threads);
+
+    int ready[TASK_GRAPH_MAX_TASKS], readyCount = 0;
+    for (int s = 0; s < task->successorCount; s++) {
+        int next = task->successors[s];
+        if (__atomic_sub_fetch(&graph->tasks[next].pending, 1, __ATOMIC_ACQ_REL) == 0) ready[readyCount++] = next;
+    }
+    if (readyCount > 0) enqueue(graph, ready, readyCount, worker, false);
+
+    pthread_mutex_lock(&graph->lock);
+    graph->completed++;
+    pthread_cond_broadcast(&graph->changed);
+    pthread_mutex_unlock(&graph->lock);
+}
+
+// Own deque newest-first (its inputs are still in cache), then steal oldest-first from the others.
+static bool take_task(TaskGraph *graph, int worker, int *id) {
+    if (deque_pop(&graph->deques[worker], id)) return true;
+    for (int k = 1; k < graph->workerCount; k++) {
+        if (deque_steal(&graph->deques[(worker + k) % graph->workerCount], id)) return true;
+    }
+    return false;
+}
+
+static void *worker_main(void *arg) {
+    WorkerArg *workerArg = arg;
+    TaskGraph *graph = workerArg->graph;
+    while (true) {
+        int id;
+        if (take_task(graph, workerArg->index, &id)) {
+            pthread_mutex_lock(&graph->lock);
+            graph->ready--;
+            pthread_mutex_unlock(&graph->lock);
+            run_task(graph, id, workerArg->index, true);
+            continue;
+        }
+
+        pthread_mutex_lock(&graph->lock);
+        while (graph->ready <= 0 && graph->completed < graph->taskCount) {
+            pthread_cond_wait(&graph->changed, &graph->lock);
+        }
+        bool done = graph->completed == graph->taskCount;
+        pthread_mutex_unlock(&graph->lock);
+        if (done) break;
+    }
+    return NULL;
+}
+
+void task_graph_start(TaskGraph *graph) {
+    graph->started = true;
+    for (int w = 0; w < graph->workerCount; w++) {
+        graph->workerArgs[w] = (WorkerArg){ graph, w };
+        if (pthread_create(&graph->threads[w], NULL, worker_main, &graph->workerArgs[w]) != 0) {
+            perror("pthread_create failed");
+            exit(1);
+        }
+    }
+
+    // Spread the roots round-robin; stealing evens out the rest
+    int roots[TASK_GRAPH_MAX_TASKS], rootCount = 0;
+    for (int id = 0; id < graph->taskCount; id++) {
+        if (graph->tasks[id].pending == 0) roots[rootCount++] = id;
+    }
+    enqueue(graph, roots, rootCount, 0, true);
+}
+
+static void join_workers(TaskGraph *graph) {
+    if (graph->joined) return;
+    for (int w = 0; w < graph->workerCount; w++) pthread_join(graph->threads[w], NULL);
+    graph->joined = true;
+}
+
+bool task_graph_poll(TaskGraph *graph) {
+    int id;
+    while (deque_pop(&graph->deques[graph->workerCount], &id)) {
+        run_task(graph, id, 0, false);
+    }
+
+    pthread_mutex_lock(&graph->lock);
+    bool done = graph->completed == graph->taskCount;
+    pthread_mutex_unlock(&graph->lock);
+    if (done) join_workers(graph);
+    return done;
+}
+
+void task_graph_wait(TaskGraph *graph) {
+    TaskDeque *mainDeque = &graph->deques[graph->workerCount];
+    while (!task_graph_poll(graph)) {
+        pthread_mutex_lock(&graph->lock);
+        while (deque_empty(mainDeque) && graph->completed < graph->taskCount) {
+            pthread_cond_wait(&graph->changed, &graph->lock);
+        }
+        pthread_mutex_unlock(&graph->lock);
+    }
+}
+
+void task_graph_destroy(TaskGraph *graph) {
+    if (graph->started) task_graph_wait(graph);
+    for (int i = 0; i <= graph->workerCount; i++) pthread_mutex_destroy(&graph->deques[i].lock);
+    pthread_mutex_destroy(&graph->lock);
+    pthread_cond_destroy(&graph->changed);
+    free(graph);
+}
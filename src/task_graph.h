@@ -0,0 +1,27 @@
+#ifndef TASK_GRAPH_H
+#define TASK_GRAPH_H
+
+#include <stdbool.h>
+
+#define TASK_GRAPH_MAX_TASKS 64
+#define TASK_GRAPH_MAX_WORKERS 32
+
+typedef void (*TaskFunction)(void *arg);
+typedef struct TaskGraph TaskGraph;
+
+// A dependency DAG executed by a work-stealing pool. Tasks flagged mainThread
+// (GPU uploads) only ever run on the thread that calls task_graph_wait/poll.
+// Tasks and dependencies must all be added before task_graph_start. Worker tasks split
+// the OpenMP threads between them rather than each opening a full team.
+TaskGraph *task_graph_create(int workerCount);
+int task_graph_add(TaskGraph *graph, const char *name, TaskFunction fn, void *arg, bool mainThread);
+void task_graph_depends(TaskGraph *graph, int task, int dependency);
+
+void task_graph_start(TaskGraph *graph);
+// Runs main-thread tasks as they become ready and returns once every task has finished.
+void task_graph_wait(TaskGraph *graph);
+// Runs the main-thread tasks that are ready now, without blocking. Returns true when the graph is done.
+bool task_graph_poll(TaskGraph *graph);
+void task_graph_destroy(TaskGraph *graph);
+
+#endif // TASK_GRAPH_H
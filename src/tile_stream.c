@@ -0,0 +1,373 @@
+#include "tile_stream.h"
+#include "raymath.h"
+#include "profiler.h"
+#include "mem_track.h"
+#include "heightmap_sampler.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define TILE_VERTEX_COUNT (TILE_VERTS * TILE_VERTS)
+#define RANGE_SAMPLES_U 256     // samples of one period for the height range
+#define RANGE_SAMPLES_V 128
+
+enum { SLOT_IDLE, SLOT_QUEUED, SLOT_BUILDING, SLOT_READY };
+
+typedef struct TileSlot {
+    // Guarded by the stream lock
+    int state;
+    int wantX, wantZ;           // the tile of the current square this slot holds
+    int buildX, buildZ;         // the tile in staging
+    unsigned buildGeneration;
+
+    // Staging: the worker's while BUILDING, the render thread's while READY
+    float *vertices, *normals;
+
+    // Render thread only
+    Mesh mesh;
+    bool gpuValid;
+    int gpuX, gpuZ;
+    unsigned gpuGeneration;
+} TileSlot;
+
+struct TileStream {
+    pthread_t thread;
+
+    // Guarded by lock
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    bool quit;
+    int centerX, centerZ;       // tile under the focus
+    TerrainParams params;
+    unsigned generation;        // bumped by every parameter change
+    unsigned rangeGeneration;   // the generation min and gradient were sampled for
+    float min, gradient;
+    double buildMs;
+    TileSlot slots[TILE_SLOTS];
+
+    // Worker thread only
+    float *u, *v, *heights, *grads;
+
+    TileStreamStats stats;      // render thread only
+};
+
+static float wrap_pixel(float a, float m) {
+    a = fmodf(a, m);
+    if (a < 0.0f) a += m;
+    return a < m ? a : 0.0f;
+}
+
+// Heights of the whole period at the tiles' vertex spacing, for a scale every tile shares.
+static void sample_range(const TerrainParams *params, float *min, float *max) {
+    int count = RANGE_SAMPLES_U * RANGE_SAMPLES_V;
+    float *u = mem_alloc(MEM_SCRATCH, count * sizeof(float));
+    float *v = mem_alloc(MEM_SCRATCH, count * sizeof(float));
+    float *heights = mem_alloc(MEM_SCRATCH, count * sizeof(float));
+    for (int b = 0; b < RANGE_SAMPLES_V; b++) {
+        for (int a = 0; a < RANGE_SAMPLES_U; a++) {
+            u[b * RANGE_SAMPLES_U + a] = (a + 0.5f) * SCREEN_WIDTH / RANGE_SAMPLES_U;
+            v[b * RANGE_SAMPLES_U + a] = (b + 0.5f) * SCREEN_HEIGHT / RANGE_SAMPLES_V;
+        }
+    }
+    terrain_height_batch(u, v, count, params, 0.0f, TILE_SIZE / TILE_QUADS, heights, NULL);
+    *min = FLT_MAX;
+    *max = -FLT_MAX;
+    for (int k = 0; k < count; k++) {
+        if (heights[k] < *min) *min = heights[k];
+        if (heights[k] > *max) *max = heights[k];
+    }
+    if (*max <= *min) *max = *min + 1.0f;
+    mem_free(MEM_SCRATCH, u, count * sizeof(float));
+    mem_free(MEM_SCRATCH, v, count * sizeof(float));
+    mem_free(MEM_SCRATCH, heights, count * sizeof(float));
+}
+
+// Vertex (i, j) of a tile is i steps along +x and j along +z from its corner, so the
+// grid winds counter-clockwise seen from above like the fixed patch.
+static void build_tiles(TileStream *stream, TileSlot **slots, int count, const TerrainParams *params, float min, float gradient) {
+    float step = TILE_SIZE / TILE_QUADS;
+    for (int t = 0; t < count; t++) {
+        float originX = slots[t]->buildX * TILE_SIZE, originZ = slots[t]->buildZ * TILE_SIZE;
+        for (int i = 0; i < TILE_VERTS; i++) {
+            for (int j = 0; j < TILE_VERTS; j++) {
+                int k = t * TILE_VERTEX_COUNT + i * TILE_VERTS + j;
+                stream->u[k] = wrap_pixel(originZ + j * step, SCREEN_WIDTH);
+                stream->v[k] = wrap_pixel(SCREEN_HEIGHT - (originX + i * step), SCREEN_HEIGHT);
+            }
+        }
+    }
+    terrain_height_batch(stream->u, stream->v, count * TILE_VERTEX_COUNT, params, 0.0f, step, stream->heights, stream->grads);
+
+    for (int t = 0; t < count; t++) {
+        Vector3 *vertices = (Vector3 *)slots[t]->vertices;
+        Vector3 *normals = (Vector3 *)slots[t]->normals;
+        for (int i = 0; i < TILE_VERTS; i++) {
+            for (int j = 0; j < TILE_VERTS; j++) {
+                int n = i * TILE_VERTS + j, k = t * TILE_VERTEX_COUNT + n;
+                vertices[n] = (Vector3){ i * step, (stream->heights[k] - min) * gradient, j * step };
+                // z follows u and x runs against v, so dy/dx = -dh/dv and dy/dz = dh/du
+                float dh_du = stream->grads[2 * k] * gradient, dh_dv = stream->grads[2 * k + 1] * gradient;
+                normals[n] = Vector3Normalize((Vector3){ dh_dv, 1.0f, -dh_du });
+            }
+        }
+    }
+}
+
+static bool any_queued(TileStream *stream) {
+    for (int s = 0; s < TILE_SLOTS; s++) {
+        if (stream->slots[s].state == SLOT_QUEUED) return true;
+    }
+    return false;
+}
+
+// Up to TILE_BATCH queued slots, nearest the centre first. Called with the lock held.
+static int take_queued(TileStream *stream, TileSlot **batch, int centerX, int centerZ) {
+    int count = 0;
+    while (count < TILE_BATCH) {
+        TileSlot *best = NULL;
+        int bestDistance = 0;
+        for (int s = 0; s < TILE_SLOTS; s++) {
+            TileSlot *slot = &stream->slots[s];
+            if (slot->state != SLOT_QUEUED) continue;
+            int dx = slot->wantX - centerX, dz = slot->wantZ - centerZ;
+            int distance = dx * dx + dz * dz;
+            if (!best || distance < bestDistance) {
+                best = slot;
+                bestDistance = distance;
+            }
+        }
+        if (!best) break;
+        best->state = SLOT_BUILDING;
+        best->buildX = best->wantX;
+        best->buildZ = best->wantZ;
+        best->buildGeneration = stream->generation;
+        batch[count++] = best;
+    }
+    return count;
+}
+
+static void *worker_main(void *arg) {
+    TileStream *stream = arg;
+    pthread_mutex_lock(&stream->lock);
+    while (true) {
+        while (!stream->quit && !any_queued(stream)) {
+            pthread_cond_wait(&stream->wake, &stream->lock);
+        }
+        if (stream->quit) break;
+        TerrainParams params = stream->params;
+        unsigned generation = stream->generation;
+
+        if (stream->rangeGeneration != generation) {
+            pthread_mutex_unlock(&stream->lock);
+            float min, max;
+            sample_range(&params, &min, &max);
+            pthread_mutex_lock(&stream->lock);
+            if (stream->generation == generation) {
+                stream->min = min;
+                stream->gradient = MESH_HEIGHT_RANGE / (max - min);
+                stream->rangeGeneration = generation;
+            }
+            continue;
+        }
+
+        TileSlot *batch[TILE_BATCH];
+        int count = take_queued(stream, batch, stream->centerX, stream->centerZ);
+        float min = stream->min, gradient = stream->gradient;
+        pthread_mutex_unlock(&stream->lock);
+
+        PROF_BEGIN("tile build");
+        uint64_t start = prof_now_ns();
+        build_tiles(stream, batch, count, &params, min, gradient);
+        double ms = (double)(prof_now_ns() - start) / 1.0e6;
+        PROF_END();
+
+        pthread_mutex_lock(&stream->lock);
+        stream->buildMs = ms / count;
+        for (int t = 0; t < count; t++) {
+            TileSlot *slot = batch[t];
+            bool current = slot->buildX == slot->wantX && slot->buildZ == slot->wantZ && slot->buildGeneration == stream->generation;
+            slot->state = current ? SLOT_READY : SLOT_QUEUED;
+        }
+    }
+    pthread_mutex_unlock(&stream->lock);
+    return NULL;
+}
+
+// One tile's grid, the same for every slot; the first upload is all zero heights.
+static Mesh create_tile_mesh(void) {
+    Mesh mesh = { 0 };
+    mesh.vertexCount = TILE_VERTEX_COUNT;
+    mesh.triangleCount = TILE_QUADS * TILE_QUADS * 2;
+    mesh.vertices = MemAlloc(TILE_VERTEX_COUNT * 3 * sizeof(float));
+    mesh.normals = MemAlloc(TILE_VERTEX_COUNT * 3 * sizeof(float));
+    mesh.texcoords = MemAlloc(TILE_VERTEX_COUNT * 2 * sizeof(float));
+    mesh.indices = MemAlloc(mesh.triangleCount * 3 * sizeof(unsigned short));
+    for (int i = 0; i < TILE_VERTS; i++) {
+        for (int j = 0; j < TILE_VERTS; j++) {
+            int n = i * TILE_VERTS + j;
+            mesh.normals[3 * n + 1] = 1.0f;
+            mesh.texcoords[2 * n] = (float)j / TILE_QUADS;
+            mesh.texcoords[2 * n + 1] = (float)i / TILE_QUADS;
+        }
+    }
+    int k = 0;
+    for (int i = 0; i < TILE_QUADS; i++) {
+        for (int j = 0; j < TILE_QUADS; j++) {
+            int v00 = i * TILE_VERTS + j, v01 = v00 + 1, v10 = v00 + TILE_VERTS, v11 = v10 + 1;
+            mesh.indices[k++] = v00;
+            mesh.indices[k++] = v01;
+            mesh.indices[k++] = v10;
+            mesh.indices[k++] = v10;
+            mesh.indices[k++] = v01;
+            mesh.indices[k++] = v11;
+        }
+    }
+    UploadMesh(&mesh, true);    // dynamic: rewritten each time the slot is recycled
+    return mesh;
+}
+
+// Points every slot at its tile of the square around the current centre. Called with the lock held.
+static void assign_slots(TileStream *stream) {
+    int half = TILE_RING / 2;
+    int firstX = stream->centerX - half, firstZ = stream->centerZ - half;
+    for (int sz = 0; sz < TILE_RING; sz++) {
+        for (int sx = 0; sx < TILE_RING; sx++) {
+            TileSlot *slot = &stream->slots[sz * TILE_RING + sx];
+            slot->wantX = firstX + WRAP_MOD(sx - firstX, TILE_RING);
+            slot->wantZ = firstZ + WRAP_MOD(sz - firstZ, TILE_RING);
+            if (slot->state == SLOT_BUILDING) continue;   // the worker requeues it if stale
+            bool current = slot->gpuValid && slot->gpuX == slot->wantX && slot->gpuZ == slot->wantZ &&
+                           slot->gpuGeneration == stream->generation;
+            if (current) slot->state = SLOT_IDLE;
+            else if (slot->state != SLOT_READY || slot->buildX != slot->wantX || slot->buildZ != slot->wantZ ||
+                     slot->buildGeneration != stream->generation) slot->state = SLOT_QUEUED;
+        }
+    }
+    pthread_cond_signal(&stream->wake);
+}
+
+TileStream *tile_stream_create(const TerrainParams *params) {
+    TileStream *stream = mem_calloc(MEM_TILES, sizeof(TileStream));
+    stream->params = *params;
+    stream->generation = 1;
+    int count = TILE_BATCH * TILE_VERTEX_COUNT;
+    stream->u = mem_alloc(MEM_TILES, count * sizeof(float));
+    stream->v = mem_alloc(MEM_TILES, count * sizeof(float));
+    stream->heights = mem_alloc(MEM_TILES, count * sizeof(float));
+    stream->grads = mem_alloc(MEM_TILES, 2 * count * sizeof(float));
+    for (int s = 0; s < TILE_SLOTS; s++) {
+        TileSlot *slot = &stream->slots[s];
+        slot->vertices = mem_alloc(MEM_TILES, TILE_VERTEX_COUNT * 3 * sizeof(float));
+        slot->normals = mem_alloc(MEM_TILES, TILE_VERTEX_COUNT * 3 * sizeof(float));
+        slot->mesh = create_tile_mesh();
+    }
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->wake, NULL);
+    assign_slots(stream);
+    if (pthread_create(&stream->thread, NULL, worker_main, stream) != 0) {
+        perror("pthread_create failed");
+        exit(1);
+    }
+    return stream;
+}
+
+void tile_stream_destroy(TileStream *stream) {
+    if (!stream) return;
+    pthread_mutex_lock(&stream->lock);
+    stream->quit = true;
+    pthread_cond_signal(&stream->wake);
+    pthread_mutex_unlock(&stream->lock);
+    pthread_join(stream->thread, NULL);
+    pthread_mutex_destroy(&stream->lock);
+    pthread_cond_destroy(&stream->wake);
+    for (int s = 0; s < TILE_SLOTS; s++) {
+        UnloadMesh(stream->slots[s].mesh);
+        mem_free(MEM_TILES, stream->slots[s].vertices, TILE_VERTEX_COUNT * 3 * sizeof(float));
+        mem_free(MEM_TILES, stream->slots[s].normals, TILE_VERTEX_COUNT * 3 * sizeof(float));
+    }
+    int count = TILE_BATCH * TILE_VERTEX_COUNT;
+    mem_free(MEM_TILES, stream->u, count * sizeof(float));
+    mem_free(MEM_TILES, stream->v, count * sizeof(float));
+    mem_free(MEM_TILES, stream->heights, count * sizeof(float));
+    mem_free(MEM_TILES, stream->grads, 2 * count * sizeof(float));
+    mem_free(MEM_TILES, stream, sizeof(TileStream));
+}
+
+void tile_stream_set_params(TileStream *stream, const TerrainParams *params) {
+    pthread_mutex_lock(&stream->lock);
+    stream->params = *params;
+    stream->generation++;
+    assign_slots(stream);
+    pthread_mutex_unlock(&stream->lock);
+}
+
+void tile_stream_update(TileStream *stream, Vector3 focus, int byteBudget) {
+    int centerX = (int)floorf(focus.x / TILE_SIZE), centerZ = (int)floorf(focus.z / TILE_SIZE);
+    TileSlot *ready[TILE_SLOTS];
+    int readyCount = 0;
+    pthread_mutex_lock(&stream->lock);
+    if (centerX != stream->centerX || centerZ != stream->centerZ) {
+        stream->centerX = centerX;
+        stream->centerZ = centerZ;
+        assign_slots(stream);
+    }
+    for (int s = 0; s < TILE_SLOTS; s++) {
+        if (stream->slots[s].state == SLOT_READY) ready[readyCount++] = &stream->slots[s];
+    }
+    stream->stats.buildMs = stream->buildMs;
+    pthread_mutex_unlock(&stream->lock);
+
+    // READY slots are left alone by the worker, so their staging is read without the lock
+    PROF_BEGIN("tile upload");
+    int uploads = 0, bytes = 0;
+    for (int r = 0; r < readyCount && (uploads == 0 || bytes + TILE_BYTES <= byteBudget); r++) {
+        TileSlot *slot = ready[r];
+        int size = TILE_VERTEX_COUNT * 3 * sizeof(float);
+        memcpy(slot->mesh.vertices, slot->vertices, size);
+        memcpy(slot->mesh.normals, slot->normals, size);
+        UpdateMeshBuffer(slot->mesh, 0, slot->mesh.vertices, size, 0);  // SHADER_LOC_VERTEX_POSITION
+        UpdateMeshBuffer(slot->mesh, 2, slot->mesh.normals, size, 0);   // SHADER_LOC_VERTEX_NORMAL
+        slot->gpuValid = true;
+        slot->gpuX = slot->buildX;
+        slot->gpuZ = slot->buildZ;
+        slot->gpuGeneration = slot->buildGeneration;
+        uploads++;
+        bytes += TILE_BYTES;
+
+        pthread_mutex_lock(&stream->lock);
+        bool current = slot->gpuX == slot->wantX && slot->gpuZ == slot->wantZ && slot->gpuGeneration == stream->generation;
+        slot->state = current ? SLOT_IDLE : SLOT_QUEUED;
+        if (!current) pthread_cond_signal(&stream->wake);
+        pthread_mutex_unlock(&stream->lock);
+    }
+    PROF_END();
+
+    stream->stats.uploads = uploads;
+    stream->stats.uploadBytes = bytes;
+    stream->stats.resident = 0;
+    pthread_mutex_lock(&stream->lock);
+    for (int s = 0; s < TILE_SLOTS; s++) {
+        TileSlot *slot = &stream->slots[s];
+        if (slot->gpuValid && slot->gpuX == slot->wantX && slot->gpuZ == slot->wantZ && slot->gpuGeneration == stream->generation) stream->stats.resident++;
+    }
+    pthread_mutex_unlock(&stream->lock);
+    stream->stats.pending = TILE_SLOTS - stream->stats.resident;
+}
+
+// Slots whose GPU tile belongs to the current square; an older generation of the same
+// tile is drawn until its rebuild arrives.
+void tile_stream_draw(TileStream *stream, RenderLayer *layer, Material material) {
+    for (int s = 0; s < TILE_SLOTS; s++) {
+        TileSlot *slot = &stream->slots[s];
+        if (!slot->gpuValid || slot->gpuX != slot->wantX || slot->gpuZ != slot->wantZ) continue;
+        render_draw_mesh(layer, slot->mesh, material, MatrixTranslate(slot->gpuX * TILE_SIZE, 0.0f, slot->gpuZ * TILE_SIZE));
+    }
+}
+
+TileStreamStats tile_stream_stats(TileStream *stream) {
+    return stream->stats;
+}
@@ -0,0 +1,53 @@
+#ifndef TILE_STREAM_H
+#define TILE_STREAM_H
+
+#include <stdbool.h>
+#include "raylib.h"
+#include "torus.h"
+#include "render_layer.h"
+
+#define TILE_SIZE 256.0f                // world units per tile side
+#define TILE_QUADS 32                   // quads per tile side
+#define TILE_VERTS (TILE_QUADS + 1)     // vertices per tile side; neighbours share their edge
+#define TILE_RING 11                    // tiles per side of the resident square, odd
+#define TILE_SLOTS (TILE_RING * TILE_RING)
+#define TILE_BATCH 4                    // tiles the worker evaluates per noise batch
+#define TILE_BYTES (TILE_VERTS * TILE_VERTS * 3 * 2 * (int)sizeof(float))   // vertices and normals
+
+typedef struct TileStream TileStream;
+
+// The flat terrain as an endless plane: it repeats every SCREEN_HEIGHT in x and
+// SCREEN_WIDTH in z, reading heightmap pixel u = z, v = SCREEN_HEIGHT - x like the fixed
+// patch does, so tiles can be built for any position.
+//
+// A TILE_RING x TILE_RING square of tiles follows the focus point. Tile (tx, tz) lives in
+// slot (tx mod TILE_RING, tz mod TILE_RING), so when the focus crosses a tile edge only
+// the row or column of slots that fell off the far side is rebuilt, and the rest stay
+// resident. Every slot owns one dynamic GPU mesh, created up front and rewritten in
+// place, so residency is fixed at TILE_SLOTS tiles and streaming never allocates.
+//
+// A worker thread evaluates the noise directly (terrain_height_batch, with the current
+// slider parameters), nearest queued tiles first. The render thread uploads finished
+// tiles within a byte budget per frame and draws only complete tiles; a tile that is not
+// ready yet is left out rather than waited for. Heights are scaled by a range sampled
+// over one whole period, so tiles agree along their shared edges.
+TileStream *tile_stream_create(const TerrainParams *params);
+void tile_stream_destroy(TileStream *stream);
+// Rebuilds every tile with new parameters; the old tiles are drawn until replaced.
+void tile_stream_set_params(TileStream *stream, const TerrainParams *params);
+// Render thread, once per frame: recentres on focus and uploads at most byteBudget bytes
+// (at least one tile).
+void tile_stream_update(TileStream *stream, Vector3 focus, int byteBudget);
+void tile_stream_draw(TileStream *stream, RenderLayer *layer, Material material);
+
+typedef struct TileStreamStats {
+    int resident;               // slots holding a tile of the current square
+    int pending;                // queued, being built or waiting for upload
+    int uploads;                // tiles uploaded last update
+    int uploadBytes;
+    double buildMs;             // worker time per tile, last batch
+} TileStreamStats;
+
+TileStreamStats tile_stream_stats(TileStream *stream);
+
+#endif // TILE_STREAM_H
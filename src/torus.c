@@ -8,16 +8,14 @@
 #include <float.h>
 
 #include "save.h"
+#include "profiler.h"
+#include "warp_field.h"
+#include "heightmap_sampler.h"
+#include "mem_track.h"
 
 #include <assert.h>
 
-typedef struct TorusCoords {
-    float theta, phi;
-    float cosTheta, sinTheta;
-    float cosPhi, sinPhi;
-} TorusCoords;
-
-static TorusCoords torusCoords = {-1.0f, -1.0f, -1.0f, -1.0f, -1.0f, -1.0f};
+#include <pthread.h>
 
 static float R = -1.0f;
 static float r = -1.0f;
@@ -26,7 +24,24 @@ void SetTorusDimensions(float major, float minor) {
     R = major;
     r = minor;
 }
-#define WRAP_MOD(a, m) (((a) % (m) + (m)) % (m))
+
+void GetTorusDimensions(float *major, float *minor) {
+    *major = R;
+    *minor = r;
+}
+
+static int heightmapWarpFactor = 1;
+
+// 1 evaluates the warp at every heightmap pixel; N > 1 evaluates it on a grid about N
+// pixels apart and interpolates it (see warp_field.h).
+void SetHeightmapWarpFactor(int factor) {
+    heightmapWarpFactor = factor < 1 ? 1 : factor;
+}
+
+int GetHeightmapWarpFactor(void) {
+    return heightmapWarpFactor;
+}
+
 // Generates a torus mesh with the specified number of rings and sides.
 Mesh MyGenTorusMeshBAK(int rings, int sides) {
     int vertexCount = rings * sides;
@@ -100,109 +115,320 @@ Mesh MyGenTorusMeshBAK(int rings, int sides) {
     return mesh;
 }
 
+static pthread_once_t noiseOnce = PTHREAD_ONCE_INIT;
+
+static void init_noise_tables(void) {
+    perlin_init(42);  // consistent seed
+}
+
+void init_terrain_noise(void) {
+    pthread_once(&noiseOnce, init_noise_tables);
+}
+
+static void select_noise(NoiseFunction4D *fn, NoiseFunction4DDeriv *deriv) {
+    NoiseType noiseType = NOISE_PERLIN;  // Change this to switch noise types
+    switch (noiseType) {
+        case NOISE_VALUE:
+            *fn = perlin_noise4d;  // Use Perlin noise
+            *deriv = perlin_noise4d_deriv;
+            break;
+        case NOISE_PERLIN:
+            *fn = perlin_noise4d;  // Use Perlin noise
+            *deriv = perlin_noise4d_deriv;
+            break;
+        case NOISE_SIMPLEX:
+            *fn = simplex4d;  // Use Simplex noise
+            *deriv = simplex4d_deriv;
+            break;
+        default:
+            fprintf(stderr, "Unknown noise type: %d\n", noiseType);
+            exit(1);
+    }
+}
+
+NoiseFunction4D terrain_noise_fn(void) {
+    NoiseFunction4D fn;
+    NoiseFunction4DDeriv deriv;
+    select_noise(&fn, &deriv);
+    return fn;
+}
+
+NoiseFunction4DDeriv terrain_noise_deriv_fn(void) {
+    NoiseFunction4D fn;
+    NoiseFunction4DDeriv deriv;
+    select_noise(&fn, &deriv);
+    return deriv;
+}
+
+// Heightmap pixel (u, v) as the torus angles embedded in 4D.
+static void torus_embedding(float u, float v, float scale, float n[4]) {
+    n[0] = R * cos(u * 2.0f * PI / SCREEN_WIDTH) * scale;
+    n[1] = R * sin(u * 2.0f * PI / SCREEN_WIDTH) * scale;
+    n[2] = r * cos(v * 2.0f * PI / SCREEN_HEIGHT) * scale;
+    n[3] = r * sin(v * 2.0f * PI / SCREEN_HEIGHT) * scale;
+}
+
+static void warp_displacement(const float n[4], float scale, float shift, float footprint, float disp[4]) {
+    NoiseFunction4D fn = terrain_noise_fn();
+    const float disp_offset = 0.1f;
+    const float displacement_strength = 1.0f;
+
+    float sx = n[0] + shift, sy = n[1] + shift, sz = n[2] + shift, sw = n[3] + shift;
+    float f = footprint * scale;  // one pixel moves the 4D position by about scale
+    disp[0] = displacement_strength * fbm4d_fn_filtered(sx + disp_offset, sy, sz, sw, 6, 2.0f, 0.5f, f, fn);
+    disp[1] = displacement_strength * fbm4d_fn_filtered(sx, sy + disp_offset, sz, sw, 6, 2.0f, 0.5f, f, fn);
+    disp[2] = displacement_strength * fbm4d_fn_filtered(sx, sy, sz + disp_offset, sw, 6, 2.0f, 0.5f, f, fn);
+    disp[3] = displacement_strength * fbm4d_fn_filtered(sx, sy, sz, sw + disp_offset, 6, 2.0f, 0.5f, f, fn);
+}
+
+// Domain-warped 4D position of heightmap pixel (u, v): the torus embedding pushed along
+// each axis by its own fBm. The warp fBm itself is not tunable; shift slides the field it
+// samples, which animates the terrain without moving it. footprint is the sample spacing
+// in pixels; the warp drops octaves finer than that (0 keeps them all).
+void terrain_warp(float u, float v, float scale, float shift, float footprint, float out[4]) {
+    float n[4], disp[4];
+    torus_embedding(u, v, scale, n);
+    warp_displacement(n, scale, shift, footprint, disp);
+    for (int a = 0; a < 4; a++) out[a] = n[a] + disp[a];
+}
+
+// Just the displacement terrain_warp adds to the embedding; smooth enough to interpolate.
+void terrain_warp_displacement(float u, float v, float scale, float shift, float footprint, float disp[4]) {
+    float n[4];
+    torus_embedding(u, v, scale, n);
+    warp_displacement(n, scale, shift, footprint, disp);
+}
+
+// terrain_warp plus its Jacobian: jac[0..3] = d(out)/du, jac[4..7] = d(out)/dv.
+void terrain_warp_deriv(float u, float v, float scale, float shift, float footprint, float out[4], float jac[8]) {
+    float a = u * 2.0f * PI / SCREEN_WIDTH;
+    float b = v * 2.0f * PI / SCREEN_HEIGHT;
+    float nx = R * cos(a) * scale;
+    float ny = R * sin(a) * scale;
+    float nz = r * cos(b) * scale;
+    float nw = r * sin(b) * scale;
+    float dn_du[4] = { -R * sinf(a) * scale * 2.0f * PI / SCREEN_WIDTH, R * cosf(a) * scale * 2.0f * PI / SCREEN_WIDTH, 0.0f, 0.0f };
+    float dn_dv[4] = { 0.0f, 0.0f, -r * sinf(b) * scale * 2.0f * PI / SCREEN_HEIGHT, r * cosf(b) * scale * 2.0f * PI / SCREEN_HEIGHT };
+
+    NoiseFunction4DDeriv fn = terrain_noise_deriv_fn();
+    const float disp_offset = 0.1f;
+    const float displacement_strength = 1.0f;
+
+    float sx = nx + shift, sy = ny + shift, sz = nz + shift, sw = nw + shift;
+    float f = footprint * scale;
+    float grad[4][4];
+    float dx = fbm4d_fn_deriv(sx + disp_offset, sy, sz, sw, 6, 2.0f, 0.5f, f, fn, grad[0]);
+    float dy = fbm4d_fn_deriv(sx, sy + disp_offset, sz, sw, 6, 2.0f, 0.5f, f, fn, grad[1]);
+    float dz = fbm4d_fn_deriv(sx, sy, sz + disp_offset, sw, 6, 2.0f, 0.5f, f, fn, grad[2]);
+    float dw = fbm4d_fn_deriv(sx, sy, sz, sw + disp_offset, 6, 2.0f, 0.5f, f, fn, grad[3]);
+
+    out[0] = nx + displacement_strength * dx;
+    out[1] = ny + displacement_strength * dy;
+    out[2] = nz + displacement_strength * dz;
+    out[3] = nw + displacement_strength * dw;
+
+    // d(out_i) = dn_i + strength * grad(warp fBm i) . dn
+    for (int i = 0; i < 4; i++) {
+        float du = 0.0f, dv = 0.0f;
+        for (int k = 0; k < 4; k++) {
+            du += grad[i][k] * dn_du[k];
+            dv += grad[i][k] * dn_dv[k];
+        }
+        jac[i] = dn_du[i] + displacement_strength * du;
+        jac[4 + i] = dn_dv[i] + displacement_strength * dv;
+    }
+}
+
+// The final fBm and contrast curve over a warped position, with the default params.
+static float height_from_warped(const float warped[4]) {
+    const TerrainParams params = TERRAIN_DEFAULT_PARAMS;
+    float warped_noise = fbm4d_fn(warped[0], warped[1], warped[2], warped[3],
+                                  params.octaves, params.lacunarity, params.gain, terrain_noise_fn());
+
+    warped_noise = powf(warped_noise, params.contrast);  // boost height contrast
+    assert(warped_noise >= 0.0f && warped_noise <= 1.0f); // Ensure noise is in [0, 1]
+    return warped_noise;
+}
+
+// Domain-warped fBm height at heightmap pixel (u, v); reentrant once init_terrain_noise() has run.
+float terrain_height(float u, float v) {
+    const TerrainParams params = TERRAIN_DEFAULT_PARAMS;
+    float warped[4];
+    terrain_warp(u, v, params.scale, 0.0f, 0.0f, warped);
+    return height_from_warped(warped);
+}
+
+// terrain_height with the warp displacement interpolated from a coarse field.
+static float terrain_height_from_field(const WarpField *field, float u, float v) {
+    const TerrainParams params = TERRAIN_DEFAULT_PARAMS;
+    float warped[4], disp[4];
+    torus_embedding(u, v, params.scale, warped);
+    warp_field_sample(field, u, v, disp);
+    for (int a = 0; a < 4; a++) warped[a] += disp[a];
+    return height_from_warped(warped);
+}
+
+// Height and its pixel-space gradient from one evaluation, chained through the warp and
+// the contrast curve. The height matches the value-only path bit for bit.
+float terrain_height_deriv(float u, float v, const TerrainParams *params, float shift, float footprint, float *dh_du, float *dh_dv) {
+    float warped[4], jac[8], grad[4];
+    terrain_warp_deriv(u, v, params->scale, shift, footprint, warped, jac);
+    float noise = fbm4d_fn_deriv(warped[0], warped[1], warped[2], warped[3], params->octaves, params->lacunarity,
+                                 params->gain, footprint * params->scale, terrain_noise_deriv_fn(), grad);
+
+    float dF_du = grad[0] * jac[0] + grad[1] * jac[1] + grad[2] * jac[2] + grad[3] * jac[3];
+    float dF_dv = grad[0] * jac[4] + grad[1] * jac[5] + grad[2] * jac[6] + grad[3] * jac[7];
+    float slope = noise > 0.0f ? params->contrast * powf(noise, params->contrast - 1.0f) : 0.0f;
+    *dh_du = slope * dF_du;
+    *dh_dv = slope * dF_dv;
+    return powf(noise, params->contrast);
+}
+
+// Heights at arbitrary pixels, split across OpenMP threads. Matches terrain_height when
+// params are the defaults and shift and footprint are 0. grads is optional: dh/du, dh/dv
+// per sample. A footprint (sample spacing in pixels, see mesh_sample_footprint) skips the
+// octaves the samples would alias, which makes sparse sampling proportionally cheaper.
+void terrain_height_batch(const float *u, const float *v, int count, const TerrainParams *params, float shift, float footprint, float *out, float *grads) {
+    init_terrain_noise();
+    NoiseFunction4D fn = terrain_noise_fn();
+    #pragma omp parallel for schedule(static)
+    for (int k = 0; k < count; k++) {
+        if (grads) {
+            out[k] = terrain_height_deriv(u[k], v[k], params, shift, footprint, &grads[2 * k], &grads[2 * k + 1]);
+            continue;
+        }
+        float warped[4];
+        terrain_warp(u[k], v[k], params->scale, shift, footprint, warped);
+        float height = fbm4d_fn_filtered(warped[0], warped[1], warped[2], warped[3], params->octaves, params->lacunarity,
+                                         params->gain, footprint * params->scale, fn);
+        out[k] = powf(height, params->contrast);
+    }
+}
+
+#define WARP_ERROR_STRIDE 16
+
+// Compares an interpolated-warp heightmap against the exact path on a sparse pixel grid.
+static void report_warp_field_error(const WarpField *field, float **heightmap) {
+    PROF_BEGIN("warp field error");
+    const TerrainParams params = TERRAIN_DEFAULT_PARAMS;
+    double heightSq = 0.0, dispSq = 0.0;
+    float heightMax = 0.0f, dispMax = 0.0f;
+    int samples = 0;
+    #pragma omp parallel for schedule(static) reduction(+:heightSq, dispSq, samples) reduction(max:heightMax, dispMax)
+    for (int v = 0; v < SCREEN_HEIGHT; v += WARP_ERROR_STRIDE) {
+        for (int u = 0; u < SCREEN_WIDTH; u += WARP_ERROR_STRIDE) {
+            float exact[4], approx[4];
+            terrain_warp_displacement(u, v, params.scale, 0.0f, 0.0f, exact);
+            warp_field_sample(field, u, v, approx);
+            for (int a = 0; a < 4; a++) {
+                float d = fabsf(exact[a] - approx[a]);
+                dispSq += d * d;
+                if (d > dispMax) dispMax = d;
+            }
+            float e = fabsf(terrain_height(u, v) - heightmap[v][u]);
+            heightSq += e * e;
+            if (e > heightMax) heightMax = e;
+            samples++;
+        }
+    }
+    printf("Warp field %dx%d (%.1f x %.1f px): height error max %f, rms %f; displacement error max %f, rms %f (%d samples)\n",
+           field->width, field->height, field->spacingU, field->spacingV,
+           heightMax, sqrt(heightSq / samples), dispMax, sqrt(dispSq / (4.0 * samples)), samples);
+    PROF_END();
+}
+
 float **get_heightmap(const char *filename) {
     float **heightmap = NULL;
+    PROF_BEGIN("get_heightmap");
     if(heightmap_exists(filename)) {
         int rows = 0, cols = 0;
         char *fullpath = build_fullpath(S_RESOURCES, S_HEIGHTMAPS, filename);
         heightmap = load_matrix(fullpath, &rows, &cols);
+        free(fullpath);
         assert(heightmap != NULL && rows > 0 && cols > 0);
         assert(rows == SCREEN_HEIGHT && cols == SCREEN_WIDTH);
         printf("Heightmap loaded from %s\n", filename);
+        PROF_END();
         return heightmap;
     } 
     printf("Heightmap does not exist at %s, generating new one.\n", filename);
-    heightmap = malloc(SCREEN_HEIGHT * sizeof(float *));
+    heightmap = mem_alloc(MEM_HEIGHTMAP, SCREEN_HEIGHT * sizeof(float *));
     for (int i = 0; i < SCREEN_HEIGHT; i++) {
-        heightmap[i] = malloc(SCREEN_WIDTH * sizeof(float));
+        heightmap[i] = mem_alloc(MEM_HEIGHTMAP, SCREEN_WIDTH * sizeof(float));
     }
 
-    perlin_init(42);  // consistent seed
-
-    float scale = 0.005f;
+    init_terrain_noise();
 
-    #pragma omp parallel for schedule(static)
-    for (int v = 0; v < SCREEN_HEIGHT; v++) {
-        for (int u = 0; u < SCREEN_WIDTH; u++) {
-            float nx = R * cos(u * 2.0f * PI / SCREEN_WIDTH) * scale;
-            float ny = R * sin(u * 2.0f * PI / SCREEN_WIDTH) * scale;
-            float nz = r * cos(v * 2.0f * PI / SCREEN_HEIGHT) * scale;
-            float nw = r * sin(v * 2.0f * PI / SCREEN_HEIGHT) * scale;
-
-            NoiseType noiseType = NOISE_PERLIN;  // Change this to switch noise types
-            NoiseFunction4D fn = NULL;
-            switch (noiseType) {
-                case NOISE_VALUE:
-                    fn = perlin_noise4d;  // Use Perlin noise
-                    break;
-                case NOISE_PERLIN:
-                    fn = perlin_noise4d;  // Use Perlin noise
-                    break;
-                case NOISE_SIMPLEX:
-                    fn = simplex4d;  // Use Simplex noise
-                    break;
-                default:
-                    fprintf(stderr, "Unknown noise type: %d\n", noiseType);
-                    exit(1);
+    if (heightmapWarpFactor > 1) {
+        const TerrainParams params = TERRAIN_DEFAULT_PARAMS;
+        WarpField *field = warp_field_create(heightmapWarpFactor, params.scale);
+        #pragma omp parallel for schedule(static)
+        for (int v = 0; v < SCREEN_HEIGHT; v++) {
+            PROF_BEGIN("heightmap row");
+            for (int u = 0; u < SCREEN_WIDTH; u++) {
+                heightmap[v][u] = terrain_height_from_field(field, u, v);
             }
-
-            const float disp_offset = 0.1f;
-            const float displacement_strength = 1.0f;
-
-            float dx = fbm4d_fn(nx + disp_offset, ny, nz, nw, 6, 2.0f, 0.5f, fn);
-            float dy = fbm4d_fn(nx, ny + disp_offset, nz, nw, 6, 2.0f, 0.5f, fn);
-            float dz = fbm4d_fn(nx, ny, nz + disp_offset, nw, 6, 2.0f, 0.5f, fn);
-            float dw = fbm4d_fn(nx, ny, nz, nw + disp_offset, 6, 2.0f, 0.5f, fn);
-
-            float warped_noise = fbm4d_fn(
-                nx + displacement_strength * dx,
-                ny + displacement_strength * dy,
-                nz + displacement_strength * dz,
-                nw + displacement_strength * dw,
-                6, 2.0f, 0.5f, fn
-            );
-
-            warped_noise = powf(warped_noise, 4.0f);  // boost height contrast
-            assert(warped_noise >= 0.0f && warped_noise <= 1.0f); // Ensure noise is in [0, 1]
-            heightmap[v][u] = warped_noise;
+            PROF_END();
+        }
+        report_warp_field_error(field, heightmap);
+        warp_field_destroy(field);
+    } else {
+        #pragma omp parallel for schedule(static)
+        for (int v = 0; v < SCREEN_HEIGHT; v++) {
+            PROF_BEGIN("heightmap row");
+            for (int u = 0; u < SCREEN_WIDTH; u++) {
+                heightmap[v][u] = terrain_height(u, v);
+            }
+            PROF_END();
         }
     }
+    PROF_COUNTER("heightmap pixels", (int64_t)SCREEN_WIDTH * SCREEN_HEIGHT);
+    PROF_END();
 
     return heightmap;
 }
 
-// Generates a torus mesh with the specified number of rings and sides.
-Mesh MyGenTorusMesh(int rings, int sides) {
-    unsigned char **image = malloc(SCREEN_HEIGHT * sizeof(unsigned char *));
-    if (!image) {
-        perror("malloc failed");
-        exit(1);
-    }
-
-    for (int y = 0; y < SCREEN_HEIGHT; y++) {
-        image[y] = malloc(SCREEN_WIDTH * sizeof(unsigned char));
-        if (!image[y]) {
-            perror("malloc failed");
-            exit(1);
-        }
-    }
-
-    float **heightmap = get_heightmap("heightmap.bin");
-
+// Heightmap value range used to scale heights onto the mesh.
+void get_heightmap_range(float **heightmap, float *out_min, float *out_max) {
+    PROF_BEGIN("heightmap range");
     float min = FLT_MIN;
     float max = -FLT_MAX;
+    #pragma omp parallel for reduction(min:min) reduction(max:max) schedule(static)
     for (int v = 0; v < SCREEN_HEIGHT; v++) {
         for (int u = 0; u < SCREEN_WIDTH; u++) {
             float height = heightmap[v][u];
             assert(height >= 0.0f && height <= 1.0f); // Ensure noise is in [0, 1]
             if (height < min) min = height;
             if (height > max) max = height;
-            image[v][u] = (unsigned char)(height * 255.0f);
         }
     }
     printf("Heightmap min: %f, max: %f\n", min, max);
+    *out_min = min;
+    *out_max = max;
+    PROF_END();
+}
+
+static unsigned char pgm_pixel(float height) {
+    return (unsigned char)(height * 255.0f);
+}
+
+// Converts the whole image before writing it, unless that would pass the memory budget;
+// then each row is converted into one buffer and written straight away.
+void write_heightmap_pgm(const char *filename, float **heightmap) {
+    PROF_BEGIN("write pgm");
+    size_t imageBytes = (size_t)SCREEN_HEIGHT * (SCREEN_WIDTH + sizeof(unsigned char *));
+    bool streaming = !mem_budget_fits(imageBytes);
+    int rows = streaming ? 1 : SCREEN_HEIGHT;
+    unsigned char **image = mem_alloc(MEM_IMAGE, rows * sizeof(unsigned char *));
+    for (int y = 0; y < rows; y++) {
+        image[y] = mem_alloc(MEM_IMAGE, SCREEN_WIDTH * sizeof(unsigned char));
+        if (streaming) continue;
+        for (int u = 0; u < SCREEN_WIDTH; u++) {
+            image[y][u] = pgm_pixel(heightmap[y][u]);
+        }
+    }
 
-    FILE *f = fopen("heightmap_T.pgm", "wb");
+    FILE *f = fopen(filename, "wb");
     if (!f) {
         perror("Cannot write image");
         exit(1);
@@ -210,7 +436,11 @@ Mesh MyGenTorusMesh(int rings, int sides) {
 
     fprintf(f, "P5\n%d %d\n255\n", SCREEN_WIDTH, SCREEN_HEIGHT);  // P5 = binary greyscale
     for (int y = 0; y < SCREEN_HEIGHT; y++) {
-        if (fwrite(image[y], sizeof(unsigned char), SCREEN_WIDTH, f) != SCREEN_WIDTH) {
+        unsigned char *row = image[streaming ? 0 : y];
+        if (streaming) {
+            for (int u = 0; u < SCREEN_WIDTH; u++) row[u] = pgm_pixel(heightmap[y][u]);
+        }
+        if (fwrite(row, sizeof(unsigned char), SCREEN_WIDTH, f) != SCREEN_WIDTH) {
             perror("Error writing image data");
             fclose(f);
             exit(1);
@@ -218,112 +448,58 @@ Mesh MyGenTorusMesh(int rings, int sides) {
     }
     fclose(f);
 
-    printf("Heightmap written to heightmap_T.pgm\n");
+    printf("Heightmap written to %s%s\n", filename, streaming ? " (streamed, over the memory budget)" : "");
 
     // Free the image memory
-    for (int y = 0; y < SCREEN_HEIGHT; y++) {
-        free(image[y]);
-    }
-    free(image);
-
-    float upper_bound = 400.0f;
-    float lower_bound = 0.0f;
-    float gradient = (upper_bound - lower_bound) / (max - min);
-    printf("Gradient: %f\n", gradient);
-
-
-    // 1. Allocate vertex and normal grids
-    Vector3 **vertexGrid = MemAlloc(rings * sizeof(Vector3 *));
-    Vector3 **normalGrid = MemAlloc(rings * sizeof(Vector3 *));
-    for (int i = 0; i < rings; i++) {
-        vertexGrid[i] = MemAlloc(sides * sizeof(Vector3));
-        normalGrid[i] = MemAlloc(sides * sizeof(Vector3));
-        for (int j = 0; j < sides; j++) {
-            normalGrid[i][j] = (Vector3){0.0f, 0.0f, 0.0f};
-        }
-    }
-
-    // 2. Fill vertexGrid with positions (and optionally sample height)
-    for (int i = 0; i < rings; i++) {
-        float theta = (float)i / rings * 2.0f * PI;
-        float cosTheta = cosf(theta);
-        float sinTheta = sinf(theta);
-        for (int j = 0; j < sides; j++) {
-            float phi = ((float)j / sides) * 2.0f * PI;
-            float cosPhi = cosf(phi);
-            float sinPhi = sinf(phi);
-
-            float x = (R + r * cosPhi) * cosTheta;
-            float y = r * sinPhi;
-            float z = (R + r * cosPhi) * sinTheta;
-
-            float nx = cosPhi * cosTheta;
-            float ny = sinPhi;
-            float nz = cosPhi * sinTheta;
-
-            Vector3 position = (Vector3){ x, y, z };
-            Vector3 normal = (Vector3){ nx, ny, nz };
-
-            int sx = WRAP_MOD((int)z, SCREEN_WIDTH);
-            int sy = WRAP_MOD((int)(SCREEN_HEIGHT - x), SCREEN_HEIGHT);
-
-            float height = heightmap[sy][sx];
-            float adjusted_height = lower_bound + (height - min) * gradient;
-            
-            vertexGrid[i][j] = Vector3Add(position,Vector3Scale(normal, adjusted_height)); 
-        }
+    for (int y = 0; y < rows; y++) {
+        mem_free(MEM_IMAGE, image[y], SCREEN_WIDTH * sizeof(unsigned char));
     }
+    mem_free(MEM_IMAGE, image, rows * sizeof(unsigned char *));
+    PROF_END();
+}
 
-    char *filename = "heightmap.bin";
+// Saves the heightmap to the cache unless it came from there.
+void store_heightmap(const char *filename, float **heightmap) {
     if(!heightmap_exists(filename)) {
         save_heightmap(filename, heightmap, SCREEN_HEIGHT, SCREEN_WIDTH);
         printf("Heightmap saved to %s\n", filename);
     } else {
         printf("Heightmap already exists at %s, skipping save.\n", filename);
     }
+}
+
+// Heightmaps are SCREEN_HEIGHT rows of SCREEN_WIDTH, whether generated or loaded.
+void free_heightmap(float **heightmap) {
     for (int i = 0; i < SCREEN_HEIGHT; i++) {
-        free(heightmap[i]);
+        mem_free(MEM_HEIGHTMAP, heightmap[i], SCREEN_WIDTH * sizeof(float));
     }
-    free(heightmap);
-
+    mem_free(MEM_HEIGHTMAP, heightmap, SCREEN_HEIGHT * sizeof(float *));
+}
 
+static void alloc_grids(Vector3 ***vertexGrid, Vector3 ***normalGrid, int rings, int sides) {
+    *vertexGrid = mem_alloc(MEM_MESH_GRID, rings * sizeof(Vector3 *));
+    *normalGrid = mem_alloc(MEM_MESH_GRID, rings * sizeof(Vector3 *));
     for (int i = 0; i < rings; i++) {
-        int i1 = (i + 1) % rings;
+        (*vertexGrid)[i] = mem_alloc(MEM_MESH_GRID, sides * sizeof(Vector3));
+        (*normalGrid)[i] = mem_alloc(MEM_MESH_GRID, sides * sizeof(Vector3));
         for (int j = 0; j < sides; j++) {
-            int j1 = (j + 1) % sides;
-
-            Vector3 p00 = vertexGrid[i][j];
-            Vector3 p01 = vertexGrid[i][j1];
-            Vector3 p10 = vertexGrid[i1][j];
-            Vector3 p11 = vertexGrid[i1][j1];
-
-            // Triangle 1: p00, p01, p10
-            Vector3 edge1 = Vector3Subtract(p01, p00);
-            Vector3 edge2 = Vector3Subtract(p10, p00);
-            Vector3 n1 = Vector3Normalize(Vector3CrossProduct(edge1, edge2));
-
-            normalGrid[i][j] = Vector3Add(normalGrid[i][j], n1);
-            normalGrid[i][j1] = Vector3Add(normalGrid[i][j1], n1);
-            normalGrid[i1][j] = Vector3Add(normalGrid[i1][j], n1);
-
-            // Triangle 2: p10, p01, p11
-            Vector3 edge3 = Vector3Subtract(p01, p10);
-            Vector3 edge4 = Vector3Subtract(p11, p10);
-            Vector3 n2 = Vector3Normalize(Vector3CrossProduct(edge3, edge4));
-
-            normalGrid[i1][j] = Vector3Add(normalGrid[i1][j], n2);
-            normalGrid[i][j1] = Vector3Add(normalGrid[i][j1], n2);
-            normalGrid[i1][j1] = Vector3Add(normalGrid[i1][j1], n2);
+            (*normalGrid)[i][j] = (Vector3){0.0f, 0.0f, 0.0f};
         }
     }
+}
 
-    // 3. Generate indices (each quad = 2 triangles = 6 indices)
+// 3. Generate indices (each quad = 2 triangles = 6 indices). The flat patch does not
+// wrap, so its last row and column of quads are left as zero (degenerate) triangles.
+static unsigned short *gen_grid_indices(int rings, int sides, bool wrap) {
+    PROF_BEGIN("indices");
     int indexCount = rings * sides * 6;
     unsigned short *indices = MemAlloc(indexCount * sizeof(unsigned short)); // Use uint16 for Raylib
     int k = 0;
-    for (int i = 0; i < rings; i++) {
+    int quadRings = wrap ? rings : rings - 1;
+    int quadSides = wrap ? sides : sides - 1;
+    for (int i = 0; i < quadRings; i++) {
         int i1 = (i + 1) % rings;
-        for (int j = 0; j < sides; j++) {
+        for (int j = 0; j < quadSides; j++) {
             int j1 = (j + 1) % sides;
 
             int v00 = i * sides + j;
@@ -342,8 +518,18 @@ Mesh MyGenTorusMesh(int rings, int sides) {
             indices[k++] = v11;
         }
     }
+    PROF_END();
+    return indices;
+}
 
+// Vertices, normals, texcoords and indices of a grids_to_mesh() mesh
+static size_t mesh_array_bytes(int rings, int sides) {
+    return (size_t)rings * sides * (2 * sizeof(Vector3) + sizeof(Vector2) + 6 * sizeof(unsigned short));
+}
+
+static Mesh grids_to_mesh(Vector3 **vertexGrid, Vector3 **normalGrid, int rings, int sides, bool wrap) {
     int vertexCount = rings * sides;
+    mem_track(MEM_MESH, mesh_array_bytes(rings, sides));
     Vector3 *flatVertices = MemAlloc(vertexCount * sizeof(Vector3));
     Vector3 *flatNormals = MemAlloc(vertexCount * sizeof(Vector3));
     Vector2 *texcoords = MemAlloc(vertexCount * sizeof(Vector2));
@@ -357,201 +543,439 @@ Mesh MyGenTorusMesh(int rings, int sides) {
         }
     }
 
-
-
     Mesh mesh = { 0 };
     mesh.vertexCount = vertexCount;
-    mesh.triangleCount = indexCount / 3;
+    mesh.triangleCount = rings * sides * 2;
     mesh.vertices = (float *)flatVertices;
     mesh.normals = (float *)flatNormals;
     mesh.texcoords = (float *)texcoords;
-    mesh.indices = (unsigned short *)indices;
-
-    UploadMesh(&mesh, false);
+    mesh.indices = gen_grid_indices(rings, sides, wrap);
     return mesh;
 }
 
-Mesh MyGenFlatTorusMesh(int rings, int sides) {
-    unsigned char **image = malloc(SCREEN_HEIGHT * sizeof(unsigned char *));
-    if (!image) {
-        perror("malloc failed");
+TorusTrigTable *torus_trig_table_create(int rings, int sides) {
+    TorusTrigTable *table = calloc(1, sizeof(TorusTrigTable));
+    if (!table) {
+        perror("calloc failed");
         exit(1);
     }
+    table->rings = rings;
+    table->sides = sides;
+    table->theta = mem_alloc(MEM_SCRATCH, rings * 3 * sizeof(float));
+    table->phi = mem_alloc(MEM_SCRATCH, sides * 3 * sizeof(float));
+    table->cosTheta = table->theta + rings;
+    table->sinTheta = table->theta + 2 * rings;
+    table->cosPhi = table->phi + sides;
+    table->sinPhi = table->phi + 2 * sides;
+    for (int i = 0; i < rings; i++) {
+        table->theta[i] = (float)i / rings * 2.0f * PI;
+        table->cosTheta[i] = cosf(table->theta[i]);
+        table->sinTheta[i] = sinf(table->theta[i]);
+    }
+    for (int j = 0; j < sides; j++) {
+        table->phi[j] = (float)j / sides * 2.0f * PI;
+        table->cosPhi[j] = cosf(table->phi[j]);
+        table->sinPhi[j] = sinf(table->phi[j]);
+    }
+    return table;
+}
 
-    for (int y = 0; y < SCREEN_HEIGHT; y++) {
-        image[y] = malloc(SCREEN_WIDTH * sizeof(unsigned char));
-        if (!image[y]) {
-            perror("malloc failed");
-            exit(1);
+void torus_trig_table_destroy(TorusTrigTable *table) {
+    if (!table) return;
+    mem_free(MEM_SCRATCH, table->theta, table->rings * 3 * sizeof(float));
+    mem_free(MEM_SCRATCH, table->phi, table->sides * 3 * sizeof(float));
+    free(table);
+}
+
+// Frames of whole rings from the table, row-major from firstRing. Each output is one simple
+// loop over the ring's sides, so the compiler vectorises it.
+void torus_frames_rows(const TorusTrigTable *table, int firstRing, int ringCount, const TorusFrameArrays *out) {
+    int sides = table->sides;
+    const float *cosPhi = table->cosPhi, *sinPhi = table->sinPhi;
+    for (int i = 0; i < ringCount; i++) {
+        float cosTheta = table->cosTheta[firstRing + i], sinTheta = table->sinTheta[firstRing + i];
+        int offset = i * sides;
+        if (out->px) {
+            float *px = out->px + offset, *py = out->py + offset, *pz = out->pz + offset;
+            #pragma omp simd
+            for (int j = 0; j < sides; j++) {
+                float ring = R + r * cosPhi[j];
+                px[j] = ring * cosTheta;
+                py[j] = r * sinPhi[j];
+                pz[j] = ring * sinTheta;
+            }
+        }
+        if (out->nx) {
+            float *nx = out->nx + offset, *ny = out->ny + offset, *nz = out->nz + offset;
+            #pragma omp simd
+            for (int j = 0; j < sides; j++) {
+                nx[j] = cosPhi[j] * cosTheta;
+                ny[j] = sinPhi[j];
+                nz[j] = cosPhi[j] * sinTheta;
+            }
         }
     }
+}
 
-    float **heightmap = get_heightmap("heightmap.bin");
+// One ring of frames, for the builders' per-ring loops.
+typedef struct RingFrames {
+    TorusFrameArrays arrays;
+    float *data;
+    int sides;
+} RingFrames;
+
+static RingFrames ring_frames_create(int sides) {
+    RingFrames frames = { 0 };
+    frames.sides = sides;
+    frames.data = mem_alloc(MEM_SCRATCH, 6 * sides * sizeof(float));
+    float *d = frames.data;
+    frames.arrays = (TorusFrameArrays){ d, d + sides, d + 2 * sides, d + 3 * sides, d + 4 * sides, d + 5 * sides };
+    return frames;
+}
 
-    float min = FLT_MIN;
-    float max = -FLT_MAX;
-    for (int v = 0; v < SCREEN_HEIGHT; v++) {
-        for (int u = 0; u < SCREEN_WIDTH; u++) {
-            float height = heightmap[v][u];
-            assert(height >= 0.0f && height <= 1.0f); // Ensure noise is in [0, 1]
-            if (height < min) min = height;
-            if (height > max) max = height;
-            image[v][u] = (unsigned char)(height * 255.0f);
-        }
+static void ring_frames_destroy(RingFrames *frames) {
+    mem_free(MEM_SCRATCH, frames->data, 6 * frames->sides * sizeof(float));
+}
+
+static float wrap_coord(float a, float m) {
+    a = fmodf(a, m);
+    if (a < 0.0f) a += m;
+    return a < m ? a : 0.0f;
+}
+
+// Heightmap position (fractional pixels) a vertex samples. The flat patch and the torus
+// read the same position for the same (i, j), so both views show the same terrain.
+static void vertex_pixel(const TorusTrigTable *table, bool flat, int i, int j, float *u, float *v) {
+    float x, z;
+    if (flat) {
+        x = SCREEN_HEIGHT - table->phi[j] * r;
+        z = R * table->theta[i];
+    } else {
+        float ring = R + r * table->cosPhi[j];
+        x = ring * table->cosTheta[i];
+        z = ring * table->sinTheta[i];
     }
-    printf("Heightmap min: %f, max: %f\n", min, max);
+    *u = wrap_coord(z, SCREEN_WIDTH);
+    *v = wrap_coord(SCREEN_HEIGHT - x, SCREEN_HEIGHT);
+}
 
-    FILE *f = fopen("heightmap.pgm", "wb");
-    if (!f) {
-        perror("Cannot write image");
-        exit(1);
+// vertex_pixel at any (theta, phi), for callers that sample between the grid points.
+void surface_pixel(bool flat, float theta, float phi, float *u, float *v) {
+    float x, z;
+    if (flat) {
+        x = SCREEN_HEIGHT - phi * r;
+        z = R * theta;
+    } else {
+        float ring = R + r * cosf(phi);
+        x = ring * cosf(theta);
+        z = ring * sinf(theta);
     }
+    *u = wrap_coord(z, SCREEN_WIDTH);
+    *v = wrap_coord(SCREEN_HEIGHT - x, SCREEN_HEIGHT);
+}
 
-    fprintf(f, "P5\n%d %d\n255\n", SCREEN_WIDTH, SCREEN_HEIGHT);  // P5 = binary greyscale
-    for (int y = 0; y < SCREEN_HEIGHT; y++) {
-        if (fwrite(image[y], sizeof(unsigned char), SCREEN_WIDTH, f) != SCREEN_WIDTH) {
-            perror("Error writing image data");
-            fclose(f);
-            exit(1);
+#define MESH_SAMPLE_MODE SAMPLE_BICUBIC   // smooth heights and normals between heightmap pixels
+
+// Undisplaced position of flat patch vertex (i, j); heights push it straight up. Torus
+// vertices take their frames from torus_frames_rows.
+static Vector3 flat_vertex_base(const TorusTrigTable *table, int i, int j) {
+    return (Vector3){ SCREEN_HEIGHT - table->phi[j] * r, 0.0f, R * table->theta[i] };
+}
+
+void mesh_vertex_frames(bool flat, int rings, int sides, Vector3 *base, Vector3 *dir) {
+    TorusTrigTable *table = torus_trig_table_create(rings, sides);
+    #pragma omp parallel
+    {
+        RingFrames frames = ring_frames_create(sides);
+        const TorusFrameArrays *f = &frames.arrays;
+        #pragma omp for schedule(static)
+        for (int i = 0; i < rings; i++) {
+            if (flat) {
+                for (int j = 0; j < sides; j++) {
+                    base[i * sides + j] = flat_vertex_base(table, i, j);
+                    dir[i * sides + j] = (Vector3){ 0.0f, 1.0f, 0.0f };
+                }
+                continue;
+            }
+            torus_frames_rows(table, i, 1, f);
+            for (int j = 0; j < sides; j++) {
+                base[i * sides + j] = (Vector3){ f->px[j], f->py[j], f->pz[j] };
+                dir[i * sides + j] = (Vector3){ f->nx[j], f->ny[j], f->nz[j] };
+            }
         }
+        ring_frames_destroy(&frames);
     }
-    fclose(f);
+    torus_trig_table_destroy(table);
+}
 
-    printf("Heightmap written to heightmap_T.pgm\n");
+// Displaces the grid by per-vertex heights (row-major, rings * sides); min maps to 0 and
+// every unit of height to gradient world units along the surface normal.
+static void place_vertices(const TorusTrigTable *table, Vector3 **vertexGrid, bool flat, const float *heights, float min, float gradient) {
+    float lower_bound = 0.0f;
+    int rings = table->rings, sides = table->sides;
+    PROF_BEGIN("vertices");
+    #pragma omp parallel
+    {
+        RingFrames frames = ring_frames_create(sides);
+        const TorusFrameArrays *f = &frames.arrays;
+        #pragma omp for schedule(static)
+        for (int i = 0; i < rings; i++) {
+            const float *ringHeights = heights + i * sides;
+            if (flat) {
+                for (int j = 0; j < sides; j++) {
+                    Vector3 position = flat_vertex_base(table, i, j);
+                    position.y = lower_bound + (ringHeights[j] - min) * gradient;
+                    vertexGrid[i][j] = position;
+                }
+                continue;
+            }
+            torus_frames_rows(table, i, 1, f);
+            Vector3 *row = vertexGrid[i];
+            for (int j = 0; j < sides; j++) {
+                float adjusted_height = lower_bound + (ringHeights[j] - min) * gradient;
+                row[j] = (Vector3){ f->px[j] + f->nx[j] * adjusted_height, f->py[j] + f->ny[j] * adjusted_height, f->pz[j] + f->nz[j] * adjusted_height };
+            }
+        }
+        ring_frames_destroy(&frames);
+    }
+    PROF_END();
+}
 
-    // Free the image memory
-    for (int y = 0; y < SCREEN_HEIGHT; y++) {
-        free(image[y]);
+// Exact normal of the displaced surface at vertex (i, j), from the height there and its
+// pixel-space gradient (world units, already scaled like the height). Oriented like the
+// builders' triangles: cross(d/dphi, d/dtheta).
+Vector3 mesh_surface_normal(const TorusTrigTable *table, bool flat, int i, int j, float height, float dheight_du, float dheight_dv) {
+    if (flat) {
+        // u = R theta, v = r phi
+        Vector3 dtheta = { 0.0f, dheight_du * R, R };
+        Vector3 dphi = { -r, dheight_dv * r, 0.0f };
+        return Vector3Normalize(Vector3CrossProduct(dphi, dtheta));
     }
-    free(image);
 
-    float upper_bound = 400.0f;
-    float lower_bound = 0.0f;
-    float gradient = (upper_bound - lower_bound) / (max - min);
-    printf("Gradient: %f\n", gradient);
+    float cosTheta = table->cosTheta[i], sinTheta = table->sinTheta[i];
+    float cosPhi = table->cosPhi[j], sinPhi = table->sinPhi[j];
+    float ring = R + r * cosPhi;
 
+    // The torus samples pixel u = z, v = SCREEN_HEIGHT - x of the undisplaced point
+    float dheight_dtheta = dheight_du * ring * cosTheta + dheight_dv * ring * sinTheta;
+    float dheight_dphi = dheight_du * -r * sinPhi * sinTheta + dheight_dv * r * sinPhi * cosTheta;
 
-    // 1. Allocate vertex and normal grids
-    Vector3 **vertexGrid = MemAlloc(rings * sizeof(Vector3 *));
-    Vector3 **normalGrid = MemAlloc(rings * sizeof(Vector3 *));
+    Vector3 n = { cosPhi * cosTheta, sinPhi, cosPhi * sinTheta };
+    Vector3 dtheta = { -ring * sinTheta - height * cosPhi * sinTheta, 0.0f, ring * cosTheta + height * cosPhi * cosTheta };
+    Vector3 dphi = { -r * sinPhi * cosTheta - height * sinPhi * cosTheta, r * cosPhi + height * cosPhi, -r * sinPhi * sinTheta - height * sinPhi * sinTheta };
+    dtheta = Vector3Add(dtheta, Vector3Scale(n, dheight_dtheta));
+    dphi = Vector3Add(dphi, Vector3Scale(n, dheight_dphi));
+    return Vector3Normalize(Vector3CrossProduct(dphi, dtheta));
+}
+
+// Per-vertex normals straight from the height gradients; no pass over neighbouring faces.
+static void analytic_normals(const TorusTrigTable *table, Vector3 **normalGrid, bool flat, const float *heights, const float *grads, float min, float gradient) {
+    int rings = table->rings, sides = table->sides;
+    PROF_BEGIN("normals");
+    #pragma omp parallel for schedule(static)
     for (int i = 0; i < rings; i++) {
-        vertexGrid[i] = MemAlloc(sides * sizeof(Vector3));
-        normalGrid[i] = MemAlloc(sides * sizeof(Vector3));
         for (int j = 0; j < sides; j++) {
-            normalGrid[i][j] = (Vector3){0.0f, 0.0f, 0.0f};
+            int k = i * sides + j;
+            float height = (heights[k] - min) * gradient;
+            normalGrid[i][j] = mesh_surface_normal(table, flat, i, j, height, grads[2 * k] * gradient, grads[2 * k + 1] * gradient);
         }
     }
+    PROF_END();
+}
 
-    // 2. Fill vertexGrid with positions (and optionally sample height)
+static void free_grids(Vector3 **vertexGrid, Vector3 **normalGrid, int rings, int sides) {
     for (int i = 0; i < rings; i++) {
-        float theta = (float)i / rings * 2.0f * PI;
-        for (int j = 0; j < sides; j++) {
-            float phi = (float)j / sides * 2.0f * PI;
-
-            float x = SCREEN_HEIGHT - phi * r;
-            float z = R * theta;
+        mem_free(MEM_MESH_GRID, vertexGrid[i], sides * sizeof(Vector3));
+        mem_free(MEM_MESH_GRID, normalGrid[i], sides * sizeof(Vector3));
+    }
+    mem_free(MEM_MESH_GRID, vertexGrid, rings * sizeof(Vector3 *));
+    mem_free(MEM_MESH_GRID, normalGrid, rings * sizeof(Vector3 *));
+}
 
-            int sx = WRAP_MOD((int)z, SCREEN_WIDTH);
-            int sy = WRAP_MOD((int)(SCREEN_HEIGHT - x), SCREEN_HEIGHT);
+// Heights are mapped from [min, max] onto [0, 400]; grads holds dh/du, dh/dv per vertex.
+static Mesh build_mesh_from_heights(bool flat, const float *heights, const float *grads, float min, float max, int rings, int sides) {
+    float gradient = MESH_HEIGHT_RANGE / (max - min);
+    printf("Gradient: %f\n", gradient);
 
-            float height = heightmap[sy][sx];
-            float adjusted_height = lower_bound + (height - min) * gradient;
+    Vector3 **vertexGrid = NULL;
+    Vector3 **normalGrid = NULL;
+    alloc_grids(&vertexGrid, &normalGrid, rings, sides);
+    TorusTrigTable *table = torus_trig_table_create(rings, sides);
+    place_vertices(table, vertexGrid, flat, heights, min, gradient);
+    analytic_normals(table, normalGrid, flat, heights, grads, min, gradient);
+    torus_trig_table_destroy(table);
+    Mesh mesh = grids_to_mesh(vertexGrid, normalGrid, rings, sides, !flat);
+    free_grids(vertexGrid, normalGrid, rings, sides);
+    // The caller owns the arrays now, and raylib frees them in UnloadMesh
+    mem_untrack(MEM_MESH, mesh_array_bytes(rings, sides));
+    return mesh;
+}
 
-            vertexGrid[i][j] = (Vector3){ x, adjusted_height, z };
+void mesh_sample_pixels(bool flat, int rings, int sides, float *u, float *v) {
+    TorusTrigTable *table = torus_trig_table_create(rings, sides);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < rings; i++) {
+        for (int j = 0; j < sides; j++) {
+            vertex_pixel(table, flat, i, j, &u[i * sides + j], &v[i * sides + j]);
         }
     }
+    torus_trig_table_destroy(table);
+}
 
-    char *filename = "heightmap.bin";
-    if(!heightmap_exists(filename)) {
-        save_heightmap(filename, heightmap, SCREEN_HEIGHT, SCREEN_WIDTH);
-        printf("Heightmap saved to %s\n", filename);
-    } else {
-        printf("Heightmap already exists at %s, skipping save.\n", filename);
-    }
-    for (int i = 0; i < SCREEN_HEIGHT; i++) {
-        free(heightmap[i]);
+// Largest pixel distance between neighbouring vertices: the finest detail the mesh can show.
+float mesh_sample_footprint(bool flat, int rings, int sides) {
+    float alongRing = flat ? (float)SCREEN_WIDTH / rings : (R + r) * 2.0f * PI / rings;
+    float acrossRing = (float)SCREEN_HEIGHT / sides;
+    return alongRing > acrossRing ? alongRing : acrossRing;
+}
+
+// Fills vertex and normal arrays (3 floats each per vertex) from new heights and their
+// gradients, scaled to the heights' own range. Touches no shared state, so worker threads may call it.
+void mesh_vertices_from_heights(float *vertices, float *normals, bool flat, const float *heights, const float *grads, int rings, int sides) {
+    float min = FLT_MAX;
+    float max = -FLT_MAX;
+    for (int k = 0; k < rings * sides; k++) {
+        if (heights[k] < min) min = heights[k];
+        if (heights[k] > max) max = heights[k];
     }
-    free(heightmap);
+    if (max <= min) max = min + 1.0f;
+    float gradient = MESH_HEIGHT_RANGE / (max - min);
+
+    Vector3 **vertexGrid = NULL;
+    Vector3 **normalGrid = NULL;
+    alloc_grids(&vertexGrid, &normalGrid, rings, sides);
+    TorusTrigTable *table = torus_trig_table_create(rings, sides);
+    place_vertices(table, vertexGrid, flat, heights, min, gradient);
+    analytic_normals(table, normalGrid, flat, heights, grads, min, gradient);
+    torus_trig_table_destroy(table);
 
     for (int i = 0; i < rings; i++) {
-        int i1 = (i + 1) % rings;
         for (int j = 0; j < sides; j++) {
-            int j1 = (j + 1) % sides;
+            ((Vector3 *)vertices)[i * sides + j] = vertexGrid[i][j];
+            ((Vector3 *)normals)[i * sides + j] = normalGrid[i][j];
+        }
+    }
+    free_grids(vertexGrid, normalGrid, rings, sides);
+}
 
-            Vector3 p00 = vertexGrid[i][j];
-            Vector3 p01 = vertexGrid[i][j1];
-            Vector3 p10 = vertexGrid[i1][j];
-            Vector3 p11 = vertexGrid[i1][j1];
+// Rewrites the CPU vertex and normal arrays in place from new heights and, when the
+// mesh is on the GPU, refreshes just those two buffers. Tangents are left stale; the
+// lighting shader does not read them.
+void update_mesh_heights(Mesh *mesh, bool flat, const float *heights, const float *grads, int rings, int sides) {
+    PROF_BEGIN("update_mesh_heights");
+    mesh_vertices_from_heights(mesh->vertices, mesh->normals, flat, heights, grads, rings, sides);
+    if (mesh->vboId != NULL) {
+        int size = mesh->vertexCount * 3 * sizeof(float);
+        UpdateMeshBuffer(*mesh, 0, mesh->vertices, size, 0);  // SHADER_LOC_VERTEX_POSITION
+        UpdateMeshBuffer(*mesh, 2, mesh->normals, size, 0);   // SHADER_LOC_VERTEX_NORMAL
+    }
+    PROF_END();
+}
 
-            // Triangle 1: p00, p01, p10
-            Vector3 edge1 = Vector3Subtract(p01, p00);
-            Vector3 edge2 = Vector3Subtract(p10, p00);
-            Vector3 n1 = Vector3Normalize(Vector3CrossProduct(edge1, edge2));
+// Heights and their gradients at every vertex's position, interpolated from the heightmap.
+static Mesh build_from_heightmap(float **heightmap, bool flat, float min, float max, int rings, int sides) {
+    int count = rings * sides;
+    float *u = mem_alloc(MEM_SCRATCH, count * sizeof(float));
+    float *v = mem_alloc(MEM_SCRATCH, count * sizeof(float));
+    float *heights = mem_alloc(MEM_SCRATCH, count * sizeof(float));
+    float *grads = mem_alloc(MEM_SCRATCH, 2 * count * sizeof(float));
+    mesh_sample_pixels(flat, rings, sides, u, v);
+    HeightmapSampler sampler = heightmap_sampler(heightmap, SCREEN_WIDTH, SCREEN_HEIGHT, MESH_SAMPLE_MODE);
+    PROF_BEGIN("sample heightmap");
+    heightmap_sample_batch(&sampler, u, v, count, heights, grads);
+    PROF_END();
+    Mesh mesh = build_mesh_from_heights(flat, heights, grads, min, max, rings, sides);
+    mem_free(MEM_SCRATCH, u, count * sizeof(float));
+    mem_free(MEM_SCRATCH, v, count * sizeof(float));
+    mem_free(MEM_SCRATCH, heights, count * sizeof(float));
+    mem_free(MEM_SCRATCH, grads, 2 * count * sizeof(float));
+    return mesh;
+}
 
-            normalGrid[i][j] = Vector3Add(normalGrid[i][j], n1);
-            normalGrid[i][j1] = Vector3Add(normalGrid[i][j1], n1);
-            normalGrid[i1][j] = Vector3Add(normalGrid[i1][j], n1);
+// Builds the displaced torus on the CPU only; the caller uploads it. Safe to run off the main thread.
+Mesh build_torus_mesh(float **heightmap, float min, float max, int rings, int sides) {
+    PROF_BEGIN("build_torus_mesh");
+    Mesh mesh = build_from_heightmap(heightmap, false, min, max, rings, sides);
+    PROF_END();
+    return mesh;
+}
 
-            // Triangle 2: p10, p01, p11
-            Vector3 edge3 = Vector3Subtract(p01, p10);
-            Vector3 edge4 = Vector3Subtract(p11, p10);
-            Vector3 n2 = Vector3Normalize(Vector3CrossProduct(edge3, edge4));
+// Builds the flat (unrolled) terrain patch on the CPU only; the caller uploads it.
+Mesh build_flat_torus_mesh(float **heightmap, float min, float max, int rings, int sides) {
+    PROF_BEGIN("build_flat_torus_mesh");
+    Mesh mesh = build_from_heightmap(heightmap, true, min, max, rings, sides);
+    PROF_END();
+    return mesh;
+}
 
-            normalGrid[i1][j] = Vector3Add(normalGrid[i1][j], n2);
-            normalGrid[i][j1] = Vector3Add(normalGrid[i][j1], n2);
-            normalGrid[i1][j1] = Vector3Add(normalGrid[i1][j1], n2);
-        }
+// Coarse stand-in shown while the full mesh is built: evaluates the noise directly at
+// each vertex's pixel, with only the octaves the vertex spacing can resolve, so it needs
+// no heightmap and takes milliseconds at low resolution.
+// The height range comes from the samples themselves. CPU only; the caller uploads it.
+Mesh build_preview_mesh(bool flat, int rings, int sides) {
+    PROF_BEGIN("build_preview_mesh");
+    int count = rings * sides;
+    float *u = mem_alloc(MEM_SCRATCH, count * sizeof(float));
+    float *v = mem_alloc(MEM_SCRATCH, count * sizeof(float));
+    float *heights = mem_alloc(MEM_SCRATCH, count * sizeof(float));
+    float *grads = mem_alloc(MEM_SCRATCH, 2 * count * sizeof(float));
+    const TerrainParams params = TERRAIN_DEFAULT_PARAMS;
+    mesh_sample_pixels(flat, rings, sides, u, v);
+    terrain_height_batch(u, v, count, &params, 0.0f, mesh_sample_footprint(flat, rings, sides), heights, grads);
+
+    float min = FLT_MAX;
+    float max = -FLT_MAX;
+    for (int k = 0; k < count; k++) {
+        if (heights[k] < min) min = heights[k];
+        if (heights[k] > max) max = heights[k];
     }
+    if (max <= min) max = min + 1.0f;  // keep the gradient finite on a flat sample
+
+    Mesh mesh = build_mesh_from_heights(flat, heights, grads, min, max, rings, sides);
+    mem_free(MEM_SCRATCH, u, count * sizeof(float));
+    mem_free(MEM_SCRATCH, v, count * sizeof(float));
+    mem_free(MEM_SCRATCH, heights, count * sizeof(float));
+    mem_free(MEM_SCRATCH, grads, 2 * count * sizeof(float));
+    PROF_END();
+    return mesh;
+}
 
-    // 3. Generate indices (each quad = 2 triangles = 6 indices)
-    int indexCount = rings * sides * 6;
-    unsigned short *indices = MemAlloc(indexCount * sizeof(unsigned short)); // Use uint16 for Raylib
-    int k = 0;
-    for (int i = 0; i < rings - 1; i++) {
-        int i1 = i + 1;
-        for (int j = 0; j < sides - 1; j++) {
-            int j1 = j + 1;
+// Generates a torus mesh with the specified number of rings and sides.
+Mesh MyGenTorusMesh(int rings, int sides) {
+    PROF_BEGIN("MyGenTorusMesh");
+    float **heightmap = get_heightmap("heightmap.bin");
+    float min, max;
+    get_heightmap_range(heightmap, &min, &max);
+    write_heightmap_pgm("heightmap_T.pgm", heightmap);
 
-            int v00 = i * sides + j;
-            int v01 = i * sides + j1;
-            int v10 = i1 * sides + j;
-            int v11 = i1 * sides + j1;
+    Mesh mesh = build_torus_mesh(heightmap, min, max, rings, sides);
 
-            // Triangle 1
-            indices[k++] = v00;
-            indices[k++] = v01;
-            indices[k++] = v10;
+    store_heightmap("heightmap.bin", heightmap);
+    free_heightmap(heightmap);
 
-            // Triangle 2
-            indices[k++] = v10;
-            indices[k++] = v01;
-            indices[k++] = v11;
-        }
-    }
+    PROF_BEGIN("UploadMesh");
+    UploadMesh(&mesh, false);
+    PROF_END();
+    PROF_END();
+    return mesh;
+}
 
-    int vertexCount = rings * sides;
-    Vector3 *flatVertices = MemAlloc(vertexCount * sizeof(Vector3));
-    Vector3 *flatNormals = MemAlloc(vertexCount * sizeof(Vector3));
-    Vector2 *texcoords = MemAlloc(vertexCount * sizeof(Vector2));
+Mesh MyGenFlatTorusMesh(int rings, int sides) {
+    PROF_BEGIN("MyGenFlatTorusMesh");
+    float **heightmap = get_heightmap("heightmap.bin");
+    float min, max;
+    get_heightmap_range(heightmap, &min, &max);
+    write_heightmap_pgm("heightmap.pgm", heightmap);
 
-    for (int i = 0; i < rings; i++) {
-        for (int j = 0; j < sides; j++) {
-            int idx = i * sides + j;
-            flatVertices[idx] = vertexGrid[i][j];
-            flatNormals[idx] = Vector3Normalize(normalGrid[i][j]);
-            texcoords[idx] = (Vector2){ (float)j / sides, (float)i / rings };
-        }
-    }
+    Mesh mesh = build_flat_torus_mesh(heightmap, min, max, rings, sides);
 
-    Mesh mesh = { 0 };
-    mesh.vertexCount = vertexCount;
-    mesh.triangleCount = indexCount / 3;
-    mesh.vertices = (float *)flatVertices;
-    mesh.normals = (float *)flatNormals;
-    mesh.texcoords = (float *)texcoords;
-    mesh.indices = (unsigned short *)indices;
+    store_heightmap("heightmap.bin", heightmap);
+    free_heightmap(heightmap);
 
+    PROF_BEGIN("UploadMesh");
     UploadMesh(&mesh, false);
+    PROF_END();
+    PROF_END();
     return mesh;
 }
 
@@ -568,71 +992,26 @@ float get_phi(float v) {
 Vector3 get_torus_normal(float u, float v) {
     float theta = get_theta(u);
     float phi = get_phi(v);
-
-    float nx = cosf(phi) * cosf(theta);
-    float ny = sinf(phi);
-    float nz = cosf(phi) * sinf(theta);
-
-    return (Vector3){ nx, ny, nz };
+    float cosPhi = cosf(phi);
+    return (Vector3){ cosPhi * cosf(theta), sinf(phi), cosPhi * sinf(theta) };
 }
 
 Vector3 get_phi_tangent(float u, float v) {
     float theta = get_theta(u);
     float phi = get_phi(v);
-
-    float tx = -sinf(phi) * cosf(theta);
-    float ty = cosf(phi);
-    float tz = -sinf(phi) * sinf(theta);
-
-    return (Vector3){ tx, ty, tz };
+    float sinPhi = sinf(phi);
+    return (Vector3){ -sinPhi * cosf(theta), cosf(phi), -sinPhi * sinf(theta) };
 }
 
 Vector3 get_theta_tangent(float u, float v) {
+    (void)v;
     float theta = get_theta(u);
-
-    float tx = -sinf(theta);
-    float ty = 0.0f;
-    float tz =  cosf(theta);
-
-    return (Vector3){ tx, ty, tz };
+    return (Vector3){ -sinf(theta), 0.0f, cosf(theta) };
 }
 
 Vector3 get_torus_position(float u, float v) {
     float theta = get_theta(u);
     float phi = get_phi(v);
-
-    float x = (R + r * cosf(phi)) * cosf(theta);
-    float y = r * sinf(phi);
-    float z = (R + r * cosf(phi)) * sinf(theta);
-
-    return (Vector3){ x, y, z };
-}
-
-void set_torus_coords(float u, float v) {
-    torusCoords.theta = get_theta(u);
-    torusCoords.phi = get_phi(v);
-    torusCoords.cosTheta = cosf(torusCoords.theta);
-    torusCoords.sinTheta = sinf(torusCoords.theta);
-    torusCoords.cosPhi = cosf(torusCoords.phi);
-    torusCoords.sinPhi = sinf(torusCoords.phi);
-}
-
-Vector3 get_torus_position_fast() {
-    return (Vector3){ (R + r * torusCoords.cosPhi) * torusCoords.cosTheta,
-                      r * torusCoords.sinPhi,
-                      (R + r * torusCoords.cosPhi) * torusCoords.sinTheta };
-}
-
-Vector3 get_torus_normal_fast() {
-    return (Vector3){ torusCoords.cosPhi * torusCoords.cosTheta,
-                      torusCoords.sinPhi,
-                      torusCoords.cosPhi * torusCoords.sinTheta };
-}
-Vector3 get_theta_tangent_fast() {
-    return (Vector3){ -torusCoords.sinTheta, 0.0f, torusCoords.cosTheta };
+    float ring = R + r * cosf(phi);
+    return (Vector3){ ring * cosf(theta), r * sinf(phi), ring * sinf(theta) };
 }
-Vector3 get_phi_tangent_fast() {
-    return (Vector3){ -torusCoords.sinPhi * torusCoords.cosTheta,
-                      torusCoords.cosPhi,
-                      -torusCoords.sinPhi * torusCoords.sinTheta };
-}
\ No newline at end of file
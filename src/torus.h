@@ -3,24 +3,95 @@
 
 #include "raylib.h"
 #include "raymath.h"
+#include "fbm_with_function_pointer.h"
 #include <math.h>
 
 extern int SCREEN_WIDTH;
 extern int SCREEN_HEIGHT;
 
+// Tunable terrain shape: the final fBm over the warped coordinates and the contrast exponent.
+typedef struct TerrainParams {
+    float scale;        // noise units per torus unit
+    int octaves;
+    float lacunarity;
+    float gain;
+    float contrast;     // height = fbm^contrast
+} TerrainParams;
+
+// Heights are scaled to [0, MESH_HEIGHT_RANGE] world units over the heightmap's range
+#define MESH_HEIGHT_RANGE 400.0f
+
+#define TERRAIN_DEFAULT_PARAMS ((TerrainParams){ 0.005f, 6, 2.0f, 0.5f, 4.0f })
+
 void SetTorusDimensions(float major, float minor);
+void GetTorusDimensions(float *major, float *minor);
+void SetHeightmapWarpFactor(int factor);
+int GetHeightmapWarpFactor(void);
 Mesh MyGenTorusMesh(int rings, int sides);
 Mesh MyGenFlatTorusMesh(int rings, int sides);
 
+// The stages MyGen*Mesh run in sequence, for callers that schedule them separately.
+// None of them touch the GPU.
+float **get_heightmap(const char *filename);
+void get_heightmap_range(float **heightmap, float *out_min, float *out_max);
+void write_heightmap_pgm(const char *filename, float **heightmap);
+void store_heightmap(const char *filename, float **heightmap);
+void free_heightmap(float **heightmap);
+Mesh build_torus_mesh(float **heightmap, float min, float max, int rings, int sides);
+Mesh build_flat_torus_mesh(float **heightmap, float min, float max, int rings, int sides);
+
+// Direct noise evaluation, for callers that cannot wait for the heightmap.
+// init_terrain_noise is idempotent and thread-safe; terrain_height is reentrant after it.
+void init_terrain_noise(void);
+NoiseFunction4D terrain_noise_fn(void);
+NoiseFunction4DDeriv terrain_noise_deriv_fn(void);
+void terrain_warp(float u, float v, float scale, float shift, float footprint, float out[4]);
+void terrain_warp_displacement(float u, float v, float scale, float shift, float footprint, float disp[4]);
+void terrain_warp_deriv(float u, float v, float scale, float shift, float footprint, float out[4], float jac[8]);
+float terrain_height(float u, float v);
+float terrain_height_deriv(float u, float v, const TerrainParams *params, float shift, float footprint, float *dh_du, float *dh_dv);
+void terrain_height_batch(const float *u, const float *v, int count, const TerrainParams *params, float shift, float footprint, float *out, float *grads);
+Mesh build_preview_mesh(bool flat, int rings, int sides);
+
+// sin/cos of every ring angle theta_i = 2 pi i / rings and side angle phi_j = 2 pi j / sides
+// of a regular grid, shared read-only so grid loops do no trigonometry.
+typedef struct TorusTrigTable {
+    int rings, sides;
+    float *theta, *cosTheta, *sinTheta;     // per ring
+    float *phi, *cosPhi, *sinPhi;           // per side
+} TorusTrigTable;
+
+TorusTrigTable *torus_trig_table_create(int rings, int sides);
+void torus_trig_table_destroy(TorusTrigTable *table);
+
+// Interactive editing: the heightmap pixel each vertex samples (row-major, rings * sides),
+// and an in-place height refresh of a mesh built with the same rings and sides.
+void mesh_sample_pixels(bool flat, int rings, int sides, float *u, float *v);
+void surface_pixel(bool flat, float theta, float phi, float *u, float *v);
+float mesh_sample_footprint(bool flat, int rings, int sides);
+void mesh_vertex_frames(bool flat, int rings, int sides, Vector3 *base, Vector3 *dir);
+// grads holds dh/du, dh/dv per vertex, as terrain_height_batch writes them.
+void mesh_vertices_from_heights(float *vertices, float *normals, bool flat, const float *heights, const float *grads, int rings, int sides);
+void update_mesh_heights(Mesh *mesh, bool flat, const float *heights, const float *grads, int rings, int sides);
+Vector3 mesh_surface_normal(const TorusTrigTable *table, bool flat, int i, int j, float height, float dheight_du, float dheight_dv);
+
+float get_theta(float u);
+float get_phi(float v);
 Vector3 get_torus_position(float u, float v);
 Vector3 get_torus_normal(float u, float v);
 Vector3 get_phi_tangent(float u, float v);
 Vector3 get_theta_tangent(float u, float v);
 
-void set_torus_coords(float u, float v);
-Vector3 get_torus_position_fast();
-Vector3 get_torus_normal_fast();
-Vector3 get_theta_tangent_fast();
-Vector3 get_phi_tangent_fast();
+// Positions and outward normals of the undisplaced torus in structure-of-arrays form.
+// Either group may be left NULL; the x, y and z arrays of a group go together.
+typedef struct TorusFrameArrays {
+    float *px, *py, *pz;        // position
+    float *nx, *ny, *nz;        // outward normal
+} TorusFrameArrays;
+
+// Frames of vertices (i, j) for ringCount rings from firstRing, row-major (i * sides + j)
+// from firstRing, with no trigonometry. Reentrant and serial: callers split rings across
+// threads. The mesh builders and mesh_vertex_frames fill each ring through it.
+void torus_frames_rows(const TorusTrigTable *table, int firstRing, int ringCount, const TorusFrameArrays *out);
 
 #endif // TORUS_H
\ No newline at end of file
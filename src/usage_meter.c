@@ -0,0 +1,68 @@
+#include "usage_meter.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#define RAPL_PATH "/sys/class/powercap/intel-rapl:0/"
+
+static double wall_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double cpu_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// A RAPL counter in joules, or -1 if it can't be read.
+static double read_joules(const char *name) {
+    FILE *f = fopen(name, "r");
+    if (!f) return -1.0;
+    unsigned long long microjoules;
+    int read = fscanf(f, "%llu", &microjoules);
+    fclose(f);
+    return read == 1 ? microjoules * 1e-6 : -1.0;
+}
+
+static void start_window(UsageMeter *meter) {
+    meter->wallStart = wall_seconds();
+    meter->cpuStart = cpu_seconds();
+    meter->energyStart = read_joules(RAPL_PATH "energy_uj");
+    meter->frames = 0;
+}
+
+void usage_meter_init(UsageMeter *meter) {
+    *meter = (UsageMeter){ 0 };
+    meter->energyRange = read_joules(RAPL_PATH "max_energy_range_uj");
+    start_window(meter);
+}
+
+void usage_meter_frame(UsageMeter *meter) {
+    meter->frames++;
+}
+
+void usage_meter_update(UsageMeter *meter, int mode) {
+    if (mode != meter->mode) {
+        meter->mode = mode;
+        start_window(meter);
+        return;
+    }
+    double elapsed = wall_seconds() - meter->wallStart;
+    if (elapsed < USAGE_METER_WINDOW) return;
+
+    UsageSample *sample = &meter->modes[mode];
+    sample->valid = true;
+    sample->fps = meter->frames / elapsed;
+    sample->cpuPercent = 100.0 * (cpu_seconds() - meter->cpuStart) / elapsed;
+    sample->watts = -1.0f;
+    double energy = read_joules(RAPL_PATH "energy_uj");
+    if (energy >= 0.0 && meter->energyStart >= 0.0) {
+        double used = energy - meter->energyStart;
+        if (used < 0.0 && meter->energyRange > 0.0) used += meter->energyRange;
+        if (used >= 0.0) sample->watts = used / elapsed;
+    }
+    start_window(meter);
+}
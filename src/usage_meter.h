@@ -0,0 +1,32 @@
+#ifndef USAGE_METER_H
+#define USAGE_METER_H
+
+#include <stdbool.h>
+
+#define USAGE_METER_MODES 2         // one result per redraw mode, to compare them
+#define USAGE_METER_WINDOW 2.0      // seconds per measurement
+
+typedef struct UsageSample {
+    bool valid;
+    float fps;                      // frames drawn per second
+    float cpuPercent;               // process CPU time, all threads, in percent of one core
+    float watts;                    // CPU package power, or -1 where RAPL can't be read
+} UsageSample;
+
+// Measures what the process costs while the app runs in one mode, so the modes can be
+// compared on the overlay. Power comes from the Linux RAPL counter of the first CPU
+// package, which is often root-only; GPU power is not measured.
+typedef struct UsageMeter {
+    int mode;
+    double wallStart, cpuStart, energyStart;
+    double energyRange;             // the RAPL counter wraps here, in joules
+    int frames;
+    UsageSample modes[USAGE_METER_MODES];
+} UsageMeter;
+
+void usage_meter_init(UsageMeter *meter);
+void usage_meter_frame(UsageMeter *meter);
+// Call at least once per loop; a mode change starts a new measurement.
+void usage_meter_update(UsageMeter *meter, int mode);
+
+#endif // USAGE_METER_H
@@ -0,0 +1,66 @@
+#include "warp_field.h"
+#include "torus.h"
+#include "profiler.h"
+#include "heightmap_sampler.h"
+#include "mem_track.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+WarpField *warp_field_create(int factor, float scale) {
+    PROF_BEGIN("warp field");
+    WarpField *field = mem_calloc(MEM_HEIGHTMAP, sizeof(WarpField));
+    if (factor < 1) factor = 1;
+    field->width = (SCREEN_WIDTH + factor - 1) / factor;
+    field->height = (SCREEN_HEIGHT + factor - 1) / factor;
+    if (field->width < 4) field->width = 4;     // the bicubic stencil needs four distinct nodes
+    if (field->height < 4) field->height = 4;
+    field->spacingU = (float)SCREEN_WIDTH / field->width;
+    field->spacingV = (float)SCREEN_HEIGHT / field->height;
+    field->disp = mem_alloc(MEM_HEIGHTMAP, field->width * field->height * 4 * sizeof(float));
+
+    // Nodes keep every warp octave: band-limiting them to the node spacing measured about
+    // twice the error of interpolating the full warp at 1/8 resolution
+    init_terrain_noise();
+    #pragma omp parallel for schedule(static)
+    for (int j = 0; j < field->height; j++) {
+        for (int i = 0; i < field->width; i++) {
+            terrain_warp_displacement(i * field->spacingU, j * field->spacingV, scale, 0.0f, 0.0f,
+                                      &field->disp[(j * field->width + i) * 4]);
+        }
+    }
+    PROF_COUNTER("warp field nodes", (int64_t)field->width * field->height);
+    PROF_END();
+    return field;
+}
+
+void warp_field_sample(const WarpField *field, float u, float v, float out[4]) {
+    float gu = u / field->spacingU;
+    float gv = v / field->spacingV;
+    int i0 = (int)floorf(gu);
+    int j0 = (int)floorf(gv);
+    float wu[4], wv[4];
+    catmull_rom_weights(gu - i0, wu, NULL);
+    catmull_rom_weights(gv - j0, wv, NULL);
+
+    int cols[4];
+    for (int a = 0; a < 4; a++) cols[a] = WRAP_MOD(i0 - 1 + a, field->width);
+    out[0] = out[1] = out[2] = out[3] = 0.0f;
+    for (int b = 0; b < 4; b++) {
+        const float *row = &field->disp[WRAP_MOD(j0 - 1 + b, field->height) * field->width * 4];
+        for (int a = 0; a < 4; a++) {
+            const float *node = &row[cols[a] * 4];
+            float w = wu[a] * wv[b];
+            out[0] += node[0] * w;
+            out[1] += node[1] * w;
+            out[2] += node[2] * w;
+            out[3] += node[3] * w;
+        }
+    }
+}
+
+void warp_field_destroy(WarpField *field) {
+    if (!field) return;
+    mem_free(MEM_HEIGHTMAP, field->disp, field->width * field->height * 4 * sizeof(float));
+    mem_free(MEM_HEIGHTMAP, field, sizeof(WarpField));
+}